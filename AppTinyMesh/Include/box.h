@@ -6,6 +6,7 @@
 #include <iostream>
 
 #include "mathematics.h"
+#include "ray.h"
 
 class Box
 {
@@ -48,6 +49,9 @@ public:
   // Compute sub-box
   Box Sub(int) const;
 
+  // Intersection
+  bool Intersect(const Ray&, double&, double&) const;
+
   // Translation, scale
   void Translate(const Vector&);
   void Scale(double);
@@ -57,6 +57,10 @@ public:
   // Pixel and sub-pixel sampling
   Ray PixelToRay(int, int, int, int) const;
   bool VectorToPixel(const Vector&, double&, double&, int, int) const;
+
+  // Clipping planes
+  void FrustumPlanes(Vector[6], double[6], int, int) const;
+  void OrthographicFrustumPlanes(Vector[6], double[6], double) const;
 };
 
 //! Returns the look-at point.
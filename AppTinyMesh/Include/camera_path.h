@@ -0,0 +1,34 @@
+// Camera path
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "camera.h"
+
+class CameraPath
+{
+protected:
+  std::vector<Vector> eyes; //!< Eye of every keyframe.
+  std::vector<Vector> ats;  //!< Look-at point of every keyframe.
+  std::vector<Vector> ups;  //!< Up vector of every keyframe.
+public:
+  //! Empty.
+  CameraPath() {}
+
+  bool Load(const std::string&);
+  void Append(const Vector&, const Vector&, const Vector& = Vector::Z);
+  int Size() const;
+
+  Camera Evaluate(double, double = 1.0, double = 100000.0) const;
+  std::vector<Camera> Sample(int, double = 1.0, double = 100000.0) const;
+};
+
+/*!
+\brief Number of keyframes.
+*/
+inline int CameraPath::Size() const
+{
+  return int(eyes.size());
+}
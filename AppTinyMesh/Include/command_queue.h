@@ -0,0 +1,51 @@
+// Command queue
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+/*!
+\class CommandQueue command_queue.h
+\brief Lock-free queue of commands, pushed by any thread and executed by a single consumer thread.
+
+Commands are stored in a linked list: pushing a command is a single atomic exchange, and popping
+only reads the list. Commands are moved into the queue, so that the data they capture changes
+hands without being copied.
+
+\code
+CommandQueue queue;
+queue.Push([m = std::move(mesh)] { Upload(m); }); // Producer
+CommandQueue::Command command;
+while (queue.Pop(command))                         // Consumer
+  command();
+\endcode
+
+A command pushed while another one is being pushed may only become visible once the other
+push is complete, which does not matter as the consumer is woken up by every producer.
+*/
+class CommandQueue
+{
+public:
+  typedef std::function<void()> Command;
+protected:
+  //! Node of the list.
+  struct Node
+  {
+    std::atomic<Node*> next{ nullptr }; //!< Next node, pushed later.
+    Command command;                    //!< Command.
+  };
+
+  std::atomic<Node*> head;  //!< Last node pushed.
+  Node* tail;               //!< Node preceding the next command, its command has already been popped.
+public:
+  CommandQueue();
+  ~CommandQueue();
+
+  CommandQueue(const CommandQueue&) = delete;
+  CommandQueue& operator=(const CommandQueue&) = delete;
+
+  void Push(Command&&);
+  bool Pop(Command&);
+  bool Empty() const;
+};
@@ -0,0 +1,50 @@
+// Frustum
+
+#pragma once
+
+#include <vector>
+
+#include "box.h"
+#include "camera.h"
+
+//! Set of axis aligned boxes stored as arrays of centers and half sizes, for batched culling.
+class BoxArray
+{
+public:
+  std::vector<float> cx, cy, cz; //!< Centers.
+  std::vector<float> ex, ey, ez; //!< Half sizes.
+public:
+  //! Empty.
+  BoxArray() {}
+
+  void Clear();
+  void Reserve(int);
+  void Append(const Box&);
+  int Size() const;
+};
+
+/*!
+\brief Number of boxes.
+*/
+inline int BoxArray::Size() const
+{
+  return int(cx.size());
+}
+
+class Frustum
+{
+protected:
+  float nx[6], ny[6], nz[6]; //!< Inward normals of the planes.
+  float c[6];                //!< Offsets of the planes.
+public:
+  explicit Frustum(const Camera&, int, int);
+  explicit Frustum(const Camera&, double);
+
+  //! Empty.
+  ~Frustum() {}
+
+  bool Intersect(const Box&) const;
+  int Cull(const BoxArray&, std::vector<unsigned char>&) const;
+protected:
+  void Set(const Vector[6], const double[6]);
+};
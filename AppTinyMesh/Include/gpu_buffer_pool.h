@@ -0,0 +1,65 @@
+// Gpu buffer pool
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "shader-api.h"
+
+//! Range of bytes handed out by a GpuBufferPool.
+struct GpuRange
+{
+  GLuint buffer = 0;  //!< Buffer storing the range, owned by the pool.
+  size_t offset = 0;  //!< Offset of the range in the buffer, in bytes.
+  size_t size = 0;    //!< Size of the range, in bytes.
+  int page = -1;      //!< Page of the pool, -1 for an empty range.
+
+  //! Check if the range is empty.
+  bool IsNull() const { return page < 0; }
+};
+
+class GpuBufferPool
+{
+public:
+  //! Memory usage of the pool.
+  struct Stats
+  {
+    int pages = 0;              //!< Number of buffers.
+    size_t reserved = 0;        //!< Size of all the buffers, in bytes.
+    size_t inUse = 0;           //!< Bytes handed out.
+    size_t largestFree = 0;     //!< Largest free block, in bytes.
+    int freeBlocks = 0;         //!< Number of free blocks.
+    double fragmentation = 0.0; //!< Part of the free memory outside of the largest free block of its buffer.
+    int allocations = 0;        //!< Number of buffers created since the pool was created.
+  };
+protected:
+  //! Buffer split into ranges.
+  struct Page
+  {
+    GLuint buffer = 0;                  //!< Buffer, 0 if the page was released.
+    size_t size = 0;                    //!< Size of the buffer.
+    size_t used = 0;                    //!< Bytes handed out.
+    bool dedicated = false;             //!< Created for a single range larger than a page, released once freed.
+    std::map<size_t, size_t> free;      //!< Free blocks, sizes indexed by offset.
+  };
+
+  std::vector<Page> pages;  //!< Pages, their indexes never change.
+  size_t pageSize;          //!< Size of the buffers created by the pool.
+  size_t alignment;         //!< Alignment of the ranges.
+  int allocations = 0;      //!< Buffers created so far.
+public:
+  explicit GpuBufferPool(size_t = size_t(16) << 20, size_t = 16);
+
+  //! Empty, pages must be released with Release() while the OpenGL context is current.
+  ~GpuBufferPool() {}
+
+  GpuRange Allocate(size_t);
+  void Free(GpuRange&);
+  void Write(const GpuRange&, size_t, size_t, const void*) const;
+  void Release();
+
+  Stats GetStats() const;
+protected:
+  int CreatePage(size_t, bool);
+};
@@ -1,27 +1,127 @@
 #pragma once
 
 #include "mesh.h"
+#include "camera.h"
+#include "height_field_tiles.h"
 
 #include<string>
 #include<vector>
+#include<memory>
 
 class HeightField
 {
 protected:
-    std::vector<int> points;
-    double scale;
+    //! Level of the min/max elevation pyramid.
+    struct MinMaxLevel
+    {
+        int nx, ny;             //!< Number of nodes along each axis.
+        std::vector<int> zmin;  //!< Lowest sample of every node.
+        std::vector<int> zmax;  //!< Highest sample of every node.
+    };
+
+    std::vector<int> points;    //!< Elevation samples, stored row by row.
+    double scale = 1.0;         //!< Vertical scale applied to the integer samples.
+    int nx = 0;                 //!< Number of samples along x.
+    int ny = 0;                 //!< Number of samples along y.
+    std::vector<MinMaxLevel> pyramid; //!< Min/max pyramid over grid cells, finest level first.
+    int leaf = 0;               //!< Finest pyramid nodes cover 2<SUP>leaf</SUP> cells along each axis.
+    std::shared_ptr<HeightFieldTiles> tiles; //!< Tiled storage replacing the samples array, if any.
 public:
     HeightField() {};
     explicit HeightField(const char*);
     explicit HeightField(const char*, double);
+    explicit HeightField(int, int, const std::vector<int>&, double = 1.0);
 
     ~HeightField() {};
 
     std::vector<int>& get_points();
     void load(const char*);
+    bool load_tiles(const char*, size_t = 64);
+    bool IsTiled() const;
+    size_t TileFailures() const;
+    void Prefetch(const Camera&, int, int) const;
 
-    double get_scale();
+    double get_scale() const;
     void set_scale(double);
 
     Mesh get_mesh();
+
+    int SizeX() const;
+    int SizeY() const;
+
+    int Sample(int, int) const;
+    double Elevation(int, int) const;
+    Vector Vertex(int, int) const;
+    Vector Normal(int, int) const;
+    Box GetBox() const;
+
+    void BuildPyramid();
+    bool Intersect(const Ray&, double&) const;
+protected:
+    Box CellBox(int, int, int) const;
 };
+
+/*!
+\brief Number of samples along the x axis.
+*/
+inline int HeightField::SizeX() const
+{
+    return nx;
+}
+
+/*!
+\brief Number of samples along the y axis.
+*/
+inline int HeightField::SizeY() const
+{
+    return ny;
+}
+
+/*!
+\brief Check if the samples are paged in from a tiled file.
+*/
+inline bool HeightField::IsTiled() const
+{
+    return tiles != nullptr;
+}
+
+/*!
+\brief Number of tiles that could not be read from the tiled file, zero if the samples are stored in memory.
+*/
+inline size_t HeightField::TileFailures() const
+{
+    return tiles ? tiles->Failures() : 0;
+}
+
+/*!
+\brief Integer value of a grid sample, before scaling.
+
+Indexes are clamped to the grid domain.
+\param i, j Integer coordinates of the sample.
+*/
+inline int HeightField::Sample(int i, int j) const
+{
+    i = i < 0 ? 0 : (i >= nx ? nx - 1 : i);
+    j = j < 0 ? 0 : (j >= ny ? ny - 1 : j);
+    return tiles ? tiles->At(i, j) : points[j * nx + i];
+}
+
+/*!
+\brief Scaled elevation of a grid sample.
+
+Indexes are clamped to the grid domain.
+\param i, j Integer coordinates of the sample.
+*/
+inline double HeightField::Elevation(int i, int j) const
+{
+    return Sample(i, j) * scale;
+}
+
+/*!
+\brief Vertex of the grid. Samples are spaced by one unit in the horizontal plane.
+\param i, j Integer coordinates of the sample.
+*/
+inline Vector HeightField::Vertex(int i, int j) const
+{
+    return Vector(double(i), double(j), Elevation(i, j));
+}
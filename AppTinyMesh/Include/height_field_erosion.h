@@ -0,0 +1,75 @@
+#pragma once
+
+#include "height_field.h"
+
+#include <vector>
+
+class HeightFieldErosion
+{
+public:
+    //! Parameters of the hydraulic erosion.
+    struct HydraulicParameters
+    {
+        double dt = 0.02;           //!< Time step.
+        double rain = 0.01;         //!< Water added to every cell per unit of time.
+        double gravity = 9.81;      //!< Gravity.
+        double capacity = 1.0;      //!< Sediment capacity per unit of water height and velocity.
+        double dissolving = 0.3;    //!< Dissolving constant.
+        double deposition = 0.3;    //!< Deposition constant.
+        double evaporation = 0.015; //!< Evaporation constant.
+        double minSlope = 0.05;     //!< Lowest sine of the local tilt angle used to compute the sediment capacity.
+    };
+protected:
+    int nx = 0;             //!< Number of samples along x.
+    int ny = 0;             //!< Number of samples along y.
+    double scale = 1.0;     //!< Vertical scale of the height field.
+
+    // Simulation buffers, one value per sample
+    std::vector<float> terrain;     //!< Terrain elevation.
+    std::vector<float> water;       //!< Water height.
+    std::vector<float> sediment;    //!< Suspended sediment.
+    std::vector<float> left;        //!< Outflow to the left neighbor, also used by the thermal erosion.
+    std::vector<float> right;       //!< Outflow to the right neighbor.
+    std::vector<float> bottom;      //!< Outflow to the bottom neighbor.
+    std::vector<float> top;         //!< Outflow to the top neighbor.
+    std::vector<float> u;           //!< Water velocity along x.
+    std::vector<float> v;           //!< Water velocity along y.
+    std::vector<float> transported; //!< Sediment after advection.
+    bool flowing = false;           //!< Outflow buffers hold the water fluxes of the hydraulic erosion, not the material moved by the thermal erosion.
+public:
+    explicit HeightFieldErosion(const HeightField&);
+
+    //! Empty.
+    ~HeightFieldErosion() {}
+
+    void Thermal(int, double = 0.7, double = 0.25);
+    void Hydraulic(int);
+    void Hydraulic(int, const HydraulicParameters&);
+
+    double Elevation(int, int) const;
+    double Water(int, int) const;
+    HeightField GetHeightField() const;
+protected:
+    void Flux(const HydraulicParameters&);
+    void Flow(const HydraulicParameters&);
+    void Erode(const HydraulicParameters&);
+    void Transport(float);
+};
+
+/*!
+\brief Elevation of the eroded terrain at a grid sample.
+\param i, j Integer coordinates of the sample.
+*/
+inline double HeightFieldErosion::Elevation(int i, int j) const
+{
+    return terrain[size_t(j) * nx + i];
+}
+
+/*!
+\brief Water height at a grid sample.
+\param i, j Integer coordinates of the sample.
+*/
+inline double HeightFieldErosion::Water(int i, int j) const
+{
+    return water[size_t(j) * nx + i];
+}
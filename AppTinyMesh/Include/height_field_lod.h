@@ -0,0 +1,77 @@
+#pragma once
+
+#include "height_field.h"
+#include "camera.h"
+
+#include <vector>
+
+class HeightFieldLOD
+{
+public:
+    //! Node of the chunk quadtree.
+    struct Chunk
+    {
+        int x, y;           //!< Lower corner, in grid samples.
+        int span;           //!< Number of full resolution cells covered by a side of the chunk.
+        int level;          //!< Depth in the quadtree, the root is at level 0.
+        double error;       //!< Geometric error, maximum vertical deviation from the full resolution grid.
+        Box box;            //!< Bounding box of the full resolution samples.
+        int children[4];    //!< Children indexes, -1 if missing.
+    };
+protected:
+    const HeightField* field;       //!< Height field, not owned.
+    int resolution;                 //!< Number of cells along a side of every chunk mesh.
+    std::vector<Chunk> chunks;      //!< Quadtree nodes, parents are stored before their children.
+    std::vector<double> levelError; //!< Maximum geometric error per level.
+public:
+    explicit HeightFieldLOD(const HeightField&, int = 32);
+
+    //! Empty.
+    ~HeightFieldLOD() {}
+
+    const HeightField& GetField() const;
+    int Chunks() const;
+    const Chunk& GetChunk(int) const;
+    int Step(int) const;
+
+    std::vector<int> Select(const Camera&, int, int, double = 2.0) const;
+    Mesh GetMesh(int) const;
+protected:
+    int Build(int, int, int, int);
+    void ComputeError(Chunk&) const;
+};
+
+/*!
+\brief Return the height field.
+*/
+inline const HeightField& HeightFieldLOD::GetField() const
+{
+    return *field;
+}
+
+/*!
+\brief Return the number of chunks in the quadtree.
+*/
+inline int HeightFieldLOD::Chunks() const
+{
+    return int(chunks.size());
+}
+
+/*!
+\brief Return a chunk of the quadtree.
+\param i Index.
+*/
+inline const HeightFieldLOD::Chunk& HeightFieldLOD::GetChunk(int i) const
+{
+    return chunks[i];
+}
+
+/*!
+\brief Return the sampling step of a chunk, in full resolution cells.
+\param i Index.
+*/
+inline int HeightFieldLOD::Step(int i) const
+{
+    int s = chunks[i].span / resolution;
+    return s < 1 ? 1 : s;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "height_field.h"
+
+#include <vector>
+#include <unordered_map>
+
+class HeightFieldRTIN
+{
+protected:
+    const HeightField* field;   //!< Height field, not owned.
+    int size;                   //!< Side of the triangulated grid, a power of two plus one.
+    std::vector<float> errors;  //!< Per vertex error map.
+public:
+    explicit HeightFieldRTIN(const HeightField&);
+
+    //! Empty.
+    ~HeightFieldRTIN() {}
+
+    int Size() const;
+    double Error(int, int) const;
+
+    Mesh GetMesh(double) const;
+    static int Cracks(const HeightField&, const Mesh&);
+protected:
+    void ComputeError(int, int, int, int, int, int, int, bool);
+    void Refine(int, int, int, int, int, int, double, std::unordered_map<int, int>&, std::vector<Vector>&, std::vector<Vector>&, std::vector<int>&) const;
+    int Insert(int, int, std::unordered_map<int, int>&, std::vector<Vector>&, std::vector<Vector>&) const;
+};
+
+/*!
+\brief Return the side of the triangulated grid.
+*/
+inline int HeightFieldRTIN::Size() const
+{
+    return size;
+}
+
+/*!
+\brief Return the error of a vertex, i.e. the error at which it is inserted in the triangulation.
+\param i, j Integer coordinates of the vertex.
+*/
+inline double HeightFieldRTIN::Error(int i, int j) const
+{
+    return errors[size_t(j) * size + i];
+}
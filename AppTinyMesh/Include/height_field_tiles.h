@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class HeightField;
+
+class HeightFieldTiles
+{
+protected:
+    //! Samples of a tile, shared with the threads still reading them after an eviction.
+    using Samples = std::shared_ptr<const std::vector<int32_t>>;
+
+    //! Tile resident in memory.
+    struct Tile
+    {
+        Samples samples;                    //!< Samples, stored row by row.
+        std::list<int>::iterator recent;    //!< Position in the least recently used list.
+    };
+
+    std::string path;           //!< File name.
+    bool valid = false;         //!< Whether the header and the size of the file are consistent.
+    int nx = 0;                 //!< Number of samples along x.
+    int ny = 0;                 //!< Number of samples along y.
+    int tile = 0;               //!< Number of samples along a side of a tile.
+    int tx = 0;                 //!< Number of tiles along x.
+    int ty = 0;                 //!< Number of tiles along y.
+    size_t capacity;            //!< Maximum number of resident tiles.
+    const unsigned long long id; //!< Identifier of the instance, keys the per-thread last tile.
+
+    mutable std::mutex mutex;                       //!< Protects the cache, the file handles and the request queue.
+    mutable std::unordered_map<int, Tile> cache;    //!< Resident tiles.
+    mutable std::list<int> recent;                  //!< Resident tiles, most recently used first.
+    mutable std::unordered_set<int> loading;        //!< Tiles being read outside of the lock.
+    mutable std::condition_variable loaded;         //!< Signals the end of a read to the threads waiting for the tile.
+    mutable std::vector<FILE*> files;               //!< Open handles not used by any read.
+    mutable size_t loads = 0;                       //!< Number of tiles read from disk.
+    mutable size_t failures = 0;                    //!< Number of tiles that could not be read.
+
+    std::deque<int> requests;           //!< Tiles waiting to be prefetched, most urgent first.
+    std::condition_variable pending;    //!< Signals new requests to the prefetch thread.
+    bool stop = false;                  //!< Stops the prefetch thread.
+    std::thread worker;                 //!< Prefetch thread.
+public:
+    explicit HeightFieldTiles(const char*, size_t = 64);
+    ~HeightFieldTiles();
+
+    HeightFieldTiles(const HeightFieldTiles&) = delete;
+    HeightFieldTiles& operator=(const HeightFieldTiles&) = delete;
+
+    bool IsValid() const;
+    int SizeX() const;
+    int SizeY() const;
+    int TileSize() const;
+    size_t Loads() const;
+    size_t Failures() const;
+
+    int At(int, int) const;
+    void Prefetch(const std::vector<int>&);
+    int TileIndex(int, int) const;
+
+    static bool Save(const char*, const HeightField&, int = 256);
+protected:
+    Samples Load(int) const;
+    bool Read(int, std::vector<int32_t>&) const;
+    Samples Insert(int, std::vector<int32_t>&, bool) const;
+    void Run();
+};
+
+/*!
+\brief Check if the tiled file could be opened.
+*/
+inline bool HeightFieldTiles::IsValid() const
+{
+    return valid;
+}
+
+/*!
+\brief Number of samples along the x axis.
+*/
+inline int HeightFieldTiles::SizeX() const
+{
+    return nx;
+}
+
+/*!
+\brief Number of samples along the y axis.
+*/
+inline int HeightFieldTiles::SizeY() const
+{
+    return ny;
+}
+
+/*!
+\brief Number of samples along a side of a tile.
+*/
+inline int HeightFieldTiles::TileSize() const
+{
+    return tile;
+}
+
+/*!
+\brief Index of the tile containing a sample.
+\param i, j Integer coordinates of the sample.
+*/
+inline int HeightFieldTiles::TileIndex(int i, int j) const
+{
+    return (j / tile) * tx + i / tile;
+}
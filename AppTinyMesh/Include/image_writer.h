@@ -0,0 +1,44 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <QtGui/QImage>
+#include <QtCore/QString>
+
+class ImageWriter
+{
+protected:
+    //! Image waiting to be written.
+    struct Job
+    {
+        QImage image;   //!< Image.
+        QString name;   //!< File name, the format is given by its suffix.
+    };
+
+    mutable std::mutex mutex;           //!< Protects the queue and the counters.
+    std::deque<Job> jobs;               //!< Images waiting to be written, oldest first.
+    std::condition_variable pending;    //!< Signals new jobs to the worker thread.
+    mutable std::condition_variable done; //!< Signals that the queue has been emptied.
+    bool busy = false;                  //!< An image is being encoded.
+    bool stop = false;                  //!< Stops the worker thread.
+    int written = 0;                    //!< Number of images written.
+    int failed = 0;                     //!< Number of images that could not be written.
+    std::thread worker;                 //!< Worker thread.
+public:
+    ImageWriter();
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    void Save(const QImage&, const QString&);
+    void Wait() const;
+    int Pending() const;
+    int Written() const;
+    int Failed() const;
+protected:
+    void Run();
+};
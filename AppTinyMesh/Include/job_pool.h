@@ -0,0 +1,99 @@
+// Job pool
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+\class JobPool job_pool.h
+\brief Pool of worker threads running jobs in the background, which may be cancelled.
+
+Jobs belong to the generation that was current when they were submitted. Cancelling starts a new
+generation: queued jobs of older generations are dropped, and running ones are expected to poll
+their token and return early. A job reports its progress through its token.
+
+\code
+JobPool pool;
+pool.Cancel();                                       // Supersede previous jobs
+pool.Submit([](const JobPool::Token& token)
+  {
+    for (int i = 0; i < n && !token.Cancelled(); i++)
+    {
+      Step(i);
+      token.Progress(double(i + 1) / n);
+    }
+  },
+  [](int generation, double progress) { ... });      // Called by the worker thread
+\endcode
+*/
+class JobPool
+{
+public:
+  typedef std::function<void(int, double)> ProgressCallback;
+
+  //! State of a job, given to the job when it runs.
+  class Token
+  {
+  protected:
+    const JobPool* pool;              //!< Pool.
+    int generation;                   //!< Generation of the job.
+    const ProgressCallback* progress; //!< Progress callback, may be empty.
+  public:
+    //! Create a token.
+    Token(const JobPool* pool, int generation, const ProgressCallback* progress) : pool(pool), generation(generation), progress(progress) {}
+
+    //! Check if the job was cancelled since it was submitted.
+    bool Cancelled() const { return !pool->Current(generation); }
+    //! Return the generation of the job.
+    int Generation() const { return generation; }
+    //! Report the progress of the job, between 0 and 1.
+    void Progress(double p) const { if (progress != nullptr && *progress) (*progress)(generation, p); }
+  };
+
+  typedef std::function<void(const Token&)> Job;
+protected:
+  //! Job waiting for a worker.
+  struct Entry
+  {
+    Job job;                    //!< Job.
+    ProgressCallback progress;  //!< Progress callback.
+    int generation;             //!< Generation when the job was submitted.
+  };
+
+  std::vector<std::thread> workers;   //!< Worker threads.
+  std::deque<Entry> queue;            //!< Jobs waiting for a worker.
+  std::mutex mutex;                   //!< Protects the queue and the counters.
+  std::condition_variable wake;       //!< Wakes the workers up.
+  std::condition_variable idle;       //!< Signaled when every job is done.
+  std::atomic<int> generation{ 0 };   //!< Current generation.
+  int running = 0;                    //!< Number of jobs being run.
+  bool quit = false;                  //!< Stops the workers.
+public:
+  explicit JobPool(int = 0);
+  ~JobPool();
+
+  JobPool(const JobPool&) = delete;
+  JobPool& operator=(const JobPool&) = delete;
+
+  int Submit(Job&&, ProgressCallback&& = ProgressCallback());
+  int Cancel();
+  bool Current(int) const;
+  void Wait();
+protected:
+  void Work();
+};
+
+/*!
+\brief Check if a generation is still the current one, i.e., if its jobs were not cancelled.
+\param g Generation.
+*/
+inline bool JobPool::Current(int g) const
+{
+  return generation.load(std::memory_order_acquire) == g;
+}
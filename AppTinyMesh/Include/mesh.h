@@ -1,6 +1,8 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
+#include <string>
 
 #include "box.h"
 #include "capsule.h"
@@ -85,8 +87,12 @@ inline Triangle::Triangle(const Vector& a, const Vector& b, const Vector& c)
   p[2] = c;
 }
 
+/*!
+\brief Callback reporting the progress of a long computation, between 0 and 1.
 
-class QString;
+Returns false to cancel the computation, whose result is then left empty.
+*/
+typedef std::function<bool(double)> BuildProgress;
 
 class Mesh
 {
@@ -100,6 +106,10 @@ public:
   explicit Mesh(const std::vector<Vector>&, const std::vector<int>&);
   explicit Mesh(const std::vector<Vector>&, const std::vector<Vector>&, const std::vector<int>&, const std::vector<int>&);
   ~Mesh();
+  Mesh(const Mesh&) = default;
+  Mesh(Mesh&&) = default;
+  Mesh& operator=(const Mesh&) = default;
+  Mesh& operator=(Mesh&&) = default;
 
   void Reserve(int, int, int, int);
 
@@ -138,17 +148,18 @@ public:
   explicit Mesh(const Disc&,  int);
   explicit Mesh(const Cone&, int);
   explicit Mesh(const Cylinder&, int);
-  explicit Mesh(const Sphere&, int);
-  explicit Mesh(const Tore&, int);
-  explicit Mesh(const Capsule&, int);
+  explicit Mesh(const Sphere&, int, const BuildProgress& = BuildProgress());
+  explicit Mesh(const Tore&, int, const BuildProgress& = BuildProgress());
+  explicit Mesh(const Capsule&, int, const BuildProgress& = BuildProgress());
 
-  void Load(const QString&);
-  void SaveObj(const QString&, const QString&) const;
+  bool Load(const std::string&);
+  bool SaveObj(const std::string&, const std::string&) const;
 protected:
   void AddTriangle(int, int, int, int);
   void AddSmoothTriangle(int, int, int, int, int, int);
   void AddSmoothQuadrangle(int, int, int, int, int, int, int, int);
   void AddQuadrangle(int, int, int, int);
+  bool Continue(const BuildProgress&, double);
 };
 
 /*!
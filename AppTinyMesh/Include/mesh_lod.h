@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+
+class MeshLOD
+{
+public:
+    //! Level of detail, a range of the index chain.
+    struct Level
+    {
+        int first;      //!< First index.
+        int count;      //!< Number of indexes, three per triangle.
+        double error;   //!< Geometric error, maximum distance between a vertex and the vertex replacing it.
+    };
+
+    static const int Bits = 10; //!< Bits per axis of the finest clustering grid.
+protected:
+    std::vector<Level> levels;  //!< Levels, from the full resolution mesh to the coarsest one.
+    std::vector<int> indexes;   //!< Index chain, the indexes of all the levels one after the other.
+public:
+    //! Empty.
+    MeshLOD() {}
+    explicit MeshLOD(int);
+    explicit MeshLOD(const float*, int, int = 256);
+
+    int Levels() const;
+    const Level& operator[](int) const;
+    int Size() const;
+    const std::vector<int>& Indexes() const;
+    void ReleaseIndexes();
+
+    int Select(double, int, double, double = 0.25) const;
+protected:
+    int Coarsest(double, double) const;
+};
+
+/*!
+\brief Return the number of levels.
+*/
+inline int MeshLOD::Levels() const
+{
+    return int(levels.size());
+}
+
+/*!
+\brief Return a level, 0 being the full resolution mesh.
+\param i Level.
+*/
+inline const MeshLOD::Level& MeshLOD::operator[](int i) const
+{
+    return levels[i];
+}
+
+/*!
+\brief Return the number of indexes of the whole chain.
+*/
+inline int MeshLOD::Size() const
+{
+    return levels.empty() ? 0 : levels.back().first + levels.back().count;
+}
+
+/*!
+\brief Return the index chain, empty once released.
+*/
+inline const std::vector<int>& MeshLOD::Indexes() const
+{
+    return indexes;
+}
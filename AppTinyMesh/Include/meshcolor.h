@@ -15,8 +15,13 @@ public:
   explicit MeshColor(const Mesh&);
   explicit MeshColor(const Mesh&, const std::vector<Color>&, const std::vector<int>&);
   ~MeshColor();
+  MeshColor(const MeshColor&) = default;
+  MeshColor(MeshColor&&) = default;
+  MeshColor& operator=(const MeshColor&) = default;
+  MeshColor& operator=(MeshColor&&) = default;
 
   Color GetColor(int) const;
+  int ColorIndex(int, int) const;
   std::vector<Color> GetColors() const;
   std::vector<int> ColorIndexes() const;
 };
@@ -31,6 +36,16 @@ inline Color MeshColor::GetColor(int i) const
   return colors[i];
 }
 
+/*!
+\brief Get the color index of a given triangle.
+\param t Triangle index.
+\param i Vertex index.
+*/
+inline int MeshColor::ColorIndex(int t, int i) const
+{
+  return carray[t * 3 + i];
+}
+
 /*!
 \brief Get the array of colors.
 */
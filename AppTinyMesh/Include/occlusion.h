@@ -0,0 +1,62 @@
+// Occlusion
+
+#pragma once
+
+#include <vector>
+
+#include "frustum.h"
+
+class OcclusionBuffer
+{
+public:
+  static const int Lanes = 8;   //!< Pixels tested at the same time when rasterizing.
+  static const int Band = 8;    //!< Rows of the depth buffer rasterized by a thread.
+protected:
+  //! Occluder triangle set up for rasterization.
+  struct Setup
+  {
+    float l[3][3];      //!< Edge functions, as linear functions of the pixel coordinates.
+    float z[3];         //!< Depth as a linear function of the pixel coordinates.
+    float dz;           //!< Largest depth variation from the center to the corners of a pixel.
+    int x0, y0, x1, y1; //!< Bounding box, in pixels, upper bounds excluded.
+  };
+
+  int width = 0;                          //!< Width of the finest level.
+  int height = 0;                         //!< Height of the finest level.
+  std::vector<int> widths, heights;       //!< Sizes of the levels.
+  std::vector<std::vector<float>> maxima; //!< Farthest occluder depth of every texel, per level.
+  std::vector<std::vector<float>> minima; //!< Nearest occluder depth of every texel, per level.
+  float matrix[16];                       //!< Projection times view matrix, column major.
+  std::vector<Setup> setups;              //!< Occluder triangles of the frame.
+public:
+  OcclusionBuffer(int = 256, int = 128);
+
+  void Resize(int, int);
+  void Clear(const float*);
+  void Add(const float*, int, const float*);
+  void Build();
+
+  bool IsVisible(const Vector&, const Vector&) const;
+  int Cull(const BoxArray&, std::vector<unsigned char>&) const;
+
+  int Width() const;
+  int Height() const;
+protected:
+  void RasterizeBand(int, int);
+};
+
+/*!
+\brief Return the width of the finest level.
+*/
+inline int OcclusionBuffer::Width() const
+{
+  return width;
+}
+
+/*!
+\brief Return the height of the finest level.
+*/
+inline int OcclusionBuffer::Height() const
+{
+  return height;
+}
@@ -4,6 +4,9 @@
 #include <QtWidgets/qmainwindow.h>
 #include "realtime.h"
 #include "meshcolor.h"
+#include "height_field_lod.h"
+#include "job_pool.h"
+#include <memory>
 
 QT_BEGIN_NAMESPACE
 	namespace Ui { class Assets; }
@@ -16,13 +19,33 @@ private:
   Ui::Assets* uiw;           //!< Interface
 
   MeshWidget* meshWidget;   //!< Viewer
-  MeshColor meshColor;		//!< Mesh.
+  HeightField* heightField = nullptr; //!< Terrain.
+  HeightFieldLOD* terrain = nullptr; //!< Terrain level of detail.
+
+  //! Result of a generation job, handed over to the viewer once the job is complete.
+  struct Generation
+  {
+    MeshColor mesh;                                 //!< Mesh.
+    std::vector<MeshWidget::InstanceFrame> frames;  //!< Instances, the mesh is drawn once if empty.
+    std::unique_ptr<HeightField> field;             //!< Terrain, replacing the meshes if any.
+    std::unique_ptr<HeightFieldLOD> terrain;        //!< Terrain level of detail.
+    double time = 0.0;                              //!< Generation time, in microseconds.
+  };
+  typedef std::function<void(Generation&, const JobPool::Token&)> Generator;
+
+  JobPool jobs;             //!< Workers running the generation jobs, destroyed first.
 
 public:
   MainWindow();
   ~MainWindow();
   void CreateActions();
-  void UpdateGeometry();
+  void UpdateGeometry(MeshColor&&);
+  bool Benchmark(const QString&, const CameraPath&, int, const QString&, int, int);
+protected:
+  void Generate(Generator&&);
+  void Apply(int, Generation&&);
+signals:
+  void _signalGenerated();
 
 public slots:
   void editingSceneLeft(const Ray&);
@@ -39,6 +62,7 @@ public slots:
   void ComplexMeshExample();
 
   void SphereImplicitExample();
+  void HeightFieldExample();
   void ResetCamera();
   void UpdateMaterial();
 };
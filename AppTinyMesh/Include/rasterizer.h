@@ -0,0 +1,109 @@
+// Rasterizer
+
+#pragma once
+
+#include <vector>
+
+#include "camera.h"
+#include "color.h"
+
+class Mesh;
+class MeshColor;
+
+class Rasterizer
+{
+public:
+  //! Materials, with the same shading as the mesh shader.
+  enum class Material
+  {
+    Normal = 0,
+    Color = 1,
+  };
+
+  static const int TileSize = 64;   //!< Side of the tiles processed by the threads, in pixels.
+  static const int Lanes = 8;       //!< Pixels tested at the same time by the inner loop.
+protected:
+  //! Triangle set up for rasterization.
+  struct Setup
+  {
+    float l[3][3];      //!< Barycentric coordinates as linear functions of the pixel coordinates.
+    float z[3];         //!< Depth as a linear function of the pixel coordinates.
+    float w[3];         //!< Inverse of the homogeneous coordinate of the vertices.
+    float n[3][3];      //!< Normals of the vertices.
+    float c[3][3];      //!< Colors of the vertices.
+    int x0, y0, x1, y1; //!< Bounding box, in pixels, upper bounds excluded.
+    int material;       //!< Material.
+  };
+
+  //! Vertex in clip space, with its attributes.
+  struct ClipVertex
+  {
+    float p[4];         //!< Homogeneous coordinates.
+    float n[3];         //!< Normal.
+    float c[3];         //!< Color.
+  };
+
+  int width;                          //!< Width of the image.
+  int height;                         //!< Height of the image.
+  std::vector<unsigned char> pixels;  //!< RGB pixels, rows stored top down.
+  std::vector<float> depth;           //!< Depth buffer, in [0,1].
+
+  Camera camera;                      //!< Camera.
+  float viewProjection[16];           //!< Projection and view matrices, row major.
+  float viewDir[3];                   //!< Normalized view direction.
+
+  std::vector<Setup> setups;          //!< Triangles of the current draw.
+  std::vector<std::vector<int>> bins; //!< Triangles overlapping every tile, in submission order.
+public:
+  Rasterizer(int, int);
+
+  void Clear(const Color& = Color(1.0));
+  void SetCamera(const Camera&);
+
+  void Draw(const Mesh&, Material = Material::Normal, const Vector& = Vector::Null);
+  void Draw(const MeshColor&, Material = Material::Color, const Vector& = Vector::Null);
+
+  int Width() const;
+  int Height() const;
+  const std::vector<unsigned char>& Pixels() const;
+  double Depth(int, int) const;
+  bool SavePPM(const char*) const;
+protected:
+  void Render(const Mesh&, const MeshColor*, Material, const Vector&);
+  int Clip(ClipVertex*, int, ClipVertex*) const;
+  bool SetupTriangle(const ClipVertex&, const ClipVertex&, const ClipVertex&, int, Setup&) const;
+  void RasterizeTile(int, int);
+};
+
+/*!
+\brief Return the width of the image.
+*/
+inline int Rasterizer::Width() const
+{
+  return width;
+}
+
+/*!
+\brief Return the height of the image.
+*/
+inline int Rasterizer::Height() const
+{
+  return height;
+}
+
+/*!
+\brief Return the RGB pixels of the image, rows stored from top to bottom.
+*/
+inline const std::vector<unsigned char>& Rasterizer::Pixels() const
+{
+  return pixels;
+}
+
+/*!
+\brief Return the depth of a pixel, 1 if no triangle covers it.
+\param x, y Pixel, from the top left corner of the image.
+*/
+inline double Rasterizer::Depth(int x, int y) const
+{
+  return depth[size_t(y) * width + x];
+}
@@ -4,62 +4,206 @@
 #include "box.h"
 #include "ray.h"
 #include "camera.h"
+#include "frustum.h"
+#include "occlusion.h"
 
 #include "mesh.h"
 #include "meshcolor.h"
+#include "matrix.h"
+#include "slot_map.h"
+#include "gpu_buffer_pool.h"
+#include "mesh_lod.h"
+#include "image_writer.h"
+#include "height_field_lod.h"
+#include "command_queue.h"
+#include "camera_path.h"
 
 #include <QtCore/QMap>
+#include <QtCore/QHash>
+#include <QtCore/QThread>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOffscreenSurface>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 // Utility class for profiling CPU & GPU
 typedef std::chrono::time_point<std::chrono::high_resolution_clock> MyChrono;
 class RenderingProfiler
 {
 public:
+  static const int FramesInFlight = 4;	//!< Number of frames whose timestamps may be pending.
+  static const int PassCount = 2;		//!< Timed passes: sky and meshes.
+  static const int WindowSize = 240;	//!< Number of frames used for the rolling statistics.
+
+  //! Rolling statistics of a GPU pass, in milliseconds.
+  struct PassStats
+  {
+    double min = 0.0;
+    double avg = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+  };
+
   bool enabled = false;			//!< Flag linked to UI.
+  bool blocking = false;		//!< Wait for the timestamps of old frames instead of skipping frames, for benchmarks.
+
+  GLuint queries[FramesInFlight][PassCount + 1];	//!< GL timestamp queries, one more than the number of passes per frame.
+  bool pending[FramesInFlight] = {};			//!< Queries of a frame have been issued but not read back yet.
+  int issued[FramesInFlight] = {};			//!< Frame counter of the queries of every slot.
+  int frame = 0;					//!< Frame counter, selects the queries.
+  int pass = 0;						//!< Passes timed in the current frame.
+  bool recording = false;				//!< Timestamps are being issued for the current frame.
 
-  GLuint query;					//!< GL Query for stats
-  GLuint64 elapsedTimeGPU;		//!< GPU rendering time for a frame.
+  std::vector<double> samples[PassCount + 1];	//!< Rolling window of the pass durations, the last one being the whole frame.
+  int nbsamples = 0;				//!< Next sample to be overwritten in the window.
+  PassStats gpuStats[PassCount + 1];		//!< Recorded info.
+  std::vector<double> history;			//!< Pass durations of the recorded frames, PassCount + 1 per frame, negative if the frame was not timed.
+  int historyStart = 0;				//!< Frame counter of the first recorded frame.
 
   int nbframes = 0;				//!< CPU Frame counter.
   MyChrono start;					//!< CPU profiler.
   double msPerFrame = 0;			//!< Recorded info.
   double framePerSecond = 0;		//!< Recorded info.
+  int visibleObjects = 0;			//!< Draw calls submitted in the last frame.
+  int culledObjects = 0;			//!< Draw calls rejected by frustum culling in the last frame.
+  int occludedObjects = 0;		//!< Draw calls rejected by occlusion culling in the last frame.
+  int triangles = 0;				//!< Triangles submitted in the last frame.
+  int drawCalls = 0;				//!< Draw calls issued in the last frame, a multi draw counting as one.
 
   /*!
   \brief Init the profiler. Only has to be done once in the program.
   */
   inline void Init()
   {
-    glGenQueries(1, &query);
+    glGenQueries(FramesInFlight * (PassCount + 1), &queries[0][0]);
     start = std::chrono::high_resolution_clock::now();
   }
 
   /*!
-  \brief Starts profiling the GPU if enabled.
+  \brief Starts the GPU timing of a frame if enabled.
+
+  Timestamps of the frame issued FramesInFlight frames ago are read back if the GPU is done
+  with them. The CPU never waits for the GPU: if they are still pending, the current frame is
+  simply not timed.
   */
-  inline void BeginGPU()
+  inline void BeginFrame()
   {
-    if (enabled)
-      glBeginQuery(GL_TIME_ELAPSED, query);
+    recording = false;
+    if (!enabled)
+      return;
+
+    const int slot = frame % FramesInFlight;
+    if (pending[slot])
+    {
+      GLint available = 0;
+      glGetQueryObjectiv(queries[slot][PassCount], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available && !blocking)
+        return;
+      Collect(slot);
+    }
+
+    issued[slot] = frame;
+    glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+    pass = 0;
+    recording = true;
   }
 
   /*!
-  \brief Ends the GPU profiling if enabled.
+  \brief Ends a GPU pass, the next one starts at the same timestamp.
   */
-  inline void EndGPU()
+  inline void EndPass()
   {
-    if (enabled)
+    if (recording && pass < PassCount)
     {
-      glEndQuery(GL_TIME_ELAPSED);
-      int done = 0;
-      while (!done)
-        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &done);
-      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsedTimeGPU);
+      pass++;
+      glQueryCounter(queries[frame % FramesInFlight][pass], GL_TIMESTAMP);
     }
   }
 
   /*!
-  \brief Update the CPU profiling.
+  \brief Ends the GPU timing of a frame.
+  */
+  inline void EndFrame()
+  {
+    if (recording)
+    {
+      // Passes that were skipped get an empty duration
+      while (pass < PassCount)
+        EndPass();
+      pending[frame % FramesInFlight] = true;
+    }
+    recording = false;
+    frame++;
+  }
+
+  /*!
+  \brief Read back the timestamps of a frame and add its pass durations to the window.
+  \param slot Queries of the frame.
+  */
+  inline void Collect(int slot)
+  {
+    GLuint64 t[PassCount + 1];
+    for (int i = 0; i <= PassCount; i++)
+      glGetQueryObjectui64v(queries[slot][i], GL_QUERY_RESULT, &t[i]);
+    pending[slot] = false;
+
+    const int recorded = issued[slot] - historyStart;
+    for (int i = 0; i <= PassCount; i++)
+    {
+      const GLuint64 ns = i < PassCount ? t[i + 1] - t[i] : t[PassCount] - t[0];
+      if (samples[i].size() < size_t(WindowSize))
+        samples[i].push_back(ns / 1000000.0);
+      else
+        samples[i][nbsamples] = ns / 1000000.0;
+      if (recorded >= 0 && size_t(recorded + 1) * (PassCount + 1) <= history.size())
+        history[size_t(recorded) * (PassCount + 1) + i] = ns / 1000000.0;
+    }
+    nbsamples = (nbsamples + 1) % WindowSize;
+  }
+
+  /*!
+  \brief Start recording the pass durations of every frame, in addition to the rolling window.
+  \param n Number of frames to be recorded.
+  */
+  inline void Record(int n)
+  {
+    history.assign(size_t(n) * (PassCount + 1), -1.0);
+    historyStart = frame;
+  }
+
+  /*!
+  \brief Wait for the timestamps of all the frames in flight and read them back.
+  */
+  inline void Flush()
+  {
+    for (int slot = 0; slot < FramesInFlight; slot++)
+    {
+      if (pending[slot])
+        Collect(slot);
+    }
+  }
+
+  /*!
+  \brief Wait for the timestamps that the next frame will read back, if any, and read them back.
+
+  Called before timing the CPU side of a frame, so that BeginFrame() does not wait for the GPU
+  in blocking mode.
+  */
+  inline void WaitNextFrame()
+  {
+    const int slot = frame % FramesInFlight;
+    if (enabled && pending[slot])
+      Collect(slot);
+  }
+
+  /*!
+  \brief Update the CPU profiling, and the GPU statistics once per second.
   */
   inline void Update()
   {
@@ -72,6 +216,22 @@ public:
       framePerSecond = nbframes / seconds;
       nbframes = 0;
       start = std::chrono::high_resolution_clock::now();
+
+      for (int i = 0; i <= PassCount; i++)
+      {
+        std::vector<double> sorted = samples[i];
+        if (sorted.empty())
+          continue;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t n = sorted.size();
+        double sum = 0.0;
+        for (double ms : sorted)
+          sum += ms;
+        gpuStats[i].min = sorted.front();
+        gpuStats[i].avg = sum / n;
+        gpuStats[i].p95 = sorted[std::min(n - 1, (n * 95) / 100)];
+        gpuStats[i].p99 = sorted[std::min(n - 1, (n * 99) / 100)];
+      }
     }
   }
 };
@@ -92,35 +252,205 @@ class MeshWidget : public QOpenGLWidget
 {
   // Must include this if you use Qt signals/slots
   Q_OBJECT
+public:
+  typedef std::pair<int, int> TriangleRange; //!< Half open range of triangle indexes.
+  typedef SlotHandle MeshHandle;             //!< Handle to a mesh of the scene, stale once the mesh is deleted.
+
+  //! Placement of an instance: a linear transform, such as a rotation, followed by a translation.
+  struct InstanceFrame
+  {
+    Matrix linear;    //!< 3x3 matrix, stored row by row.
+    Vector position;  //!< Translation.
+
+    InstanceFrame(const Vector& = Vector::Null);
+    InstanceFrame(const Matrix&, const Vector& = Vector::Null);
+  };
 protected:
   class MeshGL
   {
   public:
     bool enabled;				//!< Render flag. Mesh is not rendered if enabled equals false.
+    GpuBufferPool* pool;		//!< Pool storing the vertex, index and instance data, not owned.
     GLuint vao;					//!< Mesh VAO.
-    GLuint fullBuffer;			//!< Mesh buffer. Contains 3D normals, 2D vertices and heights.
-    GLuint indexBuffer;			//!< Mesh index buffer.
-    int triangleCount;			//!< Triangle count to draw.
+    GpuRange vertexRange;		//!< Vertices, normals and possibly colors, empty once streamed.
+    GpuRange indexRange;		//!< Indexes.
+    GLuint fullBuffer;			//!< Buffer of the streamed vertex data, 0 for static meshes.
+    int triangleCount;			//!< Number of vertices, three per triangle.
+    MeshLOD lod;				//!< Index ranges of the levels of detail, level 0 being the full resolution mesh.
+    int lodLevel;				//!< Level of detail drawn in the current frame.
+    int attributes;				//!< Number of vertex attributes: vertices, normals and possibly colors.
+    int batchSlot;				//!< Index of the mesh in the batch, -1 if not batched.
     float TRSMatrix[16];		//!< Translation-Rotation-Scale Matrix.
-    Box bbox;					//!< Bounding box of the mesh.
+    Box bbox;					//!< Bounding box of the mesh, enclosing all the instances if any.
+    Box meshBox;				//!< Bounding box of the geometry.
+
+    std::vector<float> occluder;	//!< Corners of the triangles in object space, empty if the mesh is not used as an occluder.
 
     MeshShading shading;		//!< Render flag.
     MeshMaterial material;		//!< Render flag.
     bool useWireframe;			//!< Render flag.
 
+    // Streamed vertex data, set up by the first call to Update()
+    int regions;				//!< Copies of the vertex data: 0 for static meshes, 1 without persistent mapping, 3 otherwise.
+    int region;					//!< Copy read by the draw calls.
+    float* mapped;				//!< Persistently mapped vertex data.
+    GLsync fences[3];			//!< Fences set after the last draw reading each copy.
+    std::vector<TriangleRange> history[2];	//!< Dirty ranges of the two previous updates, missing from the copy written next.
+
+    // Instancing
+    GpuRange instanceRange;		//!< Per instance transforms.
+    int instanceCount;			//!< Number of instances, 0 if the mesh is drawn once.
+    std::vector<InstanceFrame> instances;	//!< Frames of the instances, kept so that the box can be updated with the geometry.
+
+    static const int MaxOccluderTriangles = 4096;	//!< Meshes with more triangles are not used as occluders.
+    static const int MinLodTriangles = 8192;		//!< Meshes with fewer triangles have no coarser levels of detail.
   public:
     MeshGL();
-    MeshGL(const Mesh& mesh, const Vector& position = Vector::Null);
-    MeshGL(const MeshColor& mesh, const Vector& position = Vector::Null);
+    MeshGL(GpuBufferPool* pool, const Mesh& mesh, const Vector& position = Vector::Null);
+    MeshGL(GpuBufferPool* pool, const MeshColor& mesh, const Vector& position = Vector::Null);
 
     void Delete();
     void SetFrame(const Vector& position);
+    Box WorldBox() const;
+    void SetInstances(const std::vector<InstanceFrame>& frames, GLint attribute);
+    Box InstancesBox() const;
+
+    bool Update(const MeshColor& mesh, const std::vector<TriangleRange>& ranges);
+    void Fence();
+  protected:
+    void Stream(const MeshColor& mesh);
+    static void Write(const MeshColor& mesh, int a, int b, float* vertices, float* normals, float* colors);
+  };
+
+  //! Per object uniform locations of the mesh program, queried once after linking.
+  struct MeshUniforms
+  {
+    GLint TRSMatrix = -1;
+    GLint useWireframe = -1;
+    GLint material = -1;
+    GLint shading = -1;
+  };
+
+  //! Uniform locations of the skybox program.
+  struct SkyboxUniforms
+  {
+    GLint CamPos = -1;
+    GLint CamLookAt = -1;
+    GLint CamUp = -1;
+    GLint iResolution = -1;
+    GLint iOffset = -1;
+  };
+
+  //! Per frame data, laid out as the std140 Frame uniform block of the mesh shaders.
+  struct FrameUniforms
+  {
+    GLfloat ModelViewMatrix[16];
+    GLfloat ProjectionMatrix[16];
+    GLfloat viewDir[4];
+    GLfloat WIN_SCALE[4];
+  };
+
+  //! Indirect draw command, laid out as expected by glMultiDrawElementsIndirect().
+  struct DrawCommand
+  {
+    GLuint count;         //!< Number of indexes.
+    GLuint instanceCount; //!< Always 1.
+    GLuint firstIndex;    //!< First index in the index arena.
+    GLint baseVertex;     //!< First vertex in the vertex arena.
+    GLuint baseInstance;  //!< Slot of the mesh, selects its transform.
+  };
+
+  //! Static meshes packed into shared buffers, drawn with one indirect call per render state.
+  struct MeshBatch
+  {
+    GLuint vao = 0;                     //!< Vertex array reading the arenas.
+    GLuint vertexBuffer = 0;            //!< Vertex arena: all vertices, then all normals and colors.
+    GLuint indexBuffer = 0;             //!< Index arena.
+    GLuint transformBuffer = 0;         //!< Transform of every slot, read as a per instance attribute.
+    GLuint commandBuffer = 0;           //!< Indirect commands of the current frame.
+    std::vector<DrawCommand> commands;  //!< Command of every slot.
+    size_t capacity = 0;                //!< Number of vertices the vertex arena can hold.
+    size_t indexCapacity = 0;           //!< Number of indexes the index arena can hold.
+    size_t transformCapacity = 0;       //!< Number of transforms the transform buffer can hold.
   };
 
-  typedef QMap<QString, MeshGL*>::iterator MeshIterator;
+  //! Screenshot being read back, written to a file once all its tiles have arrived.
+  struct Capture
+  {
+    QImage image;       //!< Image, rows stored top down.
+    QString name;       //!< File name.
+    int tiles = 0;      //!< Tiles not read back yet.
+  };
+
+  //! Pixel buffer object receiving a tile of a screenshot.
+  struct Readback
+  {
+    GLuint pbo = 0;                     //!< Pixel buffer object.
+    size_t size = 0;                    //!< Size of the buffer, in bytes.
+    GLsync fence = 0;                   //!< Signaled once the copy is done.
+    std::shared_ptr<Capture> capture;   //!< Screenshot of the tile.
+    int x = 0, y = 0;                   //!< Bottom left corner of the tile in the image, in pixels.
+    int w = 0, h = 0;                   //!< Size of the tile.
+  };
+
+  //! Settings of the renderer, linked to UI and copied to the render thread when they change.
+  struct RenderSettings
+  {
+    bool continuous = false;        //!< Redraw at full rate instead of on changes only.
+    bool batching = false;          //!< Batched mode.
+    bool occlusionCulling = false;  //!< Occlusion culling.
+    bool statistics = false;        //!< Profiling and stats panel.
+    double meshPixelError = 1.0;    //!< Screen space error threshold of the mesh levels of detail, in pixels.
+  };
+
+  //! View rendered by the render thread, copied from the widget for every frame.
+  struct View
+  {
+    Camera camera;                  //!< Camera.
+    bool perspective = true;        //!< Perspective or orthographic projection.
+    double orthoSize = 100.0;       //!< Half size of the orthographic view.
+    int width = 0, height = 0;      //!< Size of the image, in pixels.
+  };
+
+  //! Statistics of a frame, handed to the GUI thread along with the frame.
+  struct FrameStats
+  {
+    double framePerSecond = 0.0;
+    double msPerFrame = 0.0;
+    RenderingProfiler::PassStats gpu[RenderingProfiler::PassCount + 1];
+    int visibleObjects = 0;
+    int culledObjects = 0;
+    int occludedObjects = 0;
+    int drawCalls = 0;
+    int triangles = 0;
+    GpuBufferPool::Stats pool;
+  };
+
+  //! Frame rendered by the render thread into a texture shared with the context of the widget.
+  struct FrameImage
+  {
+    GLuint framebuffer = 0;         //!< Framebuffer of the render context.
+    GLuint color = 0;               //!< Color texture, shared between the contexts.
+    GLuint depth = 0;               //!< Depth buffer.
+    int width = 0, height = 0;      //!< Size of the image.
+    GLsync fence = 0;               //!< Signaled once the last access of the thread that owned the image is done.
+    FrameStats stats;               //!< Statistics of the frame.
+  };
+
+  //! Draw call of the draw list, sorted to minimize state changes.
+  struct DrawItem
+  {
+    GLuint program;       //!< Shader program.
+    int material;         //!< Material.
+    int shading;          //!< Shading mode.
+    int wireframe;        //!< Wireframe flag.
+    MeshGL* mesh;         //!< Mesh, not owned.
+
+    bool operator<(const DrawItem&) const;
+  };
 
 protected:
-  // Scene
+  // Scene, owned by the GUI thread
   int x0, y0;
   bool perspectiveProjection = true;
   double cameraOrthoSize = 100.0;
@@ -129,14 +459,73 @@ protected:
   Vector currentAt = Vector::Null;
   Vector toAt = Vector::Null;
   int stepAt = 0;
+  RenderSettings settings;                  //!< Settings, linked to UI.
+  SlotMap<QString> handles;                 //!< Names of the meshes, mirroring the slots of the objects of the render thread.
+  QHash<QString, MeshHandle> names;         //!< Handles of the meshes, only used to look names up.
+  GLuint presentFramebuffer = 0;            //!< Framebuffer of the widget context reading the presented frame.
+  int presented = 0;                        //!< Frame shown by the widget.
+
+  // Render thread
+  static const int Fresh = 4;               //!< Flag of the ready frame, set until the widget takes it.
+  QThread* renderThread = nullptr;          //!< Thread rendering the frames and owning all the GL resources of the scene.
+  QOpenGLContext* renderContext = nullptr;  //!< Context of the render thread, shared with the context of the widget.
+  QOffscreenSurface* renderSurface = nullptr; //!< Surface of the render context, frames are drawn into the frame images.
+  CommandQueue commands;                    //!< Scene changes, executed by the render thread in order.
+  std::mutex wakeMutex;                     //!< Only protects the wake flag, the queue itself is lock-free.
+  std::condition_variable wake;             //!< Wakes the render thread up when commands are pushed.
+  bool woken = false;                       //!< Commands have been pushed since the render thread last woke up.
+  FrameImage images[3];                     //!< Triple buffered frames: presented, ready, and rendering.
+  std::atomic<int> ready{ 1 };              //!< Last frame rendered, with the Fresh flag if the widget has not taken it yet.
+
+  // Render thread state, only accessed by the render thread
+  int rendering = 2;                        //!< Frame being rendered.
+  View view;                                //!< View of the next frames.
+  RenderSettings renderSettings;            //!< Settings of the next frames.
+  bool frameRequested = false;              //!< A frame must be rendered.
+  bool quit = false;                        //!< The render thread must exit.
 
   // Meshes
   GLuint mainShaderProgram;
-  QMap<QString, MeshGL*> objects;
+  MeshUniforms mainUniforms;                //!< Cached uniform locations of the mesh program.
+  GLuint frameUniformBuffer = 0;            //!< Uniform buffer storing the FrameUniforms.
+  GLint instanceAttribute = -1;             //!< First location of the per instance matrix of the mesh program.
+  GpuBufferPool bufferPool;                 //!< Storage of the vertex, index and instance data of the meshes.
+  SlotMap<MeshGL> objects;                  //!< Meshes of the scene, stored contiguously.
+  std::vector<DrawItem> drawList;           //!< Enabled objects and terrain chunks, sorted by state.
+  bool drawListDirty = true;                //!< Draw list must be rebuilt before the next frame.
+  BoxArray drawBoxes;                       //!< World space boxes of the draw list items.
+  std::vector<unsigned char> drawVisible;   //!< Frustum and occlusion culling result of the draw list items.
+
+  // Occlusion culling
+  static const int MaxOccluders = 16;       //!< Number of objects rasterized into the occlusion buffer.
+  static const int OcclusionWidth = 256;    //!< Width of the occlusion buffer, its height follows the aspect ratio.
+  OcclusionBuffer occlusion;                //!< Depth of the occluders, rebuilt every frame.
+
+  // Batching
+  bool batchDirty = true;                   //!< Set of batched meshes must be packed again.
+  MeshBatch batch;                          //!< Packed static meshes.
+  std::vector<DrawCommand> frameCommands;   //!< Indirect commands of the visible batched items.
+  std::vector<std::pair<int, int>> batchDraws; //!< Range of frameCommands drawn at each draw list item.
+
+  // Terrain
+  const HeightFieldLOD* terrain = nullptr;  //!< Chunked terrain, not owned.
+  double terrainPixelError = 2.0;           //!< Screen space error threshold, in pixels.
+  QMap<int, MeshGL*> terrainChunks;         //!< Uploaded chunks, indexed by chunk.
+
+  // Screenshots
+  static const int MaxReadbacks = 8;        //!< Number of tiles that may be copied at the same time.
+  GLuint captureFramebuffer = 0;            //!< Offscreen framebuffer, created by the first screenshot.
+  GLuint captureColor = 0;                  //!< Color buffer of the offscreen framebuffer.
+  GLuint captureDepth = 0;                  //!< Depth buffer of the offscreen framebuffer.
+  int captureTile = 0;                      //!< Size of the offscreen framebuffer, and of the tiles.
+  std::deque<Readback> readbacks;           //!< Copies in flight, oldest first.
+  std::vector<Readback> readbackBuffers;    //!< Pixel buffer objects available for copies.
+  ImageWriter imageWriter;                  //!< Encodes and writes the screenshots in the background.
 
   // Skybox
   GLuint skyboxShader = 0;
   GLuint skyboxVAO = 0;
+  SkyboxUniforms skyboxUniforms;
 
   // Profiling
   RenderingProfiler profiler;
@@ -145,38 +534,94 @@ public:
   MeshWidget();
   ~MeshWidget();
 
-  void AddMesh(const QString&, const Mesh&, const Vector & = Vector::Null);
-  void AddMesh(const QString&, const MeshColor&, const Vector & = Vector::Null);
+  MeshHandle AddMesh(const QString&, const Mesh&, const Vector & = Vector::Null);
+  MeshHandle AddMesh(const QString&, Mesh&&, const Vector & = Vector::Null);
+  MeshHandle AddMesh(const QString&, const MeshColor&, const Vector & = Vector::Null);
+  MeshHandle AddMesh(const QString&, MeshColor&&, const Vector & = Vector::Null);
+  MeshHandle AddInstances(const QString&, const Mesh&, const std::vector<InstanceFrame>&);
+  MeshHandle AddInstances(const QString&, Mesh&&, const std::vector<InstanceFrame>&);
+  MeshHandle AddInstances(const QString&, const MeshColor&, const std::vector<InstanceFrame>&);
+  MeshHandle AddInstances(const QString&, MeshColor&&, const std::vector<InstanceFrame>&);
+  MeshHandle FindMesh(const QString&) const;
   void DeleteMesh(const QString&);
+  void DeleteMesh(MeshHandle);
   void ClearAll();
 
+  void SetTerrain(const HeightFieldLOD*, double = 2.0);
+  void ClearTerrain();
+
   void UpdateMesh(const QString&, const Vector&);
+  void UpdateMesh(MeshHandle, const Vector&);
+  void UpdateMeshGeometry(const QString&, const MeshColor&);
+  void UpdateMeshGeometry(const QString&, MeshColor&&);
+  void UpdateInstancedGeometry(const QString&, const MeshColor&, const std::vector<InstanceFrame>&);
+  void UpdateInstancedGeometry(const QString&, MeshColor&&, const std::vector<InstanceFrame>&);
+  void DeformMeshGeometry(const QString&, const MeshColor&, const std::vector<TriangleRange>& = std::vector<TriangleRange>());
+  void DeformMeshGeometry(const QString&, MeshColor&&, const std::vector<TriangleRange>& = std::vector<TriangleRange>());
   void EnableMesh(const QString&);
+  void EnableMesh(MeshHandle);
   void DisableMesh(const QString&);
+  void DisableMesh(MeshHandle);
 
   Ray ComputeRay(const QPoint&) const;
   void SetCamera(const Camera&);
 
   void SetCameraMode(bool);
   void SetNearAndFarPlane(double, double);
+  void SetContinuousRendering(bool);
+  void SetBatching(bool);
+  void SetOcclusionCulling(bool);
+  void SetMeshPixelError(double);
   void SaveScreen(int = 1280, int = 1280);
+  void SaveViews(const std::vector<Camera>&, const QString&, int = 1280, int = 1280);
+  void FinishCaptures();
+  void RunBenchmark(const CameraPath&, int, const QString&, int = 1280, int = 720);
   QPoint GetMousePosition() const;
 
   void SetMaterial(const QString&, MeshMaterial);
+  void SetMaterial(MeshHandle, MeshMaterial);
   void SetMaterialGlobal(MeshMaterial);
   void UseWireframe(const QString&, bool);
+  void UseWireframe(MeshHandle, bool);
   void UseWireframeGlobal(bool);
   void SetShading(const QString&, MeshShading);
+  void SetShading(MeshHandle, MeshShading);
   void SetShadingGlobal(MeshShading);
 
 private:
+  void Post(CommandQueue::Command&&);
+  void Invoke(CommandQueue::Command&&);
+  void RequestFrame();
+  void UpdateSettings();
+  MeshHandle Reserve(const QString&);
+  void RenderLoop();
+  void InitializeRenderer();
+  void ReleaseRenderer();
+  void RenderFrame();
+  void ResizeImage(FrameImage&, int, int);
+  void Insert(MeshHandle, MeshGL&&);
+  void Replace(MeshGL&, const MeshColor&);
+  void UpdateTerrain(int, int);
+  void SetProjection(int, int, int, int, int, int) const;
+  void DrawSky(int, int, int, int);
+  void DrawMeshes(int, int, int, int);
+  int CullOccluded(const FrameUniforms&, int, int);
+  void SelectLevelsOfDetail(int, int);
+  void CaptureView(const Camera&, int, int, const QString&);
+  void Benchmark(const std::vector<Camera>&, int, int, const QString&);
+  void CollectReadbacks(size_t);
+  void DeleteCaptureBuffers();
+  void BuildDrawList();
+  void BuildBatch();
+  void DeleteBatch();
+  void PrepareBatchDraws();
   void _InternalGetMouseGlobalPosition(QMouseEvent* e, int& x0, int& y0) const;
 
 protected:
   virtual void initializeGL();
   virtual void resizeGL(int, int);
   virtual void paintGL();
-  virtual void RenderStats();
+  virtual void RenderStats(const FrameStats&);
 
 signals:
   void _signalUpdate();
@@ -185,6 +630,7 @@ signals:
   void _signalMouseRelease();
   void _signalEditSceneLeft(const Ray&);
   void _signalEditSceneRight(const Ray&);
+  void _signalBenchmarkDone(bool);
 
 public slots:
   virtual void mousePressEvent(QMouseEvent*);
@@ -25,9 +25,10 @@
 #include <string>
 
 // Shader API
-GLuint read_program(const char *filename, const char *definitions = "");
+GLuint read_program(const char *filename, const char *definitions = "", const char *const *attributes = nullptr);
 int release_program(const GLuint program);
-int reload_program(const GLuint program, const char *filename, const char *definitions = "");
+int reload_program(const GLuint program, const char *filename, const char *definitions = "", const char *const *attributes = nullptr);
+void program_cache_directory(const char *directory);
 int program_format_errors(const GLuint program, std::string& errors);
 int program_print_errors(const GLuint program);
 
@@ -0,0 +1,241 @@
+// Slot map
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+//! Handle to an element of a SlotMap.
+struct SlotHandle
+{
+  uint32_t index = UINT32_MAX;  //!< Slot of the element.
+  uint32_t generation = 0;      //!< Generation of the slot when the element was inserted.
+
+  //! Check if the handle was returned by an insertion, it may still refer to a removed element.
+  bool IsNull() const { return index == UINT32_MAX; }
+
+  friend bool operator==(const SlotHandle& a, const SlotHandle& b) { return a.index == b.index && a.generation == b.generation; }
+  friend bool operator!=(const SlotHandle& a, const SlotHandle& b) { return !(a == b); }
+};
+
+/*!
+\class SlotMap slot_map.h
+\brief Dense storage of elements addressed by generation checked handles.
+
+Elements are stored contiguously, so that iterating over them is a linear scan. Removing an
+element moves the last one in its place. Handles go through an indirection table of slots,
+and every slot keeps a generation counter incremented when its element is removed, so that
+stale handles are detected instead of accessing another element.
+
+\code
+SlotMap<Box> boxes;
+SlotHandle h = boxes.Insert(Box(1.0));
+boxes.Get(h)->Translate(Vector(1.0, 0.0, 0.0));
+boxes.Remove(h);
+bool stale = boxes.Get(h) == nullptr; // true
+\endcode
+*/
+template <typename T>
+class SlotMap
+{
+protected:
+  //! Indirection from a handle to the dense storage.
+  struct Slot
+  {
+    uint32_t dense;       //!< Index of the element, or next free slot if the slot is free.
+    uint32_t generation;  //!< Incremented when the element is removed.
+  };
+
+  std::vector<T> items;           //!< Elements.
+  std::vector<uint32_t> owners;   //!< Slot of every element.
+  std::vector<Slot> table;        //!< Slots, indexed by handles.
+  uint32_t freeSlot = UINT32_MAX; //!< First free slot.
+public:
+  //! Empty.
+  SlotMap() {}
+
+  SlotHandle Insert(const T&);
+  SlotHandle Insert(T&&);
+  bool Remove(const SlotHandle&);
+  void Clear();
+
+  T* Get(const SlotHandle&);
+  const T* Get(const SlotHandle&) const;
+  bool Contains(const SlotHandle&) const;
+
+  int Size() const;
+  T& operator[](int);
+  const T& operator[](int) const;
+  SlotHandle HandleOf(int) const;
+
+  typename std::vector<T>::iterator begin() { return items.begin(); }
+  typename std::vector<T>::iterator end() { return items.end(); }
+  typename std::vector<T>::const_iterator begin() const { return items.begin(); }
+  typename std::vector<T>::const_iterator end() const { return items.end(); }
+protected:
+  SlotHandle Allocate();
+};
+
+/*!
+\brief Reserve a slot for an element appended to the dense storage.
+*/
+template <typename T>
+SlotHandle SlotMap<T>::Allocate()
+{
+  uint32_t s;
+  if (freeSlot != UINT32_MAX)
+  {
+    s = freeSlot;
+    freeSlot = table[s].dense;
+  }
+  else
+  {
+    s = uint32_t(table.size());
+    table.push_back({ 0, 0 });
+  }
+  table[s].dense = uint32_t(items.size());
+  owners.push_back(s);
+
+  SlotHandle h;
+  h.index = s;
+  h.generation = table[s].generation;
+  return h;
+}
+
+/*!
+\brief Insert an element.
+\param t Element.
+\return Handle to the element.
+*/
+template <typename T>
+SlotHandle SlotMap<T>::Insert(const T& t)
+{
+  SlotHandle h = Allocate();
+  items.push_back(t);
+  return h;
+}
+
+/*!
+\brief Overloaded.
+\param t Element, moved into the map.
+*/
+template <typename T>
+SlotHandle SlotMap<T>::Insert(T&& t)
+{
+  SlotHandle h = Allocate();
+  items.push_back(std::move(t));
+  return h;
+}
+
+/*!
+\brief Remove an element, the last element is moved in its place.
+\param h Handle.
+\return false if the handle is stale.
+*/
+template <typename T>
+bool SlotMap<T>::Remove(const SlotHandle& h)
+{
+  if (!Contains(h))
+    return false;
+
+  const uint32_t d = table[h.index].dense;
+  const uint32_t last = uint32_t(items.size()) - 1;
+  if (d != last)
+  {
+    items[d] = std::move(items[last]);
+    owners[d] = owners[last];
+    table[owners[d]].dense = d;
+  }
+  items.pop_back();
+  owners.pop_back();
+
+  table[h.index].generation++;
+  table[h.index].dense = freeSlot;
+  freeSlot = h.index;
+  return true;
+}
+
+/*!
+\brief Remove all elements, all the handles become stale.
+*/
+template <typename T>
+void SlotMap<T>::Clear()
+{
+  while (!items.empty())
+    Remove(HandleOf(int(items.size()) - 1));
+}
+
+/*!
+\brief Check if a handle refers to an element of the map.
+\param h Handle.
+*/
+template <typename T>
+inline bool SlotMap<T>::Contains(const SlotHandle& h) const
+{
+  return h.index < table.size() && table[h.index].generation == h.generation && table[h.index].dense < items.size() && owners[table[h.index].dense] == h.index;
+}
+
+/*!
+\brief Return the element of a handle, or nullptr if the handle is stale.
+\param h Handle.
+*/
+template <typename T>
+inline T* SlotMap<T>::Get(const SlotHandle& h)
+{
+  return Contains(h) ? &items[table[h.index].dense] : nullptr;
+}
+
+/*!
+\brief Overloaded.
+\param h Handle.
+*/
+template <typename T>
+inline const T* SlotMap<T>::Get(const SlotHandle& h) const
+{
+  return Contains(h) ? &items[table[h.index].dense] : nullptr;
+}
+
+/*!
+\brief Number of elements.
+*/
+template <typename T>
+inline int SlotMap<T>::Size() const
+{
+  return int(items.size());
+}
+
+/*!
+\brief Access an element from its position in the dense storage.
+
+Positions change when elements are removed, use handles to refer to elements.
+\param i Position.
+*/
+template <typename T>
+inline T& SlotMap<T>::operator[](int i)
+{
+  return items[i];
+}
+
+/*!
+\brief Overloaded.
+\param i Position.
+*/
+template <typename T>
+inline const T& SlotMap<T>::operator[](int i) const
+{
+  return items[i];
+}
+
+/*!
+\brief Return the handle of the element at a given position in the dense storage.
+\param i Position.
+*/
+template <typename T>
+inline SlotHandle SlotMap<T>::HandleOf(int i) const
+{
+  SlotHandle h;
+  h.index = owners[i];
+  h.generation = table[owners[i]].generation;
+  return h;
+}
@@ -0,0 +1,105 @@
+// Tracing
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*!
+\class Trace trace.h
+\brief Records the time spent in scoped zones, in every thread, and saves it as a Chrome trace.
+
+Zones are placed with the TRACE_ZONE() macro, and are only compiled if TINYMESH_TRACING is defined.
+Every thread appends its zones to a buffer of its own without any lock, and buffers are kept
+after their thread ends. Recording is off until it is started, and saved traces can be opened
+in chrome://tracing or Perfetto:
+
+\code
+void Mesh::SmoothNormals()
+{
+  TRACE_ZONE("Mesh::SmoothNormals");
+  ...
+}
+
+Trace::Start();
+...
+Trace::Save("trace.json");
+\endcode
+*/
+class Trace
+{
+protected:
+  static std::atomic<bool> recording; //!< Zones are only recorded while set.
+public:
+  //! Check if zones are compiled.
+  static constexpr bool Compiled()
+  {
+#ifdef TINYMESH_TRACING
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  static void Start();
+  static void Stop();
+  static bool Recording();
+
+  static void SetThreadName(const std::string&);
+  static void Record(const char*, int64_t, int64_t);
+  static int64_t Now();
+  static bool Save(const std::string&);
+  static void Clear();
+};
+
+/*!
+\brief Check if zones are being recorded.
+*/
+inline bool Trace::Recording()
+{
+  return recording.load(std::memory_order_relaxed);
+}
+
+/*!
+\brief Return the time elapsed since the start of the process, in nanoseconds.
+*/
+inline int64_t Trace::Now()
+{
+  static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+/*!
+\class TraceZone trace.h
+\brief Zone recorded from its creation to the end of its scope.
+*/
+class TraceZone
+{
+protected:
+  const char* name; //!< Name, which must outlive the trace, usually a string literal.
+  int64_t start;    //!< Start time, negative if the zone is not recorded.
+public:
+  //! Open a zone.
+  explicit TraceZone(const char* name) : name(name), start(Trace::Recording() ? Trace::Now() : -1) {}
+  //! Close the zone and record it.
+  ~TraceZone()
+  {
+    if (start >= 0)
+      Trace::Record(name, start, Trace::Now());
+  }
+
+  TraceZone(const TraceZone&) = delete;
+  TraceZone& operator=(const TraceZone&) = delete;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef TINYMESH_TRACING
+//! Record the time spent until the end of the enclosing scope.
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#else
+#define TRACE_ZONE(name) ((void)0)
+#endif
@@ -1,12 +1,20 @@
 #version 150
 
+// Per frame data shared by all the draws, see MeshWidget::FrameUniforms
+layout(std140) uniform Frame
+{
+	mat4 ModelViewMatrix;
+	mat4 ProjectionMatrix;
+	vec3 viewDir;
+	vec2 WIN_SCALE;
+};
+
 #ifdef VERTEX_SHADER
 in vec3 vertex;
 in vec3 normal;
 in vec3 color;
+in mat4 instanceMatrix;	// Identity for meshes that are not instanced
 
-uniform mat4 ModelViewMatrix;
-uniform mat4 ProjectionMatrix;
 uniform mat4 TRSMatrix;
 
 out vec3 fragNormal;
@@ -16,8 +24,9 @@ out vec3 fragColor;
 void main(void)
 {
 	mat4 MVP      = ProjectionMatrix * ModelViewMatrix;
-	gl_Position   = MVP * TRSMatrix * (vec4(vertex, 1.0)); 
-	fragNormal	  = (TRSMatrix * vec4(normalize(normal), 0.0f)).xyz;
+	mat4 model    = TRSMatrix * instanceMatrix;
+	gl_Position   = MVP * model * (vec4(vertex, 1.0)); 
+	fragNormal	  = (model * vec4(normalize(normal), 0.0f)).xyz;
 	fragVertex 	  = vertex;
 	fragColor	  = color;
 } 
@@ -31,7 +40,6 @@ in vec3 fragColor;
 uniform int material;
 uniform int shading;
 uniform int useWireframe;
-uniform vec3 viewDir;
 
 out vec4 fragment;
 
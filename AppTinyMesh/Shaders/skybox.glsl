@@ -18,6 +18,7 @@ uniform vec3 CamPos;
 uniform vec3 CamLookAt;
 uniform vec3 CamUp;
 uniform vec2 iResolution;
+uniform vec2 iOffset;
 
 out vec4 color;
 
@@ -31,7 +32,7 @@ vec3 BuildRd()
 	vec3 camDir   = normalize(ta-ro); // direction for center ray
 	vec3 camRight = normalize(cross(camDir,camUp));
 
-	vec2 coord =-1.0+2.0*gl_FragCoord.xy/iResolution.xy;
+	vec2 coord =-1.0+2.0*(gl_FragCoord.xy+iOffset)/iResolution.xy;
 	coord.x *= iResolution.x/iResolution.y;
 
 	// Get direction for this pixel
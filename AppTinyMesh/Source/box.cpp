@@ -132,6 +132,45 @@ Box Box::Sub(int n) const
     Vector((n & 1) ? b[0] : c[0], (n & 2) ? b[1] : c[1], (n & 4) ? b[2] : c[2]));
 }
 
+/*!
+\brief Compute the intersection between a ray and the box, using slabs.
+
+\param ray The ray.
+\param tmin, tmax Entry and exit depths of the ray, the entry depth is negative if the origin lies inside the box.
+\return True if the ray intersects the box in front of its origin.
+*/
+bool Box::Intersect(const Ray& ray, double& tmin, double& tmax) const
+{
+  tmin = -1.0e30;
+  tmax = 1.0e30;
+
+  const Vector p = ray.Origin();
+  const Vector d = ray.Direction();
+  for (int i = 0; i < 3; i++)
+  {
+    if (fabs(d[i]) < epsilon)
+    {
+      // Parallel to the slab
+      if (p[i] < a[i] || p[i] > b[i])
+        return false;
+      continue;
+    }
+    double ta = (a[i] - p[i]) / d[i];
+    double tb = (b[i] - p[i]) / d[i];
+    if (ta > tb)
+    {
+      double t = ta;
+      ta = tb;
+      tb = t;
+    }
+    tmin = Math::Max(tmin, ta);
+    tmax = Math::Min(tmax, tb);
+    if (tmin > tmax)
+      return false;
+  }
+  return tmax >= 0.0;
+}
+
 /*!
 \brief Overloaded.
 \param s Stream.
@@ -271,6 +271,67 @@ bool Camera::VectorToPixel(const Vector& p, double& u, double& v, int w, int h)
   return true;
 }
 
+/*!
+\brief Compute the six clipping planes of the perspective frustum.
+
+Planes are stored as a normal pointing inside the frustum and an offset, so that a point p
+lies inside the frustum if n*p+c is positive for all planes. Planes are ordered as left, right,
+bottom, top, near and far, and match the projection set up with gluPerspective().
+\param n Normals.
+\param c Offsets.
+\param w, h Size of the viewing window.
+*/
+void Camera::FrustumPlanes(Vector n[6], double c[6], int w, int h) const
+{
+  const Vector view = Normalized(At() - Eye());
+  const Vector horizontal = Normalized(view / Up());
+  const Vector vertical = Normalized(horizontal / view);
+
+  const double vLength = tan(GetAngleOfViewV(w, h) / 2.0);
+  const double hLength = vLength * (double(w) / double(h));
+
+  // Side planes go through the eye
+  n[0] = Normalized(horizontal + hLength * view);
+  n[1] = Normalized(hLength * view - horizontal);
+  n[2] = Normalized(vertical + vLength * view);
+  n[3] = Normalized(vLength * view - vertical);
+  for (int i = 0; i < 4; i++)
+    c[i] = -(n[i] * eye);
+
+  n[4] = view;
+  c[4] = -(view * eye) - nearplane;
+  n[5] = -view;
+  c[5] = view * eye + farplane;
+}
+
+/*!
+\brief Compute the six clipping planes of an orthographic view.
+
+Planes are ordered and oriented as in Camera::FrustumPlanes(), and match the projection set up
+with glOrtho() given the same half size in both directions.
+\param n Normals.
+\param c Offsets.
+\param size Half size of the view.
+*/
+void Camera::OrthographicFrustumPlanes(Vector n[6], double c[6], double size) const
+{
+  const Vector view = Normalized(At() - Eye());
+  const Vector horizontal = Normalized(view / Up());
+  const Vector vertical = Normalized(horizontal / view);
+
+  n[0] = horizontal;
+  n[1] = -horizontal;
+  n[2] = vertical;
+  n[3] = -vertical;
+  for (int i = 0; i < 4; i++)
+    c[i] = size - n[i] * eye;
+
+  n[4] = view;
+  c[4] = -(view * eye) - nearplane;
+  n[5] = -view;
+  c[5] = view * eye + farplane;
+}
+
 /*!
 \brief Sets the camera target vector.
 \param a Look-at point.
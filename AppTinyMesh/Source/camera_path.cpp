@@ -0,0 +1,108 @@
+// Camera path
+
+#include "camera_path.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+/*!
+\class CameraPath camera_path.h
+\brief Camera path defined by keyframes, used to replay the same views from one run to the other.
+
+Keyframes are evenly spaced along the path, and the eye, look-at point and up vector are
+linearly interpolated between them, as in the look-at animation of the viewer.
+
+Paths are stored as text files, with one keyframe per line giving the eye, the look-at point
+and optionally the up vector, which is the z-axis otherwise. Numbers are separated by spaces
+or commas, and lines starting with a # are ignored:
+\code
+# Eye, look-at point, up vector
+-10 -10 5   0 0 0   0 0 1
+-10  10 5   0 0 0   0 0 1
+\endcode
+*/
+
+/*!
+\brief Load a path from a file, keyframes are appended to the path.
+\param filename File name.
+\return false if the file could not be read or has a malformed line.
+*/
+bool CameraPath::Load(const std::string& filename)
+{
+  std::ifstream in(filename);
+  if (!in.good())
+    return false;
+
+  std::string line;
+  while (std::getline(in, line))
+  {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    std::vector<double> x;
+    double v;
+    while (fields >> v)
+      x.push_back(v);
+
+    // Comments and empty lines
+    if (x.empty())
+    {
+      std::string word;
+      std::istringstream rest(line);
+      if (!(rest >> word) || word[0] == '#')
+        continue;
+      return false;
+    }
+    if (!fields.eof() || (x.size() != 6 && x.size() != 9))
+      return false;
+
+    const Vector up = x.size() == 9 ? Vector(x[6], x[7], x[8]) : Vector::Z;
+    Append(Vector(x[0], x[1], x[2]), Vector(x[3], x[4], x[5]), up);
+  }
+  return true;
+}
+
+/*!
+\brief Add a keyframe at the end of the path.
+\param eye Eye.
+\param at Look-at point.
+\param up Up vector.
+*/
+void CameraPath::Append(const Vector& eye, const Vector& at, const Vector& up)
+{
+  eyes.push_back(eye);
+  ats.push_back(at);
+  ups.push_back(up);
+}
+
+/*!
+\brief Compute the camera at a given position along the path.
+\param t Position, between 0 for the first keyframe and 1 for the last one.
+\param near, far Near and far planes of the camera.
+*/
+Camera CameraPath::Evaluate(double t, double near, double far) const
+{
+  if (eyes.empty())
+    return Camera();
+
+  const int n = Size() - 1;
+  const double s = std::min(std::max(t, 0.0), 1.0) * n;
+  const int i = std::min(int(s), std::max(n - 1, 0));
+  const int j = std::min(i + 1, n);
+  const double alpha = s - i;
+  return Camera(eyes[i] * (1.0 - alpha) + eyes[j] * alpha, ats[i] * (1.0 - alpha) + ats[j] * alpha, Normalized(ups[i] * (1.0 - alpha) + ups[j] * alpha), 1.0, 1.0, near, far);
+}
+
+/*!
+\brief Sample the path with evenly spaced cameras, the first and last ones being at the ends of the path.
+\param n Number of cameras.
+\param near, far Near and far planes of the cameras.
+*/
+std::vector<Camera> CameraPath::Sample(int n, double near, double far) const
+{
+  std::vector<Camera> cameras;
+  cameras.reserve(std::max(n, 0));
+  for (int k = 0; k < n; k++)
+    cameras.push_back(Evaluate(n > 1 ? double(k) / double(n - 1) : 0.0, near, far));
+  return cameras;
+}
@@ -0,0 +1,66 @@
+// Command queue
+
+#include "command_queue.h"
+
+/*!
+\brief Create an empty queue.
+*/
+CommandQueue::CommandQueue()
+{
+  tail = new Node;
+  head.store(tail, std::memory_order_relaxed);
+}
+
+/*!
+\brief Destroy the queue, commands that were not executed are discarded.
+*/
+CommandQueue::~CommandQueue()
+{
+  Command command;
+  while (Pop(command))
+    ;
+  delete tail;
+}
+
+/*!
+\brief Add a command at the end of the queue.
+
+May be called by any thread.
+\param command The command.
+*/
+void CommandQueue::Push(Command&& command)
+{
+  Node* node = new Node;
+  node->command = std::move(command);
+  Node* previous = head.exchange(node, std::memory_order_acq_rel);
+  previous->next.store(node, std::memory_order_release);
+}
+
+/*!
+\brief Remove the first command of the queue.
+
+Must only be called by the consumer thread.
+\param command Set to the command.
+\return false if the queue is empty.
+*/
+bool CommandQueue::Pop(Command& command)
+{
+  Node* next = tail->next.load(std::memory_order_acquire);
+  if (next == nullptr)
+    return false;
+  command = std::move(next->command);
+  next->command = nullptr;
+  delete tail;
+  tail = next;
+  return true;
+}
+
+/*!
+\brief Check if the queue is empty.
+
+Must only be called by the consumer thread.
+*/
+bool CommandQueue::Empty() const
+{
+  return tail->next.load(std::memory_order_acquire) == nullptr;
+}
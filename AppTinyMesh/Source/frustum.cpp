@@ -0,0 +1,146 @@
+// Frustum
+
+#include "frustum.h"
+
+#include <cmath>
+
+/*!
+\class Frustum frustum.h
+\brief Clipping planes of a camera, used to cull boxes outside of the view.
+
+Planes are stored as arrays of single precision coordinates so that Frustum::Cull()
+tests a whole set of boxes against every plane in vectorized loops.
+
+A box is rejected if it lies entirely on the outer side of one of the planes. The test is
+conservative: some boxes near the corners of the frustum are kept although they are not visible.
+*/
+
+/*!
+\brief Remove all boxes.
+*/
+void BoxArray::Clear()
+{
+  cx.clear(); cy.clear(); cz.clear();
+  ex.clear(); ey.clear(); ez.clear();
+}
+
+/*!
+\brief Reserve memory for a given number of boxes.
+\param n Number of boxes.
+*/
+void BoxArray::Reserve(int n)
+{
+  cx.reserve(n); cy.reserve(n); cz.reserve(n);
+  ex.reserve(n); ey.reserve(n); ez.reserve(n);
+}
+
+/*!
+\brief Add a box.
+\param box The box.
+*/
+void BoxArray::Append(const Box& box)
+{
+  const Vector center = box.Center();
+  const Vector half = 0.5 * box.Diagonal();
+  cx.push_back(float(center[0])); cy.push_back(float(center[1])); cz.push_back(float(center[2]));
+  ex.push_back(float(half[0])); ey.push_back(float(half[1])); ez.push_back(float(half[2]));
+}
+
+/*!
+\brief Create the frustum of a perspective camera.
+\param camera The camera.
+\param w, h Size of the viewing window.
+*/
+Frustum::Frustum(const Camera& camera, int w, int h)
+{
+  Vector n[6];
+  double d[6];
+  camera.FrustumPlanes(n, d, w, h);
+  Set(n, d);
+}
+
+/*!
+\brief Create the frustum of an orthographic view.
+\param camera The camera.
+\param size Half size of the view.
+*/
+Frustum::Frustum(const Camera& camera, double size)
+{
+  Vector n[6];
+  double d[6];
+  camera.OrthographicFrustumPlanes(n, d, size);
+  Set(n, d);
+}
+
+/*!
+\brief Convert the planes to single precision.
+\param n Inward normals.
+\param d Offsets.
+*/
+void Frustum::Set(const Vector n[6], const double d[6])
+{
+  for (int i = 0; i < 6; i++)
+  {
+    nx[i] = float(n[i][0]);
+    ny[i] = float(n[i][1]);
+    nz[i] = float(n[i][2]);
+    c[i] = float(d[i]);
+  }
+}
+
+/*!
+\brief Check if a box may intersect the frustum.
+\param box The box.
+*/
+bool Frustum::Intersect(const Box& box) const
+{
+  const Vector center = box.Center();
+  const Vector half = 0.5 * box.Diagonal();
+  for (int i = 0; i < 6; i++)
+  {
+    const double r = fabs(nx[i]) * half[0] + fabs(ny[i]) * half[1] + fabs(nz[i]) * half[2];
+    if (nx[i] * center[0] + ny[i] * center[1] + nz[i] * center[2] + c[i] + r < 0.0)
+      return false;
+  }
+  return true;
+}
+
+/*!
+\brief Classify a set of boxes against the frustum.
+
+The loop over the boxes is free of branches so that the compiler can vectorize it.
+\param boxes The boxes.
+\param visible Set to 1 for boxes that may intersect the frustum, 0 otherwise.
+\return The number of boxes that may intersect the frustum.
+*/
+int Frustum::Cull(const BoxArray& boxes, std::vector<unsigned char>& visible) const
+{
+  const int n = boxes.Size();
+  visible.assign(n, 1);
+
+  const float* cx = boxes.cx.data();
+  const float* cy = boxes.cy.data();
+  const float* cz = boxes.cz.data();
+  const float* ex = boxes.ex.data();
+  const float* ey = boxes.ey.data();
+  const float* ez = boxes.ez.data();
+  unsigned char* v = visible.data();
+
+  for (int p = 0; p < 6; p++)
+  {
+    const float a = nx[p], b = ny[p], d = nz[p], o = c[p];
+    const float aa = std::fabs(a), bb = std::fabs(b), dd = std::fabs(d);
+#pragma omp simd
+    for (int i = 0; i < n; i++)
+    {
+      // Signed distance of the center plus the projected radius of the box
+      const float s = a * cx[i] + b * cy[i] + d * cz[i] + o + aa * ex[i] + bb * ey[i] + dd * ez[i];
+      v[i] &= (unsigned char)(s >= 0.0f);
+    }
+  }
+
+  int count = 0;
+  for (int i = 0; i < n; i++)
+    count += v[i];
+  return count;
+}
@@ -0,0 +1,214 @@
+// Gpu buffer pool
+
+#include "gpu_buffer_pool.h"
+
+#include <algorithm>
+#include <iterator>
+
+/*!
+\class GpuBufferPool gpu_buffer_pool.h
+\brief Suballocator handing out ranges of a few large OpenGL buffers.
+
+Creating and deleting a buffer for every mesh goes through the driver allocator each time the
+scene changes. The pool creates buffers of a fixed size, called pages, and hands out aligned
+ranges of them. Freed ranges are merged with their free neighbors and recycled, and pages are
+kept once empty, so that rebuilding a scene of the same size creates no buffer.
+
+Ranges larger than a page get a dedicated buffer, which is deleted as soon as the range is freed.
+
+\code
+GpuBufferPool pool;
+GpuRange r = pool.Allocate(sizeof(float) * 9);
+pool.Write(r, 0, sizeof(float) * 9, data);
+glBindBuffer(GL_ARRAY_BUFFER, r.buffer);
+glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (const void*)r.offset);
+pool.Free(r);
+\endcode
+*/
+
+/*!
+\brief Create an empty pool, buffers are created on demand.
+\param size Size of the buffers.
+\param a Alignment of the ranges, a power of two.
+*/
+GpuBufferPool::GpuBufferPool(size_t size, size_t a) : pageSize(size), alignment(a)
+{
+}
+
+/*!
+\brief Create a buffer and add it to the pages.
+\param size Size of the buffer.
+\param dedicated Buffer reserved to a single range.
+\return Page index.
+*/
+int GpuBufferPool::CreatePage(size_t size, bool dedicated)
+{
+  int p = 0;
+  while (p < int(pages.size()) && pages[p].buffer != 0)
+    p++;
+  if (p == int(pages.size()))
+    pages.push_back(Page());
+
+  Page& page = pages[p];
+  page = Page();
+  page.size = size;
+  page.dedicated = dedicated;
+  page.free[0] = size;
+  glGenBuffers(1, &page.buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, page.buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  allocations++;
+  return p;
+}
+
+/*!
+\brief Hand out a range, using the smallest free block large enough.
+\param size Size in bytes.
+\return The range, empty if the size is 0.
+*/
+GpuRange GpuBufferPool::Allocate(size_t size)
+{
+  GpuRange range;
+  if (size == 0)
+    return range;
+  size = (size + alignment - 1) & ~(alignment - 1);
+
+  // Best fit among all the blocks
+  int best = -1;
+  std::map<size_t, size_t>::iterator block;
+  for (int p = 0; p < int(pages.size()); p++)
+  {
+    if (pages[p].buffer == 0 || pages[p].dedicated)
+      continue;
+    for (std::map<size_t, size_t>::iterator i = pages[p].free.begin(); i != pages[p].free.end(); i++)
+    {
+      if (i->second >= size && (best < 0 || i->second < block->second))
+      {
+        best = p;
+        block = i;
+      }
+    }
+  }
+  if (best < 0)
+  {
+    const bool dedicated = size > pageSize;
+    best = CreatePage(dedicated ? size : pageSize, dedicated);
+    block = pages[best].free.begin();
+  }
+
+  Page& page = pages[best];
+  range.buffer = page.buffer;
+  range.offset = block->first;
+  range.size = size;
+  range.page = best;
+
+  // Remainder of the block
+  if (block->second > size)
+    page.free[block->first + size] = block->second - size;
+  page.free.erase(block);
+  page.used += size;
+  return range;
+}
+
+/*!
+\brief Give a range back to the pool, and reset it.
+\param range The range.
+*/
+void GpuBufferPool::Free(GpuRange& range)
+{
+  if (range.IsNull())
+    return;
+  Page& page = pages[range.page];
+  page.used -= range.size;
+
+  if (page.dedicated)
+  {
+    glDeleteBuffers(1, &page.buffer);
+    page = Page();
+    range = GpuRange();
+    return;
+  }
+
+  // Merge with the neighboring free blocks
+  size_t offset = range.offset;
+  size_t size = range.size;
+  std::map<size_t, size_t>::iterator next = page.free.lower_bound(offset);
+  if (next != page.free.end() && next->first == offset + size)
+  {
+    size += next->second;
+    next = page.free.erase(next);
+  }
+  if (next != page.free.begin())
+  {
+    std::map<size_t, size_t>::iterator previous = std::prev(next);
+    if (previous->first + previous->second == offset)
+    {
+      offset = previous->first;
+      size += previous->second;
+      page.free.erase(previous);
+    }
+  }
+  page.free[offset] = size;
+  range = GpuRange();
+}
+
+/*!
+\brief Upload data to a range.
+\param range The range.
+\param offset Offset in the range, in bytes.
+\param size Size of the data, in bytes.
+\param data The data.
+*/
+void GpuBufferPool::Write(const GpuRange& range, size_t offset, size_t size, const void* data) const
+{
+  if (range.IsNull() || size == 0)
+    return;
+  glBindBuffer(GL_COPY_WRITE_BUFFER, range.buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset + offset, size, data);
+}
+
+/*!
+\brief Delete all the buffers, ranges that were handed out become invalid.
+*/
+void GpuBufferPool::Release()
+{
+  for (Page& page : pages)
+  {
+    if (page.buffer != 0)
+      glDeleteBuffers(1, &page.buffer);
+  }
+  pages.clear();
+}
+
+/*!
+\brief Compute the memory usage of the pool.
+*/
+GpuBufferPool::Stats GpuBufferPool::GetStats() const
+{
+  Stats stats;
+  stats.allocations = allocations;
+  size_t available = 0;
+  size_t contiguous = 0;
+  for (const Page& page : pages)
+  {
+    if (page.buffer == 0)
+      continue;
+    stats.pages++;
+    stats.reserved += page.size;
+    stats.inUse += page.used;
+    size_t largest = 0;
+    for (const std::pair<const size_t, size_t>& block : page.free)
+    {
+      available += block.second;
+      largest = std::max(largest, block.second);
+      stats.freeBlocks++;
+    }
+    stats.largestFree = std::max(stats.largestFree, largest);
+    contiguous += largest;
+  }
+
+  // Free memory split across pages is not fragmented, as every page may serve large ranges
+  if (available > 0)
+    stats.fragmentation = 1.0 - double(contiguous) / double(available);
+  return stats;
+}
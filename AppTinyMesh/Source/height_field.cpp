@@ -1,6 +1,517 @@
 #include "height_field.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
+
+/*!
+\class HeightField height_field.h
+
+\brief Regular grid of integer elevation samples.
+
+Samples are either stored in memory, or paged in from a tiled file by a HeightFieldTiles
+cache for grids that do not fit in memory. Both are accessed through HeightField::Sample().
+*/
+
+/*!
+\brief Load a height field from a PGM image file.
+\param fp File name.
+*/
 HeightField::HeightField(const char* fp)
 {
-    FILE* file = fopen (fp, "rb");
+    load(fp);
+}
+
+/*!
+\brief Load a height field from a PGM image file and set its vertical scale.
+\param fp File name.
+\param s Vertical scale.
+*/
+HeightField::HeightField(const char* fp, double s) : HeightField(fp)
+{
+    scale = s;
+}
+
+/*!
+\brief Create a height field from an array of samples.
+\param x, y Number of samples along each axis.
+\param p Samples, stored row by row.
+\param s Vertical scale.
+*/
+HeightField::HeightField(int x, int y, const std::vector<int>& p, double s) : points(p), scale(s), nx(x), ny(y)
+{
+    BuildPyramid();
+}
+
+/*!
+\brief Return the array of samples.
+
+The array is empty if the samples are stored in a tiled file.
+HeightField::BuildPyramid() should be called after the samples have been modified.
+*/
+std::vector<int>& HeightField::get_points()
+{
+    return points;
+}
+
+/*!
+\brief Skip white spaces and comments in a PGM header.
+\param file File.
+*/
+static int pgm_next(FILE* file)
+{
+    int c = fgetc(file);
+    while (c != EOF)
+    {
+        if (c == '#')
+        {
+            while (c != EOF && c != '\n')
+                c = fgetc(file);
+        }
+        else if (!isspace(c))
+            break;
+        c = fgetc(file);
+    }
+    return c;
+}
+
+/*!
+\brief Read an integer from a PGM header.
+\param file File.
+*/
+static int pgm_int(FILE* file)
+{
+    int c = pgm_next(file);
+    int v = 0;
+    while (c != EOF && isdigit(c))
+    {
+        v = v * 10 + (c - '0');
+        c = fgetc(file);
+    }
+    return v;
+}
+
+/*!
+\brief Load the samples from a PGM image (binary P5 or ascii P2, 8 or 16 bits).
+
+The grid is left empty if the file cannot be read.
+\param fp File name.
+*/
+void HeightField::load(const char* fp)
+{
+    points.clear();
+    pyramid.clear();
+    tiles.reset();
+    nx = ny = 0;
+
+    FILE* file = fopen(fp, "rb");
+    if (file == nullptr)
+        return;
+
+    char magic[2] = { 0, 0 };
+    if (fread(magic, 1, 2, file) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '2'))
+    {
+        fclose(file);
+        return;
+    }
+
+    int x = pgm_int(file);
+    int y = pgm_int(file);
+    int maxval = pgm_int(file);
+    if (x <= 0 || y <= 0 || maxval <= 0)
+    {
+        fclose(file);
+        return;
+    }
+
+    points.resize(size_t(x) * size_t(y));
+    if (magic[1] == '5')
+    {
+        // Single white space already consumed after maxval
+        const int bytes = maxval < 256 ? 1 : 2;
+        std::vector<unsigned char> row(size_t(x) * bytes);
+        for (int j = 0; j < y; j++)
+        {
+            if (fread(row.data(), 1, row.size(), file) != row.size())
+                break;
+            for (int i = 0; i < x; i++)
+            {
+                // 16 bits samples are stored most significant byte first
+                points[size_t(j) * x + i] = bytes == 1 ? row[i] : (row[2 * i] << 8) | row[2 * i + 1];
+            }
+        }
+    }
+    else
+    {
+        for (size_t k = 0; k < points.size(); k++)
+            points[k] = pgm_int(file);
+    }
+    fclose(file);
+
+    nx = x;
+    ny = y;
+    BuildPyramid();
+}
+
+/*!
+\brief Page the samples in from a tiled file written by HeightFieldTiles::Save().
+
+The vertical scale is left unchanged, and the grid is left empty if the file cannot be read.
+\param fp File name.
+\param c Maximum number of tiles kept in memory.
+*/
+bool HeightField::load_tiles(const char* fp, size_t c)
+{
+    points.clear();
+    pyramid.clear();
+    tiles.reset();
+    nx = ny = 0;
+
+    std::shared_ptr<HeightFieldTiles> t = std::make_shared<HeightFieldTiles>(fp, c);
+    if (!t->IsValid())
+        return false;
+
+    tiles = t;
+    nx = tiles->SizeX();
+    ny = tiles->SizeY();
+    BuildPyramid();
+    return true;
+}
+
+/*!
+\brief Request the tiles seen by a camera to be loaded in the background.
+
+The footprint of the view frustum, bounded by the extent of the height field, is projected
+on the grid; tiles are requested from the closest to the farthest from the eye.
+Does nothing if the samples are stored in memory.
+\param camera The camera.
+\param w, h Size of the viewport, in pixels.
+*/
+void HeightField::Prefetch(const Camera& camera, int w, int h) const
+{
+    if (!tiles || pyramid.empty())
+        return;
+
+    const Box box = GetBox();
+    const Vector eye = camera.Eye();
+    const double reach = Math::Min(camera.GetFar(), Norm(eye - box.Center()) + 0.5 * Norm(box.Diagonal()));
+
+    // Horizontal footprint of the frustum
+    double xmin = eye[0], xmax = eye[0], ymin = eye[1], ymax = eye[1];
+    const int corners[4][2] = { { 0, 0 }, { w - 1, 0 }, { 0, h - 1 }, { w - 1, h - 1 } };
+    for (int k = 0; k < 4; k++)
+    {
+        const Vector p = camera.PixelToRay(corners[k][0], corners[k][1], w, h)(reach);
+        xmin = Math::Min(xmin, p[0]);
+        xmax = Math::Max(xmax, p[0]);
+        ymin = Math::Min(ymin, p[1]);
+        ymax = Math::Max(ymax, p[1]);
+    }
+
+    if (xmax < 0.0 || ymax < 0.0 || xmin > nx - 1 || ymin > ny - 1)
+        return;
+
+    const int s = tiles->TileSize();
+    const int ia = std::max(int(floor(xmin)), 0) / s;
+    const int ib = std::min(int(ceil(xmax)), nx - 1) / s;
+    const int ja = std::max(int(floor(ymin)), 0) / s;
+    const int jb = std::min(int(ceil(ymax)), ny - 1) / s;
+
+    std::vector<std::pair<double, int> > order;
+    for (int j = ja; j <= jb; j++)
+    {
+        for (int i = ia; i <= ib; i++)
+        {
+            const double dx = (i + 0.5) * s - eye[0];
+            const double dy = (j + 0.5) * s - eye[1];
+            order.push_back(std::make_pair(dx * dx + dy * dy, tiles->TileIndex(i * s, j * s)));
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<int> requested(order.size());
+    for (size_t k = 0; k < order.size(); k++)
+        requested[k] = order[k].second;
+    tiles->Prefetch(requested);
+}
+
+/*!
+\brief Return the vertical scale.
+*/
+double HeightField::get_scale() const
+{
+    return scale;
+}
+
+/*!
+\brief Set the vertical scale.
+\param s Scale.
+*/
+void HeightField::set_scale(double s)
+{
+    scale = s;
+}
+
+/*!
+\brief Compute the normal at a grid sample using central differences.
+\param i, j Integer coordinates of the sample.
+*/
+Vector HeightField::Normal(int i, int j) const
+{
+    double dx = Elevation(i + 1, j) - Elevation(i - 1, j);
+    double dy = Elevation(i, j + 1) - Elevation(i, j - 1);
+    return Normalized(Vector(-dx, -dy, 2.0));
+}
+
+/*!
+\brief Compute the bounding box of the height field.
+*/
+Box HeightField::GetBox() const
+{
+    if (nx < 1 || ny < 1)
+        return Box::Null;
+
+    int zmin = Sample(0, 0);
+    int zmax = zmin;
+    if (!pyramid.empty())
+    {
+        // The coarsest level of the pyramid covers the whole grid
+        zmin = pyramid.back().zmin[0];
+        zmax = pyramid.back().zmax[0];
+    }
+    else
+    {
+        for (size_t k = 1; k < points.size(); k++)
+        {
+            zmin = points[k] < zmin ? points[k] : zmin;
+            zmax = points[k] > zmax ? points[k] : zmax;
+        }
+    }
+    double za = zmin * scale;
+    double zb = zmax * scale;
+    return Box(Vector(0.0, 0.0, Math::Min(za, zb)), Vector(nx - 1, ny - 1, Math::Max(za, zb)));
+}
+
+/*!
+\brief Create the full resolution triangle mesh of the height field.
+
+Every grid cell is split into two triangles.
+*/
+Mesh HeightField::get_mesh()
+{
+    std::vector<Vector> vertices;
+    std::vector<Vector> normals;
+    std::vector<int> indices;
+    if (nx < 2 || ny < 2)
+        return Mesh(vertices, normals, indices, indices);
+
+    vertices.reserve(size_t(nx) * ny);
+    normals.reserve(size_t(nx) * ny);
+    for (int j = 0; j < ny; j++)
+    {
+        for (int i = 0; i < nx; i++)
+        {
+            vertices.push_back(Vertex(i, j));
+            normals.push_back(Normal(i, j));
+        }
+    }
+
+    indices.reserve(size_t(nx - 1) * (ny - 1) * 6);
+    for (int j = 0; j < ny - 1; j++)
+    {
+        for (int i = 0; i < nx - 1; i++)
+        {
+            int a = j * nx + i;
+            int b = a + 1;
+            int c = a + nx + 1;
+            int d = a + nx;
+            indices.insert(indices.end(), { a, b, c, a, c, d });
+        }
+    }
+
+    return Mesh(vertices, normals, indices, indices);
+}
+
+/*!
+\brief Build the min/max elevation pyramid used for ray intersection.
+
+The finest level stores the extent of the samples of every cell, and every coarser
+level merges two by two blocks of the previous one, up to a single node.
+For tiled height fields, the finest nodes cover 8 x 8 cells to keep the pyramid small.
+*/
+void HeightField::BuildPyramid()
+{
+    pyramid.clear();
+    if (nx < 2 || ny < 2)
+        return;
+
+    leaf = tiles ? 3 : 0;
+    MinMaxLevel level;
+    level.nx = (nx - 2 + (1 << leaf)) >> leaf;
+    level.ny = (ny - 2 + (1 << leaf)) >> leaf;
+    level.zmin.resize(size_t(level.nx) * level.ny);
+    level.zmax.resize(size_t(level.nx) * level.ny);
+    // Blocks of nodes are processed in parallel; with tiles, a block covers a tile so that
+    // threads work on few tiles at a time instead of evicting each other's
+    const int block = tiles ? std::max(1, tiles->TileSize() >> leaf) : 64;
+    const int bx = (level.nx + block - 1) / block;
+    const int by = (level.ny + block - 1) / block;
+#pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < bx * by; b++)
+    {
+        const int ia = (b % bx) * block;
+        const int ja = (b / bx) * block;
+        for (int j = ja; j < std::min(ja + block, level.ny); j++)
+        {
+            for (int i = ia; i < std::min(ia + block, level.nx); i++)
+            {
+                int zmin = Sample(i << leaf, j << leaf);
+                int zmax = zmin;
+                for (int y = j << leaf; y <= std::min((j + 1) << leaf, ny - 1); y++)
+                {
+                    for (int x = i << leaf; x <= std::min((i + 1) << leaf, nx - 1); x++)
+                    {
+                        const int z = Sample(x, y);
+                        zmin = std::min(zmin, z);
+                        zmax = std::max(zmax, z);
+                    }
+                }
+                level.zmin[size_t(j) * level.nx + i] = zmin;
+                level.zmax[size_t(j) * level.nx + i] = zmax;
+            }
+        }
+    }
+    pyramid.push_back(std::move(level));
+
+    while (pyramid.back().nx > 1 || pyramid.back().ny > 1)
+    {
+        const MinMaxLevel& fine = pyramid.back();
+        MinMaxLevel coarse;
+        coarse.nx = (fine.nx + 1) / 2;
+        coarse.ny = (fine.ny + 1) / 2;
+        coarse.zmin.resize(size_t(coarse.nx) * coarse.ny);
+        coarse.zmax.resize(size_t(coarse.nx) * coarse.ny);
+#pragma omp parallel for
+        for (int j = 0; j < coarse.ny; j++)
+        {
+            for (int i = 0; i < coarse.nx; i++)
+            {
+                int zmin = fine.zmin[size_t(2 * j) * fine.nx + 2 * i];
+                int zmax = fine.zmax[size_t(2 * j) * fine.nx + 2 * i];
+                for (int y = 2 * j; y < std::min(2 * j + 2, fine.ny); y++)
+                {
+                    for (int x = 2 * i; x < std::min(2 * i + 2, fine.nx); x++)
+                    {
+                        zmin = std::min(zmin, fine.zmin[size_t(y) * fine.nx + x]);
+                        zmax = std::max(zmax, fine.zmax[size_t(y) * fine.nx + x]);
+                    }
+                }
+                coarse.zmin[size_t(j) * coarse.nx + i] = zmin;
+                coarse.zmax[size_t(j) * coarse.nx + i] = zmax;
+            }
+        }
+        pyramid.push_back(std::move(coarse));
+    }
+}
+
+/*!
+\brief Compute the bounding box of a node of the min/max pyramid.
+\param l Level.
+\param i, j Node coordinates in the level.
+*/
+Box HeightField::CellBox(int l, int i, int j) const
+{
+    const MinMaxLevel& level = pyramid[l];
+    const double za = level.zmin[size_t(j) * level.nx + i] * scale;
+    const double zb = level.zmax[size_t(j) * level.nx + i] * scale;
+    const int s = l + leaf;
+    return Box(Vector(double(i << s), double(j << s), Math::Min(za, zb) - Box::epsilon),
+        Vector(double(std::min((i + 1) << s, nx - 1)), double(std::min((j + 1) << s, ny - 1)), Math::Max(za, zb) + Box::epsilon));
+}
+
+/*!
+\brief Compute the first intersection between a ray and the height field.
+
+The min/max pyramid is traversed front to back, skipping the nodes whose boxes are missed
+by the ray or lie behind the closest intersection found so far. Cells of the finest level
+are tested exactly against the two triangles of HeightField::get_mesh().
+\param ray The ray.
+\param t Depth of the intersection along the ray.
+*/
+bool HeightField::Intersect(const Ray& ray, double& t) const
+{
+    if (pyramid.empty())
+        return false;
+
+    struct Node
+    {
+        int level, i, j;
+        double tmin;
+    };
+
+    double ta, tb;
+    const int top = int(pyramid.size()) - 1;
+    if (!CellBox(top, 0, 0).Intersect(ray, ta, tb))
+        return false;
+
+    bool hit = false;
+    t = 1.0e30;
+
+    std::vector<Node> stack;
+    stack.reserve(4 * pyramid.size());
+    stack.push_back({ top, 0, 0, ta });
+    while (!stack.empty())
+    {
+        Node node = stack.back();
+        stack.pop_back();
+        if (node.tmin > t)
+            continue;
+
+        if (node.level == 0)
+        {
+            for (int y = node.j << leaf; y < std::min((node.j + 1) << leaf, ny - 1); y++)
+            {
+                for (int x = node.i << leaf; x < std::min((node.i + 1) << leaf, nx - 1); x++)
+                {
+                    const Vector a = Vertex(x, y);
+                    const Vector b = Vertex(x + 1, y);
+                    const Vector c = Vertex(x + 1, y + 1);
+                    const Vector d = Vertex(x, y + 1);
+
+                    double tt, u, v;
+                    if (Triangle(a, b, c).Intersect(ray, tt, u, v) && tt >= 0.0 && tt < t)
+                    {
+                        t = tt;
+                        hit = true;
+                    }
+                    if (Triangle(a, c, d).Intersect(ray, tt, u, v) && tt >= 0.0 && tt < t)
+                    {
+                        t = tt;
+                        hit = true;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // Push the children hit by the ray, the closest one last
+        const MinMaxLevel& child = pyramid[node.level - 1];
+        Node children[4];
+        int n = 0;
+        for (int y = 2 * node.j; y < std::min(2 * node.j + 2, child.ny); y++)
+        {
+            for (int x = 2 * node.i; x < std::min(2 * node.i + 2, child.nx); x++)
+            {
+                if (CellBox(node.level - 1, x, y).Intersect(ray, ta, tb) && ta <= t)
+                    children[n++] = { node.level - 1, x, y, ta };
+            }
+        }
+        for (int k = 1; k < n; k++)
+        {
+            for (int l = k; l > 0 && children[l - 1].tmin < children[l].tmin; l--)
+                std::swap(children[l - 1], children[l]);
+        }
+        stack.insert(stack.end(), children, children + n);
+    }
+    return hit;
 }
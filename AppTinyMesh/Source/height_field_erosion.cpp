@@ -0,0 +1,337 @@
+#include "height_field_erosion.h"
+
+#include <algorithm>
+
+/*!
+\class HeightFieldErosion height_field_erosion.h
+
+\brief Thermal and hydraulic erosion of height fields.
+
+The simulation runs on single precision copies of the terrain elevation, stored as one array
+per quantity so that rows are processed by contiguous loops. Every step is split in passes that
+only read the neighbors computed by the previous pass, so that rows are updated in parallel.
+
+The thermal erosion moves material to the lower neighbors whose slope exceeds the talus.
+The hydraulic erosion is the virtual pipe model of Xing Mei, Philippe Decaudin and Bao-Gang Hu,
+<I>Fast hydraulic erosion simulation and visualization on GPU</I>, <B>Pacific Graphics</B>, 2007.
+
+Samples are spaced by one unit, as in HeightField::Vertex().
+*/
+
+/*!
+\brief Apply a function to every cell of a row.
+
+The function receives the index of the cell, the indexes of its left and right neighbors clamped to
+the row, and masks that are null for the neighbors outside of the grid. Interior cells are processed
+by a loop without branches that is vectorized, hence the function must only write to the cell it
+is given and must not read values written for other cells of the row.
+\param nx Number of cells.
+\param f Function.
+*/
+template<typename F>
+static inline void ForRow(int nx, const F& f)
+{
+    if (nx == 1)
+    {
+        f(0, 0, 0, 0.0f, 0.0f);
+        return;
+    }
+    f(0, 0, 1, 0.0f, 1.0f);
+#pragma omp simd
+    for (int i = 1; i < nx - 1; i++)
+        f(i, i - 1, i + 1, 1.0f, 1.0f);
+    f(nx - 1, nx - 2, nx - 1, 1.0f, 0.0f);
+}
+
+/*!
+\brief Copy the elevation of a height field, without water nor sediment.
+\param hf Height field.
+*/
+HeightFieldErosion::HeightFieldErosion(const HeightField& hf) : nx(hf.SizeX()), ny(hf.SizeY()), scale(hf.get_scale())
+{
+    const size_t n = size_t(nx) * ny;
+    terrain.resize(n);
+    water.assign(n, 0.0f);
+    sediment.assign(n, 0.0f);
+    left.assign(n, 0.0f);
+    right.assign(n, 0.0f);
+    bottom.assign(n, 0.0f);
+    top.assign(n, 0.0f);
+    u.assign(n, 0.0f);
+    v.assign(n, 0.0f);
+    transported.assign(n, 0.0f);
+
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++)
+    {
+        for (int i = 0; i < nx; i++)
+            terrain[size_t(j) * nx + i] = float(hf.Elevation(i, j));
+    }
+}
+
+/*!
+\brief Thermal erosion.
+
+Every iteration, the material above the talus slope is moved to the four neighbors,
+in proportion of their excess slope.
+\param n Number of iterations.
+\param talus Talus slope, i.e. tangent of the angle of repose.
+\param rate Fraction of the excess material moved per iteration, in [0, 1].
+*/
+void HeightFieldErosion::Thermal(int n, double talus, double rate)
+{
+    const float t = float(talus);
+    const float k = float(0.5 * rate);
+
+    // Outflows are overwritten, water fluxes of a previous hydraulic erosion are lost
+    if (n > 0)
+        flowing = false;
+    for (int it = 0; it < n; it++)
+    {
+        // Outflows
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < ny; j++)
+        {
+            const float* h = &terrain[size_t(j) * nx];
+            const float* hb = &terrain[size_t(j > 0 ? j - 1 : j) * nx];
+            const float* ht = &terrain[size_t(j < ny - 1 ? j + 1 : j) * nx];
+            float* ol = &left[size_t(j) * nx];
+            float* orr = &right[size_t(j) * nx];
+            float* ob = &bottom[size_t(j) * nx];
+            float* ot = &top[size_t(j) * nx];
+            ForRow(nx, [&](int i, int il, int ir, float, float)
+            {
+                // Neighbors outside of the grid are at the same elevation, hence receive nothing
+                const float el = std::max(h[i] - h[il] - t, 0.0f);
+                const float er = std::max(h[i] - h[ir] - t, 0.0f);
+                const float eb = std::max(h[i] - hb[i] - t, 0.0f);
+                const float et = std::max(h[i] - ht[i] - t, 0.0f);
+                const float sum = el + er + eb + et;
+                const float moved = k * std::max(std::max(el, er), std::max(eb, et));
+                const float f = moved / std::max(sum, 1.0e-20f);
+                ol[i] = el * f;
+                orr[i] = er * f;
+                ob[i] = eb * f;
+                ot[i] = et * f;
+            });
+        }
+
+        // Gather inflows
+#pragma omp parallel for schedule(static)
+        for (int j = 0; j < ny; j++)
+        {
+            const size_t r = size_t(j) * nx;
+            const float* tb = &top[size_t(j > 0 ? j - 1 : j) * nx];
+            const float* bt = &bottom[size_t(j < ny - 1 ? j + 1 : j) * nx];
+            const float mb = j > 0 ? 1.0f : 0.0f;
+            const float mt = j < ny - 1 ? 1.0f : 0.0f;
+            ForRow(nx, [&](int i, int il, int ir, float ml, float mr)
+            {
+                const float in = ml * right[r + il] + mr * left[r + ir] + mb * tb[i] + mt * bt[i];
+                const float out = left[r + i] + right[r + i] + bottom[r + i] + top[r + i];
+                terrain[r + i] += in - out;
+            });
+        }
+    }
+}
+
+/*!
+\brief Hydraulic erosion with the default parameters.
+\param n Number of iterations.
+*/
+void HeightFieldErosion::Hydraulic(int n)
+{
+    Hydraulic(n, HydraulicParameters());
+}
+
+/*!
+\brief Hydraulic erosion.
+
+Every iteration adds rain, computes the water outflows through virtual pipes, moves water,
+dissolves or deposits sediment according to the capacity of the flow, advects the sediment
+and evaporates water. Steps that only depend on the cell itself are merged with the neighboring
+passes, so that every iteration streams through the buffers four times.
+\param n Number of iterations.
+\param p Parameters.
+*/
+void HeightFieldErosion::Hydraulic(int n, const HydraulicParameters& p)
+{
+    // Water fluxes accumulate over iterations, and start from still water after a thermal erosion
+    if (n > 0 && !flowing)
+    {
+        std::fill(left.begin(), left.end(), 0.0f);
+        std::fill(right.begin(), right.end(), 0.0f);
+        std::fill(bottom.begin(), bottom.end(), 0.0f);
+        std::fill(top.begin(), top.end(), 0.0f);
+        flowing = true;
+    }
+    for (int it = 0; it < n; it++)
+    {
+        Flux(p);
+        Flow(p);
+        Erode(p);
+        Transport(float(p.dt));
+    }
+}
+
+/*!
+\brief Update the outflows through the virtual pipes, scaled so that cells never lose more water than they hold.
+
+Rain is uniform, hence does not change the differences of water levels; it is only
+accounted for in the water available in the cell, and added by HeightFieldErosion::Flow().
+\param p Parameters.
+*/
+void HeightFieldErosion::Flux(const HydraulicParameters& p)
+{
+    const float dt = float(p.dt);
+    const float k = float(p.dt * p.gravity);
+    const float rain = float(p.dt * p.rain);
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++)
+    {
+        const size_t r = size_t(j) * nx;
+        const size_t rb = size_t(j > 0 ? j - 1 : j) * nx;
+        const size_t rt = size_t(j < ny - 1 ? j + 1 : j) * nx;
+        ForRow(nx, [&](int i, int il, int ir, float, float)
+        {
+            // Neighbors outside of the grid have the same water level, their pipes stay empty
+            const float h = terrain[r + i] + water[r + i];
+            const float fl = std::max(left[r + i] + k * (h - terrain[r + il] - water[r + il]), 0.0f);
+            const float fr = std::max(right[r + i] + k * (h - terrain[r + ir] - water[r + ir]), 0.0f);
+            const float fb = std::max(bottom[r + i] + k * (h - terrain[rb + i] - water[rb + i]), 0.0f);
+            const float ft = std::max(top[r + i] + k * (h - terrain[rt + i] - water[rt + i]), 0.0f);
+            const float sum = (fl + fr + fb + ft) * dt;
+            const float s = std::min((water[r + i] + rain) / std::max(sum, 1.0e-20f), 1.0f);
+            left[r + i] = fl * s;
+            right[r + i] = fr * s;
+            bottom[r + i] = fb * s;
+            top[r + i] = ft * s;
+        });
+    }
+}
+
+/*!
+\brief Add rain and move water according to the outflows, then compute the velocity field and the sediment capacity.
+
+The capacity is stored in the advection buffer, which is not used until HeightFieldErosion::Transport().
+\param p Parameters.
+*/
+void HeightFieldErosion::Flow(const HydraulicParameters& p)
+{
+    const float dt = float(p.dt);
+    const float rain = float(p.dt * p.rain);
+    const float kc = float(p.capacity);
+    const float smin = float(p.minSlope);
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++)
+    {
+        const size_t r = size_t(j) * nx;
+        const float* tb = &top[size_t(j > 0 ? j - 1 : j) * nx];
+        const float* bt = &bottom[size_t(j < ny - 1 ? j + 1 : j) * nx];
+        const float* hb = &terrain[size_t(j > 0 ? j - 1 : j) * nx];
+        const float* ht = &terrain[size_t(j < ny - 1 ? j + 1 : j) * nx];
+        const float mb = j > 0 ? 1.0f : 0.0f;
+        const float mt = j < ny - 1 ? 1.0f : 0.0f;
+        const float dy = (j > 0 && j < ny - 1) ? 0.5f : 1.0f;
+        ForRow(nx, [&](int i, int il, int ir, float ml, float mr)
+        {
+            const float inl = ml * right[r + il];
+            const float inr = mr * left[r + ir];
+            const float inb = mb * tb[i];
+            const float int_ = mt * bt[i];
+            const float out = left[r + i] + right[r + i] + bottom[r + i] + top[r + i];
+
+            const float w0 = water[r + i] + rain;
+            const float w = std::max(w0 + dt * (inl + inr + inb + int_ - out), 0.0f);
+            const float mean = std::max(0.5f * (w0 + w), 1.0e-4f);
+            const float vx = 0.5f * (inl - left[r + i] + right[r + i] - inr) / mean;
+            const float vy = 0.5f * (inb - bottom[r + i] + top[r + i] - int_) / mean;
+            u[r + i] = vx;
+            v[r + i] = vy;
+            water[r + i] = w;
+
+            // Sine of the tilt angle of the terrain
+            const float gx = (terrain[r + ir] - terrain[r + il]) / float(std::max(ir - il, 1));
+            const float gy = dy * (ht[i] - hb[i]);
+            const float g2 = gx * gx + gy * gy;
+            const float tilt = std::max(std::sqrt(g2 / (1.0f + g2)), smin);
+
+            // Capacity grows with the amount of water, so that thin films of rain do not carve the terrain
+            transported[r + i] = kc * tilt * w * std::sqrt(vx * vx + vy * vy);
+        });
+    }
+}
+
+/*!
+\brief Dissolve or deposit sediment according to the capacity of the flow, and evaporate water.
+\param p Parameters.
+*/
+void HeightFieldErosion::Erode(const HydraulicParameters& p)
+{
+    const float ks = float(p.dissolving);
+    const float kd = float(p.deposition);
+    const float ke = std::max(1.0f - float(p.evaporation * p.dt), 0.0f);
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++)
+    {
+        const size_t r = size_t(j) * nx;
+#pragma omp simd
+        for (int i = 0; i < nx; i++)
+        {
+            const float c = transported[r + i];
+            const float s = sediment[r + i];
+            const float e = c > s ? ks * (c - s) : -kd * (s - c);
+            terrain[r + i] -= e;
+            sediment[r + i] = s + e;
+            water[r + i] *= ke;
+        }
+    }
+}
+
+/*!
+\brief Advect the sediment along the velocity field, using a semi-Lagrangian scheme.
+\param dt Time step.
+*/
+void HeightFieldErosion::Transport(float dt)
+{
+    const float xmax = float(nx - 1);
+    const float ymax = float(ny - 1);
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++)
+    {
+        const size_t r = size_t(j) * nx;
+        for (int i = 0; i < nx; i++)
+        {
+            const float x = std::min(std::max(float(i) - dt * u[r + i], 0.0f), xmax);
+            const float y = std::min(std::max(float(j) - dt * v[r + i], 0.0f), ymax);
+            const int xa = std::min(int(x), nx - 2 < 0 ? 0 : nx - 2);
+            const int ya = std::min(int(y), ny - 2 < 0 ? 0 : ny - 2);
+            const int xb = std::min(xa + 1, nx - 1);
+            const int yb = std::min(ya + 1, ny - 1);
+            const float a = x - float(xa);
+            const float b = y - float(ya);
+            const float* s0 = &sediment[size_t(ya) * nx];
+            const float* s1 = &sediment[size_t(yb) * nx];
+            transported[r + i] = (1.0f - b) * ((1.0f - a) * s0[xa] + a * s0[xb]) + b * ((1.0f - a) * s1[xa] + a * s1[xb]);
+        }
+    }
+    sediment.swap(transported);
+}
+
+/*!
+\brief Create a height field from the eroded terrain, with the vertical scale of the original one.
+
+Elevations are rounded to the integer samples of the height field.
+*/
+HeightField HeightFieldErosion::GetHeightField() const
+{
+    std::vector<int> points(size_t(nx) * ny);
+    const double s = scale != 0.0 ? 1.0 / scale : 1.0;
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++)
+    {
+        for (int i = 0; i < nx; i++)
+            points[size_t(j) * nx + i] = int(lround(terrain[size_t(j) * nx + i] * s));
+    }
+    return HeightField(nx, ny, points, scale != 0.0 ? scale : 1.0);
+}
@@ -0,0 +1,270 @@
+#include "height_field_lod.h"
+
+#include <algorithm>
+
+/*!
+\class HeightFieldLOD height_field_lod.h
+
+\brief Chunked quadtree level of detail for height fields.
+
+Every chunk is a regular grid of at most resolution x resolution cells, sampling the
+height field with a step that doubles at every coarser level. The geometric error of a
+chunk is the maximum vertical distance between its triangulation and the full resolution
+samples, and is propagated so that a parent error is never lower than those of its children.
+
+Chunks are selected by projecting their geometric error on screen; cracks between chunks of
+different levels are hidden by vertical skirts around every chunk mesh.
+*/
+
+/*!
+\brief Build the chunk quadtree of a height field.
+
+The height field must outlive the level of detail structure.
+\param hf Height field.
+\param r Number of cells along a side of a chunk, should be a power of two.
+*/
+HeightFieldLOD::HeightFieldLOD(const HeightField& hf, int r) : field(&hf), resolution(r)
+{
+    if (field->SizeX() < 2 || field->SizeY() < 2)
+        return;
+
+    // Smallest power of two multiple of the resolution covering the grid
+    int span = resolution;
+    while (span < field->SizeX() - 1 || span < field->SizeY() - 1)
+        span *= 2;
+
+    Build(0, 0, span, 0);
+
+    // Error and box of every chunk are independent
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < int(chunks.size()); i++)
+    {
+        ComputeError(chunks[i]);
+    }
+
+    // Propagate errors bottom-up, children are stored after their parent
+    for (int i = int(chunks.size()) - 1; i >= 0; i--)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            int c = chunks[i].children[k];
+            if (c != -1)
+                chunks[i].error = Math::Max(chunks[i].error, chunks[c].error);
+        }
+        if (int(levelError.size()) <= chunks[i].level)
+            levelError.resize(chunks[i].level + 1, 0.0);
+        levelError[chunks[i].level] = Math::Max(levelError[chunks[i].level], chunks[i].error);
+    }
+}
+
+/*!
+\brief Recursively create the chunks covering a square region of the grid.
+\param x, y Lower corner.
+\param span Side of the region, in cells.
+\param level Depth.
+\return Index of the chunk, -1 if the region lies outside of the grid.
+*/
+int HeightFieldLOD::Build(int x, int y, int span, int level)
+{
+    if (x >= field->SizeX() - 1 || y >= field->SizeY() - 1)
+        return -1;
+
+    int index = int(chunks.size());
+    Chunk chunk;
+    chunk.x = x;
+    chunk.y = y;
+    chunk.span = span;
+    chunk.level = level;
+    chunk.error = 0.0;
+    chunk.children[0] = chunk.children[1] = chunk.children[2] = chunk.children[3] = -1;
+    chunks.push_back(chunk);
+
+    // Leaves sample the full resolution grid
+    if (span <= resolution)
+        return index;
+
+    int h = span / 2;
+    int c0 = Build(x, y, h, level + 1);
+    int c1 = Build(x + h, y, h, level + 1);
+    int c2 = Build(x, y + h, h, level + 1);
+    int c3 = Build(x + h, y + h, h, level + 1);
+    chunks[index].children[0] = c0;
+    chunks[index].children[1] = c1;
+    chunks[index].children[2] = c2;
+    chunks[index].children[3] = c3;
+    return index;
+}
+
+/*!
+\brief Compute the geometric error and the bounding box of a chunk.
+
+Full resolution samples are compared to the triangulation of the chunk, using the same
+diagonal split as HeightField::get_mesh().
+\param chunk The chunk.
+*/
+void HeightFieldLOD::ComputeError(Chunk& chunk) const
+{
+    int step = chunk.span / resolution;
+    step = step < 1 ? 1 : step;
+    const int xe = std::min(chunk.x + chunk.span, field->SizeX() - 1);
+    const int ye = std::min(chunk.y + chunk.span, field->SizeY() - 1);
+
+    double zmin = field->Elevation(chunk.x, chunk.y);
+    double zmax = zmin;
+    double error = 0.0;
+    for (int j = chunk.y; j <= ye; j++)
+    {
+        const int j0 = std::min(chunk.y + ((j - chunk.y) / step) * step, ye);
+        const int j1 = std::min(j0 + step, ye);
+        const double v = j1 > j0 ? double(j - j0) / double(j1 - j0) : 0.0;
+        for (int i = chunk.x; i <= xe; i++)
+        {
+            const int i0 = std::min(chunk.x + ((i - chunk.x) / step) * step, xe);
+            const int i1 = std::min(i0 + step, xe);
+            const double u = i1 > i0 ? double(i - i0) / double(i1 - i0) : 0.0;
+
+            const double za = field->Elevation(i0, j0);
+            const double zb = field->Elevation(i1, j0);
+            const double zc = field->Elevation(i1, j1);
+            const double zd = field->Elevation(i0, j1);
+            const double z = (u >= v) ? za + u * (zb - za) + v * (zc - zb) : za + v * (zd - za) + u * (zc - zd);
+
+            const double e = field->Elevation(i, j);
+            error = Math::Max(error, fabs(z - e));
+            zmin = Math::Min(zmin, e);
+            zmax = Math::Max(zmax, e);
+        }
+    }
+    chunk.error = error;
+    chunk.box = Box(Vector(chunk.x, chunk.y, zmin), Vector(xe, ye, zmax));
+}
+
+/*!
+\brief Select the chunks to be rendered from a camera.
+
+The quadtree is refined until the projected geometric error of a chunk falls below the threshold.
+\param camera The camera.
+\param w, h Size of the viewport, in pixels.
+\param tau Maximum screen space error, in pixels.
+\return Indexes of the selected chunks.
+*/
+std::vector<int> HeightFieldLOD::Select(const Camera& camera, int w, int h, double tau) const
+{
+    std::vector<int> selected;
+    if (chunks.empty())
+        return selected;
+
+    // Pixels per unit of length at unit distance
+    const double k = double(h) / (2.0 * tan(camera.GetAngleOfViewV(w, h) / 2.0));
+    const Vector eye = camera.Eye();
+
+    std::vector<int> stack;
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        const int index = stack.back();
+        const Chunk& chunk = chunks[index];
+        stack.pop_back();
+
+        // Distance between the eye and the box of the chunk
+        const Vector p = Vector::Min(Vector::Max(eye, chunk.box[0]), chunk.box[1]);
+        const double d = Math::Max(Norm(p - eye), camera.GetNear());
+
+        const bool leaf = chunk.children[0] == -1 && chunk.children[1] == -1 && chunk.children[2] == -1 && chunk.children[3] == -1;
+        if (leaf || chunk.error * k / d <= tau)
+        {
+            selected.push_back(index);
+            continue;
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            if (chunk.children[c] != -1)
+                stack.push_back(chunk.children[c]);
+        }
+    }
+    return selected;
+}
+
+/*!
+\brief Create the mesh of a chunk, including its skirts.
+
+Skirts are dropped by the error of the next coarser level, which hides the cracks between
+neighboring chunks as long as their levels differ by at most one.
+Normals are computed on the full resolution grid so that they match across chunks.
+\param c Chunk index.
+*/
+Mesh HeightFieldLOD::GetMesh(int c) const
+{
+    const Chunk& chunk = chunks[c];
+    const int step = Step(c);
+    const int xe = std::min(chunk.x + chunk.span, field->SizeX() - 1);
+    const int ye = std::min(chunk.y + chunk.span, field->SizeY() - 1);
+
+    std::vector<int> xs, ys;
+    for (int i = chunk.x; i < xe; i += step)
+        xs.push_back(i);
+    xs.push_back(xe);
+    for (int j = chunk.y; j < ye; j += step)
+        ys.push_back(j);
+    ys.push_back(ye);
+    const int mx = int(xs.size());
+    const int my = int(ys.size());
+
+    std::vector<Vector> vertices;
+    std::vector<Vector> normals;
+    std::vector<int> indices;
+    vertices.reserve(mx * my + 2 * (mx + my));
+    normals.reserve(mx * my + 2 * (mx + my));
+    indices.reserve(6 * (mx - 1) * (my - 1) + 12 * (mx + my));
+
+    for (int j = 0; j < my; j++)
+    {
+        for (int i = 0; i < mx; i++)
+        {
+            vertices.push_back(field->Vertex(xs[i], ys[j]));
+            normals.push_back(field->Normal(xs[i], ys[j]));
+        }
+    }
+    for (int j = 0; j < my - 1; j++)
+    {
+        for (int i = 0; i < mx - 1; i++)
+        {
+            int a = j * mx + i;
+            int b = a + 1;
+            int cc = a + mx + 1;
+            int d = a + mx;
+            indices.insert(indices.end(), { a, b, cc, a, cc, d });
+        }
+    }
+
+    // Boundary loop, counter clockwise seen from above
+    std::vector<int> loop;
+    for (int i = 0; i < mx; i++)
+        loop.push_back(i);
+    for (int j = 1; j < my; j++)
+        loop.push_back(j * mx + mx - 1);
+    for (int i = mx - 2; i >= 0; i--)
+        loop.push_back((my - 1) * mx + i);
+    for (int j = my - 2; j > 0; j--)
+        loop.push_back(j * mx);
+
+    // Skirts
+    const double depth = Math::Max(levelError[chunk.level > 0 ? chunk.level - 1 : 0] + chunk.error, 1.0);
+    const int first = int(vertices.size());
+    for (size_t k = 0; k < loop.size(); k++)
+    {
+        vertices.push_back(vertices[loop[k]] - Vector(0.0, 0.0, depth));
+        normals.push_back(normals[loop[k]]);
+    }
+    for (size_t k = 0; k < loop.size(); k++)
+    {
+        const size_t l = (k + 1) % loop.size();
+        const int b0 = loop[k];
+        const int b1 = loop[l];
+        const int s0 = first + int(k);
+        const int s1 = first + int(l);
+        indices.insert(indices.end(), { b0, s0, s1, b0, s1, b1 });
+    }
+
+    return Mesh(vertices, normals, indices, indices);
+}
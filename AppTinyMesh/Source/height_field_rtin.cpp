@@ -0,0 +1,205 @@
+#include "height_field_rtin.h"
+
+#include <algorithm>
+#include <cfloat>
+
+/*!
+\class HeightFieldRTIN height_field_rtin.h
+
+\brief Right-triangulated irregular network of a height field.
+
+The grid is recursively split into right isosceles triangles, by bisecting their hypotenuse.
+An error map stores, for every vertex, the maximum vertical error of all the triangles whose
+hypotenuse midpoint is that vertex, including their descendants. Meshes for any error threshold
+are then extracted by a single traversal of the refined triangles, which is proportional to the
+size of the output. Errors are computed level by level, from the smallest triangles, so that the
+error at a midpoint accounts for both triangles sharing it before it is read by their parents:
+a triangle is refined whenever its neighbor is, and meshes are crack free.
+HeightFieldRTIN::Cracks() checks the property on an extracted mesh.
+
+After Will Evans, David Kirkpatrick and Gregg Townsend, <I>Right-triangulated irregular networks</I>,
+<B>Algorithmica</B>, 30(2):264-286, 2001, and Vladimir Agafonkin's Martini.
+
+Height fields whose sides are not a power of two plus one are triangulated as if they were
+extended to the next such size; triangles outside of the grid are discarded and those crossing
+its boundary are always refined.
+*/
+
+/*!
+\brief Compute the error map of a height field.
+
+The height field must outlive the triangulation.
+\param hf Height field.
+*/
+HeightFieldRTIN::HeightFieldRTIN(const HeightField& hf) : field(&hf)
+{
+    size = 2;
+    while (size + 1 < field->SizeX() || size + 1 < field->SizeY())
+        size *= 2;
+    size += 1;
+
+    errors.resize(size_t(size) * size, 0.0f);
+    if (field->SizeX() < 2 || field->SizeY() < 2)
+        return;
+
+    // Levels are processed from the smallest triangles, so that both triangles sharing a hypotenuse
+    // midpoint have merged their error into it before it is read by their parents, which keeps
+    // the errors monotone. Level l has 2<SUP>l+1</SUP> triangles, the finest one with a midpoint m<SUP>2</SUP>
+    const int m = size - 1;
+    int finest = 0;
+    for (long long n = 2; n < (long long)m * m; n *= 2)
+        finest++;
+    for (int l = finest; l >= 0; l--)
+    {
+        ComputeError(0, 0, m, m, m, 0, l, l == finest);
+        ComputeError(m, m, 0, 0, 0, m, l, l == finest);
+    }
+}
+
+/*!
+\brief Merge the errors of the descendants of a triangle at a given depth into the error map at their hypotenuse midpoints.
+
+The errors of the deeper levels must be complete.
+\param ax, ay, bx, by End vertices of the hypotenuse.
+\param cx, cy Right angle vertex.
+\param depth Depth of the descendants, relative to the triangle.
+\param finest Whether the descendants belong to the finest level with a hypotenuse midpoint.
+*/
+void HeightFieldRTIN::ComputeError(int ax, int ay, int bx, int by, int cx, int cy, int depth, bool finest)
+{
+    // Triangles outside of the grid are discarded, their error is never read
+    const int sx = field->SizeX() - 1;
+    const int sy = field->SizeY() - 1;
+    if (std::min({ ax, bx, cx }) >= sx || std::min({ ay, by, cy }) >= sy)
+        return;
+
+    const int mx = (ax + bx) >> 1;
+    const int my = (ay + by) >> 1;
+    if (depth > 0)
+    {
+        ComputeError(cx, cy, ax, ay, mx, my, depth - 1, finest);
+        ComputeError(bx, by, cx, cy, mx, my, depth - 1, finest);
+        return;
+    }
+
+    float& e = errors[size_t(my) * size + mx];
+    const double interpolated = 0.5 * (field->Elevation(ax, ay) + field->Elevation(bx, by));
+    e = std::max(e, float(fabs(interpolated - field->Elevation(mx, my))));
+
+    if (!finest)
+    {
+        e = std::max(e, errors[size_t((cy + ay) >> 1) * size + ((cx + ax) >> 1)]);
+        e = std::max(e, errors[size_t((by + cy) >> 1) * size + ((bx + cx) >> 1)]);
+    }
+
+    // Triangles crossing the boundary of the grid are always refined
+    if (std::max({ ax, bx, cx }) > sx || std::max({ ay, by, cy }) > sy)
+        e = FLT_MAX;
+}
+
+/*!
+\brief Extract the mesh approximating the height field within a given error.
+\param maxError Maximum vertical error, in the units of the scaled elevation.
+*/
+Mesh HeightFieldRTIN::GetMesh(double maxError) const
+{
+    std::unordered_map<int, int> indices;
+    std::vector<Vector> vertices;
+    std::vector<Vector> normals;
+    std::vector<int> triangles;
+    if (field->SizeX() < 2 || field->SizeY() < 2)
+        return Mesh(vertices, normals, triangles, triangles);
+
+    const int m = size - 1;
+    Refine(0, 0, m, m, m, 0, maxError, indices, vertices, normals, triangles);
+    Refine(m, m, 0, 0, 0, m, maxError, indices, vertices, normals, triangles);
+    return Mesh(vertices, normals, triangles, triangles);
+}
+
+/*!
+\brief Recursively refine a triangle until its error falls below the threshold, and output it.
+\param ax, ay, bx, by End vertices of the hypotenuse.
+\param cx, cy Right angle vertex.
+\param maxError Maximum error.
+\param indices Map from grid points to vertex indexes.
+\param vertices, normals, triangles Output mesh arrays.
+*/
+void HeightFieldRTIN::Refine(int ax, int ay, int bx, int by, int cx, int cy, double maxError, std::unordered_map<int, int>& indices, std::vector<Vector>& vertices, std::vector<Vector>& normals, std::vector<int>& triangles) const
+{
+    // Discard triangles lying outside of the grid
+    if (std::min({ ax, bx, cx }) >= field->SizeX() - 1 || std::min({ ay, by, cy }) >= field->SizeY() - 1)
+        return;
+
+    const int mx = (ax + bx) >> 1;
+    const int my = (ay + by) >> 1;
+    if (abs(ax - cx) + abs(ay - cy) > 1 && errors[size_t(my) * size + mx] > maxError)
+    {
+        Refine(cx, cy, ax, ay, mx, my, maxError, indices, vertices, normals, triangles);
+        Refine(bx, by, cx, cy, mx, my, maxError, indices, vertices, normals, triangles);
+        return;
+    }
+
+    const int a = Insert(ax, ay, indices, vertices, normals);
+    const int b = Insert(bx, by, indices, vertices, normals);
+    const int c = Insert(cx, cy, indices, vertices, normals);
+
+    // Counter clockwise seen from above
+    if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) > 0)
+        triangles.insert(triangles.end(), { a, b, c });
+    else
+        triangles.insert(triangles.end(), { a, c, b });
+}
+
+/*!
+\brief Return the index of the vertex at a grid point, creating it if needed.
+\param x, y Grid point.
+\param indices Map from grid points to vertex indexes.
+\param vertices, normals Output mesh arrays.
+*/
+int HeightFieldRTIN::Insert(int x, int y, std::unordered_map<int, int>& indices, std::vector<Vector>& vertices, std::vector<Vector>& normals) const
+{
+    auto inserted = indices.emplace(y * size + x, int(vertices.size()));
+    if (inserted.second)
+    {
+        vertices.push_back(field->Vertex(x, y));
+        normals.push_back(field->Normal(x, y));
+    }
+    return inserted.first->second;
+}
+
+/*!
+\brief Check that a mesh of a height field is watertight.
+
+Every edge inside of the grid must be shared by exactly two triangles, and every edge on the
+border of the grid by a single one. Vertexes must be shared by the triangles, as in the meshes
+returned by HeightFieldRTIN::GetMesh() and HeightField::get_mesh().
+\param hf Height field.
+\param mesh Mesh.
+\return Number of edges breaking the rule, zero for a crack free mesh.
+*/
+int HeightFieldRTIN::Cracks(const HeightField& hf, const Mesh& mesh)
+{
+    std::unordered_map<long long, int> edges;
+    for (int t = 0; t < mesh.Triangles(); t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            const int a = mesh.VertexIndex(t, k);
+            const int b = mesh.VertexIndex(t, (k + 1) % 3);
+            edges[(long long)std::min(a, b) * mesh.Vertexes() + std::max(a, b)]++;
+        }
+    }
+
+    const double sx = hf.SizeX() - 1;
+    const double sy = hf.SizeY() - 1;
+    int cracks = 0;
+    for (const auto& edge : edges)
+    {
+        const Vector a = mesh.Vertex(int(edge.first / mesh.Vertexes()));
+        const Vector b = mesh.Vertex(int(edge.first % mesh.Vertexes()));
+        const bool border = (a[0] == b[0] && (a[0] == 0.0 || a[0] == sx)) || (a[1] == b[1] && (a[1] == 0.0 || a[1] == sy));
+        if (edge.second != (border ? 1 : 2))
+            cracks++;
+    }
+    return cracks;
+}
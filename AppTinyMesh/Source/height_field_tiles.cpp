@@ -0,0 +1,352 @@
+#include "height_field_tiles.h"
+#include "height_field.h"
+
+#include <atomic>
+#include <cstring>
+
+/*!
+\class HeightFieldTiles height_field_tiles.h
+
+\brief Tiled on-disk storage of height field samples, paged in through a least recently used cache.
+
+The file starts with the four characters <TT>HFT1</TT> followed by the number of samples along
+x and y and the side of the tiles, as 32 bits integers. Tiles follow row by row, every tile
+storing its tile x tile samples row by row, with the tiles on the borders padded by clamping.
+All values use the byte order of the machine that wrote the file.
+
+Tiles are read on demand when a sample is accessed, and can be loaded ahead of time by a
+background thread through HeightFieldTiles::Prefetch(). Every thread keeps the samples of the
+last tile it accessed, so that resident samples are returned without locking; the cache is only
+locked on a tile change, and files are read outside of the lock.
+Tiles that cannot be read are replaced by zeros, reported on the standard error and counted
+by HeightFieldTiles::Failures().
+*/
+
+static const char HeightFieldTilesMagic[4] = { 'H', 'F', 'T', '1' };
+
+//! Source of the identifiers of the instances.
+static std::atomic<unsigned long long> HeightFieldTilesInstances(0);
+
+//! Last tile accessed by a thread.
+struct HeightFieldTilesView
+{
+    unsigned long long owner = 0;   //!< Identifier of the tiled storage, zero if none.
+    int t = -1;                     //!< Tile index.
+    std::shared_ptr<const std::vector<int32_t>> samples; //!< Samples, kept alive after an eviction.
+    const int32_t* data = nullptr;  //!< Samples of the tile.
+};
+
+static thread_local HeightFieldTilesView HeightFieldTilesLast;
+
+/*!
+\brief Move the position of a file, with 64 bits offsets.
+\param f File.
+\param offset Offset.
+\param origin Origin, as in fseek().
+*/
+static bool HeightFieldTilesSeek(FILE* f, long long offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(f, offset, origin) == 0;
+#else
+    return fseeko(f, off_t(offset), origin) == 0;
+#endif
+}
+
+/*!
+\brief Open a tiled height field file.
+
+The file is rejected if the header is invalid or if some tiles are missing.
+\param fp File name.
+\param c Maximum number of tiles kept in memory.
+*/
+HeightFieldTiles::HeightFieldTiles(const char* fp, size_t c) : path(fp), capacity(c < 2 ? 2 : c), id(++HeightFieldTilesInstances)
+{
+    FILE* file = fopen(fp, "rb");
+    if (file == nullptr)
+        return;
+
+    char magic[4];
+    int32_t header[3];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, HeightFieldTilesMagic, 4) != 0 || fread(header, sizeof(int32_t), 3, file) != 3 ||
+        header[0] <= 0 || header[1] <= 0 || header[2] <= 0)
+    {
+        fclose(file);
+        return;
+    }
+    nx = header[0];
+    ny = header[1];
+    tile = header[2];
+    tx = (nx + tile - 1) / tile;
+    ty = (ny + tile - 1) / tile;
+
+#ifdef _WIN32
+    const long long size = HeightFieldTilesSeek(file, 0, SEEK_END) ? _ftelli64(file) : -1;
+#else
+    const long long size = HeightFieldTilesSeek(file, 0, SEEK_END) ? (long long)ftello(file) : -1;
+#endif
+    if (size < 16 + (long long)tx * ty * tile * tile * (long long)sizeof(int32_t))
+    {
+        fclose(file);
+        nx = ny = tile = tx = ty = 0;
+        return;
+    }
+
+    valid = true;
+    files.push_back(file);
+    worker = std::thread(&HeightFieldTiles::Run, this);
+}
+
+/*!
+\brief Stop the prefetch thread and close the files.
+*/
+HeightFieldTiles::~HeightFieldTiles()
+{
+    if (worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        pending.notify_one();
+        worker.join();
+    }
+    for (FILE* f : files)
+        fclose(f);
+}
+
+/*!
+\brief Return the number of tiles read from disk so far.
+*/
+size_t HeightFieldTiles::Loads() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return loads;
+}
+
+/*!
+\brief Return the number of tiles that could not be read, and were replaced by zeros.
+*/
+size_t HeightFieldTiles::Failures() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failures;
+}
+
+/*!
+\brief Return a sample, loading its tile if it is not resident.
+
+Samples of the last tile accessed by the calling thread are read without locking.
+\param i, j Integer coordinates of the sample, inside the grid.
+*/
+int HeightFieldTiles::At(int i, int j) const
+{
+    const int t = TileIndex(i, j);
+    const int k = (j % tile) * tile + i % tile;
+
+    HeightFieldTilesView& view = HeightFieldTilesLast;
+    if (view.owner != id || view.t != t)
+    {
+        view.samples = Load(t);
+        view.owner = id;
+        view.t = t;
+        view.data = view.samples->data();
+    }
+    return view.data[k];
+}
+
+/*!
+\brief Return the samples of a tile, reading it outside of the lock if it is not resident.
+
+Threads requesting a tile that is being read wait for it instead of reading it again.
+\param t Tile index.
+*/
+HeightFieldTiles::Samples HeightFieldTiles::Load(int t) const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        auto it = cache.find(t);
+        if (it != cache.end())
+        {
+            recent.splice(recent.begin(), recent, it->second.recent);
+            return it->second.samples;
+        }
+        if (loading.find(t) == loading.end())
+            break;
+        loaded.wait(lock);
+    }
+
+    loading.insert(t);
+    lock.unlock();
+    std::vector<int32_t> samples;
+    const bool ok = Read(t, samples);
+    lock.lock();
+    loading.erase(t);
+    Samples resident = Insert(t, samples, ok);
+    lock.unlock();
+    loaded.notify_all();
+    return resident;
+}
+
+/*!
+\brief Request tiles to be loaded by the background thread.
+
+Previous requests that have not been served yet are discarded.
+\param tiles Tile indexes, most urgent first.
+*/
+void HeightFieldTiles::Prefetch(const std::vector<int>& tiles)
+{
+    if (!worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.clear();
+        for (int t : tiles)
+        {
+            // Never request more tiles than the cache can hold, they would evict each other
+            if (requests.size() >= capacity / 2)
+                break;
+            if (t >= 0 && t < tx * ty && cache.find(t) == cache.end() && loading.find(t) == loading.end())
+                requests.push_back(t);
+        }
+    }
+    pending.notify_one();
+}
+
+/*!
+\brief Read a tile from the file. The mutex must not be locked.
+
+Every concurrent read uses its own file handle, handles are kept open for the next reads.
+\param t Tile index.
+\param samples Samples of the tile.
+*/
+bool HeightFieldTiles::Read(int t, std::vector<int32_t>& samples) const
+{
+    FILE* f = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!files.empty())
+        {
+            f = files.back();
+            files.pop_back();
+        }
+    }
+    if (f == nullptr)
+        f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+
+    const size_t n = size_t(tile) * tile;
+    samples.resize(n);
+    const long long offset = 16 + (long long)t * (long long)(n * sizeof(int32_t));
+    const bool ok = HeightFieldTilesSeek(f, offset, SEEK_SET) && fread(samples.data(), sizeof(int32_t), n, f) == n;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    files.push_back(f);
+    return ok;
+}
+
+/*!
+\brief Make a tile resident, evicting the least recently used ones. The mutex must be locked.
+
+Threads still reading the samples of an evicted tile keep them alive.
+\param t Tile index.
+\param samples Samples, moved into the cache.
+\param ok Whether the samples could be read, they are replaced by zeros otherwise.
+\return Samples of the resident tile.
+*/
+HeightFieldTiles::Samples HeightFieldTiles::Insert(int t, std::vector<int32_t>& samples, bool ok) const
+{
+    if (ok)
+        loads++;
+    else
+    {
+        failures++;
+        fprintf(stderr, "Cannot read tile %d of %s, replaced by zeros\n", t, path.c_str());
+        samples.assign(size_t(tile) * tile, 0);
+    }
+
+    auto it = cache.find(t);
+    if (it != cache.end())
+    {
+        recent.splice(recent.begin(), recent, it->second.recent);
+        return it->second.samples;
+    }
+
+    while (cache.size() >= capacity)
+    {
+        cache.erase(recent.back());
+        recent.pop_back();
+    }
+    recent.push_front(t);
+    Tile& resident = cache[t];
+    resident.samples = std::make_shared<const std::vector<int32_t>>(std::move(samples));
+    resident.recent = recent.begin();
+    return resident.samples;
+}
+
+/*!
+\brief Prefetch thread, loads the requested tiles without holding the cache lock during reads.
+*/
+void HeightFieldTiles::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        pending.wait(lock, [this] { return stop || !requests.empty(); });
+        if (stop)
+            break;
+
+        const int t = requests.front();
+        requests.pop_front();
+        if (cache.find(t) != cache.end() || loading.find(t) != loading.end())
+            continue;
+
+        loading.insert(t);
+        lock.unlock();
+        std::vector<int32_t> samples;
+        const bool ok = Read(t, samples);
+        lock.lock();
+        loading.erase(t);
+        Insert(t, samples, ok);
+        loaded.notify_all();
+    }
+}
+
+/*!
+\brief Write the samples of a height field in the tiled format.
+\param fp File name.
+\param hf Height field.
+\param s Number of samples along a side of a tile.
+*/
+bool HeightFieldTiles::Save(const char* fp, const HeightField& hf, int s)
+{
+    if (hf.SizeX() < 1 || hf.SizeY() < 1 || s < 1)
+        return false;
+
+    FILE* f = fopen(fp, "wb");
+    if (f == nullptr)
+        return false;
+
+    const int32_t header[3] = { hf.SizeX(), hf.SizeY(), s };
+    bool ok = fwrite(HeightFieldTilesMagic, 1, 4, f) == 4 && fwrite(header, sizeof(int32_t), 3, f) == 3;
+
+    const int mx = (hf.SizeX() + s - 1) / s;
+    const int my = (hf.SizeY() + s - 1) / s;
+    std::vector<int32_t> samples(size_t(s) * s);
+    for (int b = 0; b < my && ok; b++)
+    {
+        for (int a = 0; a < mx && ok; a++)
+        {
+            for (int j = 0; j < s; j++)
+            {
+                for (int i = 0; i < s; i++)
+                    samples[size_t(j) * s + i] = hf.Sample(a * s + i, b * s + j);
+            }
+            ok = fwrite(samples.data(), sizeof(int32_t), samples.size(), f) == samples.size();
+        }
+    }
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,121 @@
+#include "image_writer.h"
+
+/*!
+\class ImageWriter image_writer.h
+
+\brief Encodes and writes images to files on a worker thread.
+
+Compressing a large image takes much longer than rendering it, so screenshots are queued and
+written in the background while the user interface keeps running. Images are written in the
+order they were queued. Images still queued when the writer is destroyed are written first.
+
+\code
+ImageWriter writer;
+writer.Save(image, "screen.png");
+writer.Wait(); // The file is written
+\endcode
+*/
+
+/*!
+\brief Start the worker thread.
+*/
+ImageWriter::ImageWriter()
+{
+    worker = std::thread(&ImageWriter::Run, this);
+}
+
+/*!
+\brief Write the remaining images and stop the worker thread.
+*/
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    pending.notify_one();
+    worker.join();
+}
+
+/*!
+\brief Queue an image to be written.
+
+The image is implicitly shared, so queuing it does not copy its pixels.
+\param image Image.
+\param name File name, the format is deduced from its suffix.
+*/
+void ImageWriter::Save(const QImage& image, const QString& name)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({ image, name });
+    }
+    pending.notify_one();
+}
+
+/*!
+\brief Block until all the queued images have been written.
+*/
+void ImageWriter::Wait() const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return jobs.empty() && !busy; });
+}
+
+/*!
+\brief Return the number of images queued or being written.
+*/
+int ImageWriter::Pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return int(jobs.size()) + (busy ? 1 : 0);
+}
+
+/*!
+\brief Return the number of images written so far.
+*/
+int ImageWriter::Written() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+/*!
+\brief Return the number of images that could not be written.
+*/
+int ImageWriter::Failed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+/*!
+\brief Worker thread, encodes the images without holding the lock.
+*/
+void ImageWriter::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        pending.wait(lock, [this] { return stop || !jobs.empty(); });
+        if (jobs.empty())
+            break;
+
+        Job job = jobs.front();
+        jobs.pop_front();
+        busy = true;
+
+        lock.unlock();
+        const bool ok = job.image.save(job.name);
+        job = Job();
+        lock.lock();
+
+        busy = false;
+        if (ok)
+            written++;
+        else
+            failed++;
+        if (jobs.empty())
+            done.notify_all();
+    }
+}
@@ -1,4 +1,5 @@
 #include "implicits.h"
+#include "trace.h"
 
 const double AnalyticScalarField::Epsilon = 1e-6;
 
@@ -25,9 +26,12 @@ double AnalyticScalarField::Value(const Vector& p) const
 \param n Discretization parameter.
 \param g Returned geometry.
 \param epsilon Epsilon value for computing vertices on straddling edges.
+\param progress Reports the progress once per layer, the geometry is left empty if it is cancelled.
 */
-void AnalyticScalarField::Polygonize(int n, Mesh& g, const Box& box, const double& epsilon) const
+void AnalyticScalarField::Polygonize(int n, Mesh& g, const Box& box, const double& epsilon, const BuildProgress& progress) const
 {
+  TRACE_ZONE("AnalyticScalarField::Polygonize");
+
   std::vector<Vector> vertex;
   std::vector<Vector> normal;
 
@@ -115,6 +119,7 @@ void AnalyticScalarField::Polygonize(int n, Mesh& g, const Box& box, const doubl
 
   // Array for edge vertices
   int e[12];
+  bool cancelled = false;
 
   // For all layers
   for (int k = naz; k < nbz; k++)
@@ -223,6 +228,12 @@ void AnalyticScalarField::Polygonize(int n, Mesh& g, const Box& box, const doubl
     std::swap(eax, ebx);
     std::swap(eay, eby);
     std::swap(u, v);
+
+    if (progress && !progress(double(k + 1) / nbz))
+    {
+      cancelled = true;
+      break;
+    }
   }
 
   delete[]a;
@@ -236,6 +247,12 @@ void AnalyticScalarField::Polygonize(int n, Mesh& g, const Box& box, const doubl
   delete[]eby;
   delete[]ez;
 
+  if (cancelled)
+  {
+    g = Mesh();
+    return;
+  }
+
   std::vector<int> normals = triangle;
 
   g = Mesh(vertex, normal, triangle, normals);
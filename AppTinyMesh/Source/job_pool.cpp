@@ -0,0 +1,109 @@
+// Job pool
+
+#include "job_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+
+/*!
+\brief Create the pool and start its workers.
+\param n Number of workers, by default one less than the number of hardware threads, so that
+the interface thread keeps a core of its own.
+*/
+JobPool::JobPool(int n)
+{
+  if (n <= 0)
+    n = std::max(2, int(std::thread::hardware_concurrency()) - 1);
+  for (int i = 0; i < n; i++)
+    workers.emplace_back(&JobPool::Work, this);
+}
+
+/*!
+\brief Cancel the jobs and wait for the workers.
+*/
+JobPool::~JobPool()
+{
+  Cancel();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+/*!
+\brief Queue a job in the current generation.
+
+May be called by any thread.
+\param job The job.
+\param progress Called by the worker running the job whenever the job reports its progress.
+\return The generation of the job.
+*/
+int JobPool::Submit(Job&& job, ProgressCallback&& progress)
+{
+  int g;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    g = generation.load(std::memory_order_relaxed);
+    queue.push_back({ std::move(job), std::move(progress), g });
+  }
+  wake.notify_one();
+  return g;
+}
+
+/*!
+\brief Cancel every job submitted so far.
+
+Queued jobs are dropped, running jobs see their token cancelled.
+\return The new generation.
+*/
+int JobPool::Cancel()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  const int g = generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+  queue.clear();
+  if (running == 0)
+    idle.notify_all();
+  return g;
+}
+
+/*!
+\brief Wait until every queued and running job is done.
+*/
+void JobPool::Wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return queue.empty() && running == 0; });
+}
+
+/*!
+\brief Run the jobs, executed by every worker.
+*/
+void JobPool::Work()
+{
+  Trace::SetThreadName("Job worker");
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;)
+  {
+    wake.wait(lock, [this] { return quit || !queue.empty(); });
+    if (quit)
+      return;
+
+    Entry entry = std::move(queue.front());
+    queue.pop_front();
+    running++;
+    lock.unlock();
+
+    if (Current(entry.generation))
+      entry.job(Token(this, entry.generation, &entry.progress));
+    entry = Entry();
+
+    lock.lock();
+    running--;
+    if (running == 0 && queue.empty())
+      idle.notify_all();
+  }
+}
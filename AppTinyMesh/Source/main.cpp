@@ -1,12 +1,67 @@
 #include "qte.h"
+#include "trace.h"
 #include <QtWidgets/qapplication.h>
+#include <QtCore/QCommandLineParser>
+#include <QtGui/QSurfaceFormat>
+
+#include <iostream>
 
 int main(int argc, char *argv[])
 {
 	QApplication app(argc, argv);
 
+	// Benchmark mode: a camera path is rendered and the statistics of every frame are written to a CSV file
+	QCommandLineParser parser;
+	parser.addHelpOption();
+	QCommandLineOption benchmark("benchmark", "Render the camera path stored in <file>, then exit.", "file");
+	QCommandLineOption scene("scene", "Example rendered by the benchmark, such as ComplexMesh or HeightField.", "name", "ComplexMesh");
+	QCommandLineOption frames("frames", "Number of frames rendered by the benchmark.", "n", "1000");
+	QCommandLineOption size("size", "Size of the frames rendered by the benchmark.", "WxH", "1280x720");
+	QCommandLineOption output("output", "CSV file written by the benchmark.", "file", "benchmark.csv");
+	QCommandLineOption trace("trace", "Record the traced zones of the session, and save them as a Chrome trace to <file> on exit.", "file");
+	parser.addOptions({ benchmark, scene, frames, size, output, trace });
+	parser.process(app);
+
+	if (parser.isSet(trace))
+	{
+		if (!Trace::Compiled())
+			std::cout << "Warning : Zones are not compiled, configure with TINYMESH_TRACING to record them" << std::endl;
+		Trace::SetThreadName("Interface");
+		Trace::Start();
+	}
+
+	CameraPath path;
+	if (parser.isSet(benchmark))
+	{
+		if (!path.Load(parser.value(benchmark).toStdString()) || path.Size() == 0)
+		{
+			std::cout << "Error : Camera path " << parser.value(benchmark).toStdString() << " could not be loaded" << std::endl;
+			return 1;
+		}
+
+		// Frames are not synchronized with the display
+		QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+		format.setSwapInterval(0);
+		QSurfaceFormat::setDefaultFormat(format);
+	}
+
 	MainWindow mainWin;
 	mainWin.showMaximized();
 
-	return app.exec();
+	if (parser.isSet(benchmark))
+	{
+		const QStringList wh = parser.value(size).split('x');
+		const int w = wh.value(0).toInt();
+		const int h = wh.value(1).toInt();
+		if (w <= 0 || h <= 0 || !mainWin.Benchmark(parser.value(scene), path, parser.value(frames).toInt(), parser.value(output), w, h))
+		{
+			std::cout << "Error : Invalid benchmark size or scene" << std::endl;
+			return 1;
+		}
+	}
+
+	const int code = app.exec();
+	if (parser.isSet(trace) && !Trace::Save(parser.value(trace).toStdString()))
+		std::cout << "Error : Trace " << parser.value(trace).toStdString() << " could not be written" << std::endl;
+	return code;
 }
@@ -1,6 +1,7 @@
 #include "realtime.h"
 
 #include "meshcolor.h"
+#include "trace.h"
 
 #include <iostream>
 
@@ -8,9 +9,17 @@
 #include <QtGui/QKeyEvent>
 #include <QtGui/QMouseEvent>
 #include <QtCore/qdatetime.h>
+#include <QtCore/QFile>
+#include <QtCore/QDir>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTextStream>
 #include <QtGui/QPainter>
 
 #include <fstream>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <future>
 
 /*!
 \brief Default constructor.
@@ -22,20 +31,34 @@ MeshWidget::MeshGL::MeshGL()
     shading = MeshShading::Triangles;
     material = MeshMaterial::Normal;
 
+    pool = nullptr;
     vao = 0;
     fullBuffer = 0;
-    indexBuffer = 0;
     triangleCount = 0;
+    lodLevel = 0;
+    attributes = 2;
+    batchSlot = -1;
     SetFrame(Vector::Null);
+
+    regions = 0;
+    region = 0;
+    mapped = nullptr;
+    fences[0] = fences[1] = fences[2] = 0;
+
+    instanceCount = 0;
 }
 
 /*!
 \brief Constructor from a Mesh and a frame scaled.
+\param p Pool storing the vertex and index data.
 */
-MeshWidget::MeshGL::MeshGL(const Mesh& mesh, const Vector& position) : MeshGL()
+MeshWidget::MeshGL::MeshGL(GpuBufferPool* p, const Mesh& mesh, const Vector& position) : MeshGL()
 {
+    TRACE_ZONE("MeshGL upload");
+
+    pool = p;
     SetFrame(position);
-    bbox = mesh.GetBox();
+    meshBox = bbox = mesh.GetBox();
 
     // Compute plain arrays of sorted vertices & normals
     std::vector<int> vertexIndexes = mesh.VertexIndexes();
@@ -61,60 +84,61 @@ MeshWidget::MeshGL::MeshGL(const Mesh& mesh, const Vector& position) : MeshGL()
         normals[i * 3 + 1] = float(normal[1]);
         normals[i * 3 + 2] = float(normal[2]);
     }
-    // Indices are now sorted
-    int* indices = new int[nbVertex];
-    for (int i = 0; i < nbVertex; i++)
-        indices[i] = i;
+    // Indices are now sorted, large meshes get coarser levels of detail sharing the same vertices
     triangleCount = nbVertex;
+    lod = nbVertex >= 3 * MinLodTriangles ? MeshLOD(vertices, nbVertex) : MeshLOD(nbVertex);
 
-    // Generate vao & buffers
+    // Small meshes are kept in memory to be rasterized as occluders
+    if (nbVertex <= 3 * MaxOccluderTriangles)
+        occluder.assign(vertices, vertices + singleBufferSize);
+
+    // Generate vao & ranges of the pool
     if (vao == 0)
         glGenVertexArrays(1, &vao);
-    if (fullBuffer == 0)
-        glGenBuffers(1, &fullBuffer);
-    if (indexBuffer == 0)
-        glGenBuffers(1, &indexBuffer);
-
-
-    glBindVertexArray(vao);
     size_t fullSize = sizeof(float) * singleBufferSize
             + sizeof(float) * singleBufferSize;
-    glBindBuffer(GL_ARRAY_BUFFER, fullBuffer);
-    glBufferData(GL_ARRAY_BUFFER, fullSize, nullptr, GL_STATIC_DRAW);
+    vertexRange = pool->Allocate(fullSize);
+    indexRange = pool->Allocate(sizeof(int) * lod.Size());
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexRange.buffer);
 
     // Vertices(0)
     size_t size = 0;
     size_t offset = 0;
     size = sizeof(float) * singleBufferSize;
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size, vertices);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (const void*)offset);
+    pool->Write(vertexRange, offset, size, vertices);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (const void*)(vertexRange.offset + offset));
     glEnableVertexAttribArray(0);
 
     // Normals(1)
     offset = offset + size;
     size = sizeof(float) * singleBufferSize;
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size, normals);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (const void*)offset);
+    pool->Write(vertexRange, offset, size, normals);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (const void*)(vertexRange.offset + offset));
     glEnableVertexAttribArray(1);
 
     // Triangles
-    glGenBuffers(1, &indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * nbVertex, indices, GL_STATIC_DRAW);
+    pool->Write(indexRange, 0, sizeof(int) * lod.Size(), lod.Indexes().data());
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexRange.buffer);
+    lod.ReleaseIndexes();
 
     // Free data
     delete[] vertices;
     delete[] normals;
-    delete[] indices;
 }
 
 /*!
 \brief Constructor from a MeshColor and a frame scaled.
+\param p Pool storing the vertex and index data.
 */
-MeshWidget::MeshGL::MeshGL(const MeshColor& mesh, const Vector& fr) : MeshGL()
+MeshWidget::MeshGL::MeshGL(GpuBufferPool* p, const MeshColor& mesh, const Vector& fr) : MeshGL()
 {
+    TRACE_ZONE("MeshGL upload");
+
+    pool = p;
     SetFrame(fr);
-    bbox = mesh.GetBox();
+    meshBox = bbox = mesh.GetBox();
 
     // Compute plain arrays of sorted vertices & normals
     std::vector<int> vertexIndexes = mesh.VertexIndexes();
@@ -148,70 +172,82 @@ MeshWidget::MeshGL::MeshGL(const MeshColor& mesh, const Vector& fr) : MeshGL()
         colors[i * 3 + 1] = float(color[1]);
         colors[i * 3 + 2] = float(color[2]);
     }
-    // Indices are now sorted
-    int* indices = new int[nbVertex];
-    for (int i = 0; i < nbVertex; i++)
-        indices[i] = i;
+    // Indices are now sorted, large meshes get coarser levels of detail sharing the same vertices
     triangleCount = nbVertex;
+    lod = nbVertex >= 3 * MinLodTriangles ? MeshLOD(vertices, nbVertex) : MeshLOD(nbVertex);
+    attributes = 3;
+
+    // Small meshes are kept in memory to be rasterized as occluders
+    if (nbVertex <= 3 * MaxOccluderTriangles)
+        occluder.assign(vertices, vertices + singleBufferSize);
 
-    // Generate vao & buffers
+    // Generate vao & ranges of the pool
     if (vao == 0)
         glGenVertexArrays(1, &vao);
-    if (fullBuffer == 0)
-        glGenBuffers(1, &fullBuffer);
-    if (indexBuffer == 0)
-        glGenBuffers(1, &indexBuffer);
-
-    glBindVertexArray(vao);
     size_t fullSize =
             sizeof(float) * singleBufferSize	// Vertices
             + sizeof(float) * singleBufferSize	// Normals
             + sizeof(float) * singleBufferSize;	// Colors
-    glBindBuffer(GL_ARRAY_BUFFER, fullBuffer);
-    glBufferData(GL_ARRAY_BUFFER, fullSize, nullptr, GL_STATIC_DRAW);
+    vertexRange = pool->Allocate(fullSize);
+    indexRange = pool->Allocate(sizeof(int) * lod.Size());
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexRange.buffer);
 
     // Vertices(0)
     size_t size = 0;
     size_t offset = 0;
     size = sizeof(float) * singleBufferSize;
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size, vertices);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (const void*)offset);
+    pool->Write(vertexRange, offset, size, vertices);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (const void*)(vertexRange.offset + offset));
     glEnableVertexAttribArray(0);
 
     // Normals(1)
     offset = offset + size;
     size = sizeof(float) * singleBufferSize;
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size, normals);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (const void*)offset);
+    pool->Write(vertexRange, offset, size, normals);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (const void*)(vertexRange.offset + offset));
     glEnableVertexAttribArray(1);
 
     // Colors(2)
     offset = offset + size;
     size = sizeof(float) * singleBufferSize;
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size, colors);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (const void*)offset);
+    pool->Write(vertexRange, offset, size, colors);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (const void*)(vertexRange.offset + offset));
     glEnableVertexAttribArray(2);
 
     // Triangles
-    glGenBuffers(1, &indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * nbVertex, indices, GL_STATIC_DRAW);
+    pool->Write(indexRange, 0, sizeof(int) * lod.Size(), lod.Indexes().data());
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexRange.buffer);
+    lod.ReleaseIndexes();
 
     // Free data
     delete[] vertices;
     delete[] normals;
     delete[] colors;
-    delete[] indices;
 }
 
 /*!
-\brief Delete all opengl buffers.
+\brief Delete the opengl objects of the mesh and give its ranges back to the pool.
 */
 void MeshWidget::MeshGL::Delete()
 {
+    for (int i = 0; i < 3; i++)
+    {
+        if (fences[i] != 0)
+            glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+    mapped = nullptr;
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &fullBuffer);
-    glDeleteBuffers(1, &indexBuffer);
+    vao = fullBuffer = 0;
+    if (pool != nullptr)
+    {
+        pool->Free(vertexRange);
+        pool->Free(indexRange);
+        pool->Free(instanceRange);
+    }
 }
 
 /*!
@@ -242,9 +278,326 @@ void MeshWidget::MeshGL::SetFrame(const Vector& fr)
     TRSMatrix[15] = 1.0;
 }
 
+/*!
+\brief Compute the bounding box of the mesh transformed by its frame.
+
+The center is transformed and the half size is projected onto the axes using the absolute
+values of the rotation and scale coefficients of the column major TRSMatrix.
+*/
+Box MeshWidget::MeshGL::WorldBox() const
+{
+    const Vector c = bbox.Center();
+    const Vector e = 0.5 * bbox.Diagonal();
+    Vector center, half;
+    for (int r = 0; r < 3; r++)
+    {
+        center[r] = TRSMatrix[12 + r] + TRSMatrix[r] * c[0] + TRSMatrix[4 + r] * c[1] + TRSMatrix[8 + r] * c[2];
+        half[r] = fabs(TRSMatrix[r]) * e[0] + fabs(TRSMatrix[4 + r]) * e[1] + fabs(TRSMatrix[8 + r]) * e[2];
+    }
+    return Box(center - half, center + half);
+}
+
+/*!
+\brief Compute the box enclosing all the instances of the geometry, same as WorldBox() for every instance.
+
+The box of the geometry is returned if the mesh is drawn once.
+*/
+Box MeshWidget::MeshGL::InstancesBox() const
+{
+    if (instances.empty())
+        return meshBox;
+
+    const Vector center = meshBox.Center();
+    const Vector half = 0.5 * meshBox.Diagonal();
+    Box box = Box::Null;
+    for (size_t k = 0; k < instances.size(); k++)
+    {
+        const std::vector<double>& linear = instances[k].linear.Entries();
+        Vector a, b;
+        for (int r = 0; r < 3; r++)
+        {
+            double x = instances[k].position[r];
+            double e = 0.0;
+            for (int c = 0; c < 3; c++)
+            {
+                x += linear[r * 3 + c] * center[c];
+                e += fabs(linear[r * 3 + c]) * half[c];
+            }
+            a[r] = x - e;
+            b[r] = x + e;
+        }
+        box = k == 0 ? Box(a, b) : Box(box, Box(a, b));
+    }
+    return box;
+}
+
+/*!
+\brief Draw the mesh as a set of instances sharing its vertex data.
+
+The transforms are stored in a buffer read as a per instance matrix attribute. The bounding box
+is replaced by the box enclosing all the instances, and the frames are kept so that the box
+follows later updates of the geometry.
+\param frames Frames of the instances.
+\param attribute First of the four locations of the matrix attribute in the mesh program.
+*/
+void MeshWidget::MeshGL::SetInstances(const std::vector<InstanceFrame>& frames, GLint attribute)
+{
+    std::vector<float> matrices(frames.size() * 16);
+    for (size_t k = 0; k < frames.size(); k++)
+    {
+        // Column major matrix
+        float* m = &matrices[k * 16];
+        const std::vector<double>& linear = frames[k].linear.Entries();
+        for (int c = 0; c < 3; c++)
+        {
+            for (int r = 0; r < 3; r++)
+                m[c * 4 + r] = float(linear[r * 3 + c]);
+            m[c * 4 + 3] = 0.0f;
+            m[12 + c] = float(frames[k].position[c]);
+        }
+        m[15] = 1.0f;
+    }
+    instances = frames;
+    bbox = InstancesBox();
+    instanceCount = int(frames.size());
+
+    // Instances are not used as occluders
+    occluder.clear();
+
+    pool->Free(instanceRange);
+    instanceRange = pool->Allocate(sizeof(float) * matrices.size());
+    pool->Write(instanceRange, 0, sizeof(float) * matrices.size(), matrices.data());
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceRange.buffer);
+    if (attribute >= 0)
+    {
+        // A mat4 attribute takes four consecutive locations, one per column
+        for (int c = 0; c < 4; c++)
+        {
+            glVertexAttribPointer(attribute + c, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 16, (const void*)(instanceRange.offset + sizeof(float) * 4 * c));
+            glVertexAttribDivisor(attribute + c, 1);
+            glEnableVertexAttribArray(attribute + c);
+        }
+    }
+}
+
+/*!
+\brief Create an identity linear transform, with a translation.
+\param p Translation.
+*/
+MeshWidget::InstanceFrame::InstanceFrame(const Vector& p) : linear(3), position(p)
+{
+    linear.Entries()[0] = linear.Entries()[4] = linear.Entries()[8] = 1.0;
+}
+
+/*!
+\brief Create a frame.
+\param m Linear transform, a 3x3 matrix.
+\param p Translation.
+*/
+MeshWidget::InstanceFrame::InstanceFrame(const Matrix& m, const Vector& p) : linear(m), position(p)
+{
+}
+
+/*!
+\brief Update the vertex data of the mesh, writing only the modified triangles.
+
+The first update replaces the static buffer by streamed storage holding vertices, normals and
+colors. When persistent mapping is available, the storage holds three copies of the vertex data:
+every update writes the copy following the one being drawn, after waiting for the GPU to be done
+with it, so that the CPU and the GPU never access the same copy. Otherwise a single copy is
+updated with glBufferSubData().
+\param mesh The mesh, with the same triangles as the uploaded one.
+\param ranges Modified triangles, all of them if empty.
+\return false if the number of triangles has changed, in which case nothing is updated.
+*/
+bool MeshWidget::MeshGL::Update(const MeshColor& mesh, const std::vector<TriangleRange>& ranges)
+{
+    if (mesh.Triangles() * 3 != triangleCount)
+        return false;
+    meshBox = mesh.GetBox();
+    bbox = InstancesBox();
+
+    if (regions == 0)
+    {
+        Stream(mesh);
+        return true;
+    }
+
+    // Clamped ranges
+    std::vector<TriangleRange> dirty;
+    if (ranges.empty())
+        dirty.push_back(TriangleRange(0, mesh.Triangles()));
+    for (const TriangleRange& range : ranges)
+    {
+        TriangleRange r(std::max(range.first, 0), std::min(range.second, mesh.Triangles()));
+        if (r.first < r.second)
+            dirty.push_back(r);
+    }
+
+    const size_t n = size_t(triangleCount) * 3;
+    if (mapped != nullptr)
+    {
+        const int next = (region + 1) % regions;
+        if (fences[next] != 0)
+        {
+            GLenum status = glClientWaitSync(fences[next], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            while (status == GL_TIMEOUT_EXPIRED)
+                status = glClientWaitSync(fences[next], 0, 1000000);
+            glDeleteSync(fences[next]);
+            fences[next] = 0;
+        }
+
+        // The copy also misses the triangles modified by the two previous updates
+        std::vector<TriangleRange> writes = dirty;
+        writes.insert(writes.end(), history[0].begin(), history[0].end());
+        writes.insert(writes.end(), history[1].begin(), history[1].end());
+        const TriangleRange all(0, mesh.Triangles());
+        if (std::find(writes.begin(), writes.end(), all) != writes.end())
+            writes.assign(1, all);
+
+        float* vertices = mapped + n * next;
+        float* normals = mapped + n * (regions + next);
+        float* colors = mapped + n * (2 * regions + next);
+        for (const TriangleRange& r : writes)
+            Write(mesh, r.first, r.second, vertices + 9 * r.first, normals + 9 * r.first, colors + 9 * r.first);
+        history[1].swap(history[0]);
+        history[0] = dirty;
+        region = next;
+    }
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, fullBuffer);
+        std::vector<float> data;
+        for (const TriangleRange& r : dirty)
+        {
+            const size_t m = size_t(r.second - r.first) * 9;
+            data.resize(3 * m);
+            Write(mesh, r.first, r.second, data.data(), data.data() + m, data.data() + 2 * m);
+            for (int i = 0; i < 3; i++)
+                glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * (n * i + 9 * size_t(r.first)), sizeof(float) * m, data.data() + i * m);
+        }
+    }
+    return true;
+}
+
+/*!
+\brief Replace the static vertex buffer by streamed storage, and upload the whole mesh.
+\param mesh The mesh.
+*/
+void MeshWidget::MeshGL::Stream(const MeshColor& mesh)
+{
+    TRACE_ZONE("MeshGL::Stream");
+
+    const int triangles = mesh.Triangles();
+    const size_t n = size_t(triangleCount) * 3;
+
+    // Streamed meshes are deformed, they are neither used as occluders nor simplified
+    occluder.clear();
+    lodLevel = 0;
+
+    // Storage allocated with glBufferStorage() is immutable, so the range of the pool is replaced by a buffer of the mesh
+    glBindVertexArray(vao);
+    pool->Free(vertexRange);
+    glGenBuffers(1, &fullBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, fullBuffer);
+
+    if (GLEW_ARB_buffer_storage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        regions = 3;
+        glBufferStorage(GL_ARRAY_BUFFER, sizeof(float) * n * 9, nullptr, flags);
+        mapped = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(float) * n * 9, flags);
+        if (mapped == nullptr)
+        {
+            glDeleteBuffers(1, &fullBuffer);
+            glGenBuffers(1, &fullBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, fullBuffer);
+        }
+    }
+    if (mapped != nullptr)
+    {
+        for (int r = 0; r < regions; r++)
+            Write(mesh, 0, triangles, mapped + n * r, mapped + n * (regions + r), mapped + n * (2 * regions + r));
+    }
+    else
+    {
+        regions = 1;
+        std::vector<float> data(n * 3);
+        Write(mesh, 0, triangles, data.data(), data.data() + n, data.data() + 2 * n);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * n * 3, data.data(), GL_DYNAMIC_DRAW);
+    }
+
+    // Vertices(0), normals(1) and colors(2), every attribute stores all the copies
+    attributes = 3;
+    for (int i = 0; i < 3; i++)
+    {
+        glVertexAttribPointer(i, 3, GL_FLOAT, GL_FALSE, 0, (const void*)(sizeof(float) * n * regions * i));
+        glEnableVertexAttribArray(i);
+    }
+    region = 0;
+    history[0].clear();
+    history[1].clear();
+}
+
+/*!
+\brief Convert a range of triangles to the unindexed layout of the vertex buffer.
+\param mesh The mesh.
+\param a, b Half open range of triangles.
+\param vertices, normals, colors Destination of the first triangle of the range.
+*/
+void MeshWidget::MeshGL::Write(const MeshColor& mesh, int a, int b, float* vertices, float* normals, float* colors)
+{
+#pragma omp parallel for
+    for (int t = a; t < b; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            const size_t i = (size_t(t - a) * 3 + k) * 3;
+            const Vector vertex = mesh.Vertex(mesh.VertexIndex(t, k));
+            const Vector normal = mesh.Normal(mesh.NormalIndex(t, k));
+            const Color color = mesh.GetColor(mesh.ColorIndex(t, k));
+            for (int j = 0; j < 3; j++)
+            {
+                vertices[i + j] = float(vertex[j]);
+                normals[i + j] = float(normal[j]);
+                colors[i + j] = float(color[j]);
+            }
+        }
+    }
+}
+
+/*!
+\brief Protect the copy of streamed vertex data read by the last draw call.
+*/
+void MeshWidget::MeshGL::Fence()
+{
+    if (mapped == nullptr)
+        return;
+    if (fences[region] != 0)
+        glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/*!
+\brief Order draw calls by program, then material, shading and wireframe state.
+*/
+bool MeshWidget::DrawItem::operator<(const DrawItem& item) const
+{
+    if (program != item.program)
+        return program < item.program;
+    if (material != item.material)
+        return material < item.material;
+    if (shading != item.shading)
+        return shading < item.shading;
+    return wireframe < item.wireframe;
+}
+
 
 /*!
 \brief Default constructor.
+
+Scene changes made before the widget is shown are queued, and executed once the render thread starts.
 */
 MeshWidget::MeshWidget()
 {
@@ -252,18 +605,35 @@ MeshWidget::MeshWidget()
 
 /*!
 \brief Destructor.
+
+The render thread writes the pending screenshots and releases the scene before exiting.
 */
 MeshWidget::~MeshWidget()
 {
-    // Destroy all meshes
-    ClearAll();
+    if (renderThread != nullptr)
+    {
+        Post([this] { quit = true; });
+        renderThread->wait();
+        delete renderThread;
+    }
+    imageWriter.Wait();
 
-    // Release shader
-    release_program(mainShaderProgram);
+    makeCurrent();
+    glDeleteFramebuffers(1, &presentFramebuffer);
+    for (FrameImage& image : images)
+    {
+        if (image.fence != 0)
+            glDeleteSync(image.fence);
+    }
+    doneCurrent();
+    delete renderSurface;
 }
 
 /*!
-\brief Initialize OpenGL, shaders and a camera centered at origin.
+\brief Initialize OpenGL, a camera centered at origin, and start the render thread.
+
+The render thread draws into its own context, shared with the context of the widget, so that
+the widget only copies the frames it receives.
 */
 void MeshWidget::initializeGL()
 {
@@ -274,7 +644,148 @@ void MeshWidget::initializeGL()
         std::cout << "Still resuming application" << std::endl;
     }
     std::cout << "Using GL_VERSION: " << glGetString(GL_VERSION) << std::endl;
+    glGenFramebuffers(1, &presentFramebuffer);
+
+    // Linked programs are cached on disk, and only compiled again when their source or the driver changes
+    const QString cache = QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("shaders");
+    program_cache_directory(cache.toLocal8Bit().data());
+
+    camera = Camera(Vector(-10.0), Vector(0.0));
+    SetNearAndFarPlane(1.0, 5000.0);
+
+    // Context and surface are created on the GUI thread, the context is then handed to the render thread
+    renderSurface = new QOffscreenSurface;
+    renderSurface->setFormat(context()->format());
+    renderSurface->create();
+    renderContext = new QOpenGLContext;
+    renderContext->setFormat(context()->format());
+    renderContext->setShareContext(context());
+    if (!renderContext->create())
+        std::cout << "Error : Render context could not be created" << std::endl;
+    renderThread = QThread::create([this] { RenderLoop(); });
+    renderContext->moveToThread(renderThread);
+    renderThread->start();
+}
+
+/*!
+\brief Main loop of the render thread.
+
+The thread sleeps until commands are pushed, executes them in order, and renders a frame if
+they changed the scene or the view. In continuous mode, frames are rendered back to back.
+*/
+void MeshWidget::RenderLoop()
+{
+    Trace::SetThreadName("Render");
+    renderContext->makeCurrent(renderSurface);
+    InitializeRenderer();
+
+    CommandQueue::Command command;
+    while (true)
+    {
+        {
+            // Screenshots being read back are polled every millisecond
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            if (!renderSettings.continuous && !frameRequested)
+            {
+                if (readbacks.empty())
+                    wake.wait(lock, [this] { return woken; });
+                else
+                    wake.wait_for(lock, std::chrono::milliseconds(1), [this] { return woken; });
+            }
+            woken = false;
+        }
+
+        while (commands.Pop(command))
+            command();
+        command = nullptr;
+        if (quit)
+            break;
+
+        if (frameRequested || renderSettings.continuous)
+            RenderFrame();
+        else
+            CollectReadbacks(readbacks.size());
+    }
+
+    ReleaseRenderer();
+    renderContext->doneCurrent();
+    delete renderContext;
+    renderContext = nullptr;
+}
+
+/*!
+\brief Push a command executed by the render thread.
+
+May be called before the render thread starts, the command is then executed once it does.
+\param command Command, which may own the data it works on.
+*/
+void MeshWidget::Post(CommandQueue::Command&& command)
+{
+    commands.Push(std::move(command));
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        woken = true;
+    }
+    wake.notify_one();
+}
+
+/*!
+\brief Execute a command on the render thread and wait for it to be done.
+
+Used when the caller releases data the render thread may be reading.
+\param command Command.
+*/
+void MeshWidget::Invoke(CommandQueue::Command&& command)
+{
+    if (renderThread == nullptr)
+    {
+        Post(std::move(command));
+        return;
+    }
+    std::promise<void> done;
+    std::future<void> future = done.get_future();
+    Post([&command, &done] { command(); done.set_value(); });
+    future.wait();
+}
+
+/*!
+\brief Ask the render thread for a frame of the current view.
+*/
+void MeshWidget::RequestFrame()
+{
+    const qreal ratio = devicePixelRatio();
+    View next;
+    next.camera = camera;
+    next.perspective = perspectiveProjection;
+    next.orthoSize = cameraOrthoSize;
+    next.width = int(width() * ratio);
+    next.height = int(height() * ratio);
+    Post([this, next] { view = next; frameRequested = true; });
+}
+
+/*!
+\brief Hand the settings over to the render thread.
+*/
+void MeshWidget::UpdateSettings()
+{
+    const RenderSettings next = settings;
+    Post([this, next]
+        {
+            if (renderSettings.batching && !next.batching)
+                DeleteBatch();
+            if (renderSettings.batching != next.batching)
+                drawListDirty = true;
+            profiler.enabled = next.statistics;
+            renderSettings = next;
+            frameRequested = true;
+        });
+}
 
+/*!
+\brief Initialize the GL state and the shaders of the render context.
+*/
+void MeshWidget::InitializeRenderer()
+{
     glEnable(GL_LINE_SMOOTH);
     glHint(GL_LINE_SMOOTH_HINT, GL_DONT_CARE);
 
@@ -306,196 +817,1225 @@ void MeshWidget::initializeGL()
     // Shader/Camera/Profiler
     QString fullPath = shaderPath + usedMeshShader;
     QByteArray ba = fullPath.toLocal8Bit();
-    mainShaderProgram = read_program(ba.data());
-    camera = Camera(Vector(-10.0), Vector(0.0));
-    SetNearAndFarPlane(1.0, 5000.0);
+    // Fixed attribute locations, matching the vertex arrays of MeshGL
+    static const char* const attributes[] = { "vertex", "normal", "color", "instanceMatrix", nullptr };
+    mainShaderProgram = read_program(ba.data(), "", attributes);
+
+    // Uniform locations do not change after linking
+    mainUniforms.TRSMatrix = glGetUniformLocation(mainShaderProgram, "TRSMatrix");
+    mainUniforms.useWireframe = glGetUniformLocation(mainShaderProgram, "useWireframe");
+    mainUniforms.material = glGetUniformLocation(mainShaderProgram, "material");
+    mainUniforms.shading = glGetUniformLocation(mainShaderProgram, "shading");
+
+    // Meshes drawn once read the instance matrix from the current attribute value, set to identity
+    instanceAttribute = glGetAttribLocation(mainShaderProgram, "instanceMatrix");
+    for (int c = 0; c < 4 && instanceAttribute >= 0; c++)
+        glVertexAttrib4f(instanceAttribute + c, c == 0 ? 1.0f : 0.0f, c == 1 ? 1.0f : 0.0f, c == 2 ? 1.0f : 0.0f, c == 3 ? 1.0f : 0.0f);
+
+    // Per frame data is shared through a uniform buffer bound to point 0
+    GLuint frameBlock = glGetUniformBlockIndex(mainShaderProgram, "Frame");
+    if (frameBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(mainShaderProgram, frameBlock, 0);
+    glGenBuffers(1, &frameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
     profiler.Init();
 
     // Sky
     fullPath = shaderPath + usedSkyShader;
     ba = fullPath.toLocal8Bit();
     skyboxShader = read_program(ba.data());
+    skyboxUniforms.CamPos = glGetUniformLocation(skyboxShader, "CamPos");
+    skyboxUniforms.CamLookAt = glGetUniformLocation(skyboxShader, "CamLookAt");
+    skyboxUniforms.CamUp = glGetUniformLocation(skyboxShader, "CamUp");
+    skyboxUniforms.iResolution = glGetUniformLocation(skyboxShader, "iResolution");
+    skyboxUniforms.iOffset = glGetUniformLocation(skyboxShader, "iOffset");
     glGenVertexArrays(1, &skyboxVAO);
 }
 
 /*!
-\brief Resize window.
-\param w, h Width and height.
+\brief Release the scene and all the resources of the render context, once the pending screenshots are written.
+*/
+void MeshWidget::ReleaseRenderer()
+{
+    CollectReadbacks(0);
+
+    for (MeshGL& gl : objects)
+        gl.Delete();
+    objects.Clear();
+    for (QMap<int, MeshGL*>::iterator i = terrainChunks.begin(); i != terrainChunks.end(); i++)
+    {
+        i.value()->Delete();
+        delete i.value();
+    }
+    terrainChunks.clear();
+
+    release_program(mainShaderProgram);
+    glDeleteBuffers(1, &frameUniformBuffer);
+    DeleteBatch();
+    DeleteCaptureBuffers();
+    bufferPool.Release();
+
+    // Fences of the images are left to the widget
+    for (FrameImage& image : images)
+    {
+        glDeleteFramebuffers(1, &image.framebuffer);
+        glDeleteTextures(1, &image.color);
+        glDeleteRenderbuffers(1, &image.depth);
+    }
+}
+
+/*!
+\brief Resize window.
+\param w, h Width and height.
+*/
+void MeshWidget::resizeGL(int, int)
+{
+    RequestFrame();
+}
+
+/*!
+\brief Set the projection matrix for a part of an image.
+
+The part is drawn with the off center frustum it covers in the frustum of the whole image, so
+that an image larger than the viewport can be rendered as a set of tiles.
+\param w, h Size of the image.
+\param x, y Bottom left corner of the part, in pixels.
+\param tw, th Size of the part.
+*/
+void MeshWidget::SetProjection(int w, int h, int x, int y, int tw, int th) const
+{
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+
+    // Half size of the whole image on the near plane
+    double r = view.orthoSize;
+    double t = view.orthoSize;
+    if (view.perspective)
+    {
+        t = view.camera.GetNear() * tan(0.5 * view.camera.GetAngleOfViewV(w, h));
+        r = t * double(w) / double(h);
+    }
+    const double left = r * (2.0 * x / w - 1.0);
+    const double right = r * (2.0 * (x + tw) / w - 1.0);
+    const double bottom = t * (2.0 * y / h - 1.0);
+    const double top = t * (2.0 * (y + th) / h - 1.0);
+
+    if (view.perspective)
+        glFrustum(left, right, bottom, top, view.camera.GetNear(), view.camera.GetFar());
+    else
+        glOrtho(left, right, bottom, top, view.camera.GetNear(), view.camera.GetFar());
+    glMatrixMode(GL_MODELVIEW);
+}
+
+/*!
+\brief Show the last frame rendered by the render thread.
+
+The frame is copied into the framebuffer of the widget, the stats panel being drawn over it.
+The widget keeps showing the same frame until the render thread hands a new one over, so that
+the GUI thread never waits for the rendering.
+*/
+void MeshWidget::paintGL()
+{
+    // Custom update from user
+    emit _signalUpdate();
+
+    // Take the ready frame, the previous one goes back to the render thread
+    if (ready.load(std::memory_order_acquire) & Fresh)
+        presented = ready.exchange(presented, std::memory_order_acq_rel) & 3;
+    FrameImage& image = images[presented];
+
+    const qreal ratio = devicePixelRatio();
+    const int w = int(width() * ratio);
+    const int h = int(height() * ratio);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    glViewport(0, 0, w, h);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (image.color != 0)
+    {
+        // Frame is scaled while the widget is being resized
+        glWaitSync(image.fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(image.fence);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, presentFramebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image.color, 0);
+        glBlitFramebuffer(0, 0, image.width, image.height, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+        // The render thread waits for the copy before drawing into the image again
+        image.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+
+    if (settings.statistics)
+        RenderStats(image.stats);
+
+    // Move camera
+    if (MoveAt)
+    {
+        if (stepAt < 15)
+        {
+            stepAt++;
+            double alpha = double(stepAt) / 15.;
+            camera.SetAt(currentAt * (1. - alpha) + toAt * (alpha));
+            RequestFrame();
+        }
+        else
+            MoveAt = false;
+    }
+}
+
+/*!
+\brief Render a frame of the current view into the image owned by the render thread, and hand it over to the widget.
+*/
+void MeshWidget::RenderFrame()
+{
+    TRACE_ZONE("MeshWidget::RenderFrame");
+
+    frameRequested = false;
+
+    // Screenshots whose copy is done are handed to the writer, the others are left pending
+    CollectReadbacks(readbacks.size());
+
+    const int w = view.width;
+    const int h = view.height;
+    if (w <= 0 || h <= 0)
+        return;
+
+    // Image may still be read by the widget
+    FrameImage& image = images[rendering];
+    if (image.fence != 0)
+    {
+        glWaitSync(image.fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(image.fence);
+        image.fence = 0;
+    }
+    ResizeImage(image, w, h);
+
+    // Clear
+    glBindFramebuffer(GL_FRAMEBUFFER, image.framebuffer);
+    glViewport(0, 0, w, h);
+    SetProjection(w, h, 0, 0, w, h);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.f);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    const Camera& camera = view.camera;
+    UpdateTerrain(w, h);
+    gluLookAt(camera.Eye()[0], camera.Eye()[1], camera.Eye()[2], camera.At()[0], camera.At()[1], camera.At()[2], camera.Up()[0], camera.Up()[1], camera.Up()[2]);
+
+    // Sky
+    profiler.BeginFrame();
+    DrawSky(w, h, 0, 0);
+    profiler.EndPass();
+
+    // Draw meshes
+    DrawMeshes(w, h, w, h);
+    profiler.EndPass();
+
+    // CPU Profiling
+    if (profiler.enabled)
+    {
+        profiler.Update();
+        FrameStats& stats = image.stats;
+        stats.framePerSecond = profiler.framePerSecond;
+        stats.msPerFrame = profiler.msPerFrame;
+        std::copy(profiler.gpuStats, profiler.gpuStats + RenderingProfiler::PassCount + 1, stats.gpu);
+        stats.visibleObjects = profiler.visibleObjects;
+        stats.culledObjects = profiler.culledObjects;
+        stats.occludedObjects = profiler.occludedObjects;
+        stats.drawCalls = profiler.drawCalls;
+        stats.triangles = profiler.triangles;
+        stats.pool = bufferPool.GetStats();
+    }
+    profiler.EndFrame();
+
+    // Hand the frame over, the widget is only asked to repaint if it took the previous one
+    image.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    const int previous = ready.exchange(rendering | Fresh, std::memory_order_acq_rel);
+    rendering = previous & 3;
+    if (!(previous & Fresh))
+        QMetaObject::invokeMethod(this, [this] { update(); }, Qt::QueuedConnection);
+}
+
+/*!
+\brief Allocate the buffers of a frame image if its size has changed.
+\param image Image.
+\param w, h Size of the image.
+*/
+void MeshWidget::ResizeImage(FrameImage& image, int w, int h)
+{
+    if (image.width == w && image.height == h)
+        return;
+    if (image.framebuffer == 0)
+    {
+        glGenFramebuffers(1, &image.framebuffer);
+        glGenTextures(1, &image.color);
+        glGenRenderbuffers(1, &image.depth);
+    }
+    glBindTexture(GL_TEXTURE_2D, image.color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, image.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, image.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image.color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, image.depth);
+    image.width = w;
+    image.height = h;
+}
+
+/*!
+\brief Draw the sky, behind the meshes.
+\param w, h Size of the image.
+\param x, y Bottom left corner of the part of the image drawn in the viewport, in pixels.
+*/
+void MeshWidget::DrawSky(int w, int h, int x, int y)
+{
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glUseProgram(skyboxShader);
+    glBindVertexArray(skyboxVAO);
+    const Camera& camera = view.camera;
+    glUniform3f(skyboxUniforms.CamPos, camera.Eye()[0], camera.Eye()[1], camera.Eye()[2]);
+    glUniform3f(skyboxUniforms.CamLookAt, camera.At()[0], camera.At()[1], camera.At()[2]);
+    glUniform3f(skyboxUniforms.CamUp, camera.Up()[0], camera.Up()[1], camera.Up()[2]);
+    glUniform2f(skyboxUniforms.iResolution, GLfloat(w), GLfloat(h));
+    glUniform2f(skyboxUniforms.iOffset, GLfloat(x), GLfloat(y));
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+/*!
+\brief Draw the enabled meshes and terrain chunks with the current matrices.
+
+Objects outside of the frustum of the whole image are culled, so that a tile of a larger image
+is drawn with the same objects as the image.
+\param w, h Size of the image.
+\param tw, th Size of the viewport.
+*/
+void MeshWidget::DrawMeshes(int w, int h, int tw, int th)
+{
+    // Shared uniforms, uploaded once per frame
+    FrameUniforms frame;
+    glGetFloatv(GL_MODELVIEW_MATRIX, frame.ModelViewMatrix);
+    glGetFloatv(GL_PROJECTION_MATRIX, frame.ProjectionMatrix);
+    Vector direction = Normalized(view.camera.View());
+    frame.viewDir[0] = float(direction[0]);
+    frame.viewDir[1] = float(direction[1]);
+    frame.viewDir[2] = float(direction[2]);
+    frame.viewDir[3] = 0.0f;
+    frame.WIN_SCALE[0] = tw / 2.0f;
+    frame.WIN_SCALE[1] = th / 2.0f;
+    frame.WIN_SCALE[2] = frame.WIN_SCALE[3] = 0.0f;
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, frameUniformBuffer);
+
+    // Frustum culling of the whole draw list before submission
+    if (drawListDirty)
+        BuildDrawList();
+    int visible = int(drawList.size());
+    if (w > 0 && h > 0)
+    {
+        if (view.perspective)
+            visible = Frustum(view.camera, w, h).Cull(drawBoxes, drawVisible);
+        else
+            visible = Frustum(view.camera, view.orthoSize).Cull(drawBoxes, drawVisible);
+    }
+    else
+        drawVisible.assign(drawList.size(), 1);
+    profiler.culledObjects = int(drawList.size()) - visible;
+    profiler.occludedObjects = 0;
+    if (renderSettings.occlusionCulling && w > 0 && h > 0)
+        profiler.occludedObjects = CullOccluded(frame, w, h);
+    profiler.visibleObjects = visible - profiler.occludedObjects;
+    if (w > 0 && h > 0)
+        SelectLevelsOfDetail(w, h);
+    profiler.drawCalls = 0;
+    profiler.triangles = 0;
+    for (size_t k = 0; k < drawList.size(); k++)
+    {
+        if (drawVisible[k])
+            profiler.triangles += drawList[k].mesh->lod[drawList[k].mesh->lodLevel].count / 3 * std::max(1, drawList[k].mesh->instanceCount);
+    }
+    PrepareBatchDraws();
+
+    // Sorted submission, state is only set when it changes
+    GLuint program = 0;
+    int material = -1;
+    int shading = -1;
+    int wireframe = -1;
+    for (size_t k = 0; k < drawList.size(); k++)
+    {
+        if (!drawVisible[k])
+            continue;
+        const DrawItem& item = drawList[k];
+        if (item.program != program)
+        {
+            program = item.program;
+            glUseProgram(program);
+            material = shading = wireframe = -1;
+        }
+        if (item.material != material)
+        {
+            material = item.material;
+            glUniform1i(mainUniforms.material, material);
+        }
+        if (item.shading != shading)
+        {
+            shading = item.shading;
+            glUniform1i(mainUniforms.shading, shading);
+        }
+        if (item.wireframe != wireframe)
+        {
+            wireframe = item.wireframe;
+            glUniform1i(mainUniforms.useWireframe, wireframe);
+        }
+
+        // Visible batched items of the same render state are drawn together at the first one
+        if (item.mesh->batchSlot >= 0)
+        {
+            const std::pair<int, int>& draw = batchDraws[k];
+            if (draw.second == 0)
+                continue;
+            static const GLfloat identity[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+            glUniformMatrix4fv(mainUniforms.TRSMatrix, 1, GL_FALSE, identity);
+            glBindVertexArray(batch.vao);
+            if (GLEW_ARB_multi_draw_indirect)
+            {
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.commandBuffer);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(sizeof(DrawCommand) * draw.first), draw.second, 0);
+                profiler.drawCalls++;
+            }
+            else
+            {
+                for (int c = draw.first; c < draw.first + draw.second; c++)
+                {
+                    const DrawCommand& command = frameCommands[c];
+                    glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, (const void*)(sizeof(GLuint) * command.firstIndex),
+                        1, command.baseVertex, command.baseInstance);
+                }
+                profiler.drawCalls += draw.second;
+            }
+            continue;
+        }
+        glUniformMatrix4fv(mainUniforms.TRSMatrix, 1, GL_FALSE, &item.mesh->TRSMatrix[0]);
+
+        // Draw the selected level, streamed meshes read the last written copy of their vertex data
+        const MeshLOD::Level& level = item.mesh->lod[item.mesh->lodLevel];
+        const void* indexes = (const void*)(item.mesh->indexRange.offset + sizeof(GLuint) * level.first);
+        glBindVertexArray(item.mesh->vao);
+        if (item.mesh->instanceCount > 0)
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)level.count, GL_UNSIGNED_INT, indexes, item.mesh->instanceCount, item.mesh->region * item.mesh->triangleCount);
+        else
+            glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)level.count, GL_UNSIGNED_INT, indexes, item.mesh->region * item.mesh->triangleCount);
+        item.mesh->Fence();
+        profiler.drawCalls++;
+    }
+}
+
+/*!
+\brief Cull the draw list items hidden by the largest visible objects.
+
+The visible objects covering the largest part of the view are rasterized into a low resolution
+depth buffer on the CPU, and the boxes left by frustum culling are tested against its hierarchy.
+The pass does not wait for the GPU, so it runs while the previous frame is being rendered.
+\param frame Matrices of the frame.
+\param w, h Size of the image.
+\return The number of items culled.
+*/
+int MeshWidget::CullOccluded(const FrameUniforms& frame, int w, int h)
+{
+    occlusion.Resize(OcclusionWidth, std::max(1, OcclusionWidth * h / w));
+
+    // Projection times view matrix, column major
+    const GLfloat* p = frame.ProjectionMatrix;
+    const GLfloat* v = frame.ModelViewMatrix;
+    float mvp[16];
+    for (int c = 0; c < 4; c++)
+    {
+        for (int r = 0; r < 4; r++)
+            mvp[c * 4 + r] = p[r] * v[c * 4] + p[4 + r] * v[c * 4 + 1] + p[8 + r] * v[c * 4 + 2] + p[12 + r] * v[c * 4 + 3];
+    }
+    occlusion.Clear(mvp);
+
+    // Occluders are ranked by the squared ratio of the radius of their box to its distance
+    const Vector eye = view.camera.Eye();
+    std::vector<std::pair<double, int>> candidates;
+    for (size_t k = 0; k < drawList.size(); k++)
+    {
+        if (!drawVisible[k] || drawList[k].mesh->occluder.empty())
+            continue;
+        const Vector center(drawBoxes.cx[k], drawBoxes.cy[k], drawBoxes.cz[k]);
+        const Vector half(drawBoxes.ex[k], drawBoxes.ey[k], drawBoxes.ez[k]);
+        candidates.push_back({ SquaredNorm(half) / std::max(SquaredNorm(center - eye), 1e-6), int(k) });
+    }
+    const int n = std::min(int(candidates.size()), MaxOccluders);
+    std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(), std::greater<std::pair<double, int>>());
+    for (int i = 0; i < n; i++)
+    {
+        const MeshGL* mesh = drawList[candidates[i].second].mesh;
+        occlusion.Add(mesh->occluder.data(), int(mesh->occluder.size() / 9), mesh->TRSMatrix);
+    }
+    occlusion.Build();
+    return occlusion.Cull(drawBoxes, drawVisible);
+}
+
+/*!
+\brief Select the level of detail of the visible meshes.
+
+The geometric error of every level is projected at the distance between the eye and the box of the
+mesh, as for the terrain chunks. Instanced and streamed meshes are always drawn at full resolution.
+\param w, h Size of the image.
+*/
+void MeshWidget::SelectLevelsOfDetail(int w, int h)
+{
+    // Pixels per unit of length, at unit distance for perspective views
+    const double k = view.perspective ? double(h) / (2.0 * tan(view.camera.GetAngleOfViewV(w, h) / 2.0)) : double(h) / (2.0 * view.orthoSize);
+    const Vector eye = view.camera.Eye();
+    for (size_t i = 0; i < drawList.size(); i++)
+    {
+        MeshGL* mesh = drawList[i].mesh;
+        if (!drawVisible[i] || mesh->lod.Levels() < 2 || mesh->instanceCount > 0 || mesh->regions > 0)
+            continue;
+        double scale = k;
+        if (view.perspective)
+        {
+            const Vector center(drawBoxes.cx[i], drawBoxes.cy[i], drawBoxes.cz[i]);
+            const Vector half(drawBoxes.ex[i], drawBoxes.ey[i], drawBoxes.ez[i]);
+            const Vector p = Vector::Min(Vector::Max(eye, center - half), center + half);
+            scale = k / Math::Max(Norm(p - eye), view.camera.GetNear());
+        }
+        mesh->lodLevel = mesh->lod.Select(scale, mesh->lodLevel, renderSettings.meshPixelError);
+    }
+}
+
+/*!
+\brief Add a new mesh in the scene.
+
+A mesh with the same name is replaced. The mesh is copied, and uploaded by the render thread.
+\param mesh new mesh
+\param frame mesh frame, identity by default.
+\return Handle to the mesh, for updates that do not look the name up.
+*/
+MeshWidget::MeshHandle MeshWidget::AddMesh(const QString& name, const Mesh& mesh, const Vector& frame)
+{
+    return AddMesh(name, Mesh(mesh), frame);
+}
+
+/*!
+\brief Add a new mesh in the scene, handing it over to the render thread without copying it.
+\param mesh new mesh
+\param frame mesh frame, identity by default.
+\return Handle to the mesh.
+*/
+MeshWidget::MeshHandle MeshWidget::AddMesh(const QString& name, Mesh&& mesh, const Vector& frame)
+{
+    const MeshHandle h = Reserve(name);
+    Post([this, h, mesh = std::move(mesh), frame] { Insert(h, MeshGL(&bufferPool, mesh, frame)); });
+    return h;
+}
+
+/*!
+\brief Add a new colored mesh in the scene.
+\param mesh new colored mesh
+\param frame mesh frame, identity by default.
+\return Handle to the mesh.
+*/
+MeshWidget::MeshHandle MeshWidget::AddMesh(const QString& name, const MeshColor& mesh, const Vector& frame)
+{
+    return AddMesh(name, MeshColor(mesh), frame);
+}
+
+/*!
+\brief Overloaded, the mesh is moved to the render thread.
+\param mesh new colored mesh
+\param frame mesh frame, identity by default.
+\return Handle to the mesh.
+*/
+MeshWidget::MeshHandle MeshWidget::AddMesh(const QString& name, MeshColor&& mesh, const Vector& frame)
+{
+    const MeshHandle h = Reserve(name);
+    Post([this, h, mesh = std::move(mesh), frame] { Insert(h, MeshGL(&bufferPool, mesh, frame)); });
+    return h;
+}
+
+/*!
+\brief Add a mesh drawn several times with a single draw call.
+
+The geometry is uploaded once, and every instance is placed by its own frame. Nothing is added
+if there are no frames.
+\param name mesh name
+\param mesh shared geometry
+\param frames frames of the instances
+\return Handle to the mesh, null if nothing was added.
+*/
+MeshWidget::MeshHandle MeshWidget::AddInstances(const QString& name, const Mesh& mesh, const std::vector<InstanceFrame>& frames)
+{
+    if (frames.empty())
+        return MeshHandle();
+    return AddInstances(name, Mesh(mesh), frames);
+}
+
+/*!
+\brief Overloaded, the mesh is moved to the render thread.
+\param name mesh name
+\param mesh shared geometry
+\param frames frames of the instances
+\return Handle to the mesh, null if nothing was added.
+*/
+MeshWidget::MeshHandle MeshWidget::AddInstances(const QString& name, Mesh&& mesh, const std::vector<InstanceFrame>& frames)
+{
+    if (frames.empty())
+        return MeshHandle();
+    const MeshHandle h = Reserve(name);
+    Post([this, h, mesh = std::move(mesh), frames]
+        {
+            MeshGL gl(&bufferPool, mesh);
+            gl.SetInstances(frames, instanceAttribute);
+            Insert(h, std::move(gl));
+        });
+    return h;
+}
+
+/*!
+\brief Add a colored mesh drawn several times with a single draw call.
+\param name mesh name
+\param mesh shared geometry
+\param frames frames of the instances
+\return Handle to the mesh, null if nothing was added.
+*/
+MeshWidget::MeshHandle MeshWidget::AddInstances(const QString& name, const MeshColor& mesh, const std::vector<InstanceFrame>& frames)
+{
+    if (frames.empty())
+        return MeshHandle();
+    return AddInstances(name, MeshColor(mesh), frames);
+}
+
+/*!
+\brief Overloaded, the mesh is moved to the render thread.
+\param name mesh name
+\param mesh shared geometry
+\param frames frames of the instances
+\return Handle to the mesh, null if nothing was added.
+*/
+MeshWidget::MeshHandle MeshWidget::AddInstances(const QString& name, MeshColor&& mesh, const std::vector<InstanceFrame>& frames)
+{
+    if (frames.empty())
+        return MeshHandle();
+    const MeshHandle h = Reserve(name);
+    Post([this, h, mesh = std::move(mesh), frames]
+        {
+            MeshGL gl(&bufferPool, mesh);
+            gl.SetInstances(frames, instanceAttribute);
+            Insert(h, std::move(gl));
+        });
+    return h;
+}
+
+/*!
+\brief Allocate the handle of a new mesh, replacing the mesh with the same name.
+
+Handles are allocated by the GUI thread in the same order as the objects are inserted by the
+render thread, so that both slot maps hand out the same handles.
+\param name mesh name
+*/
+MeshWidget::MeshHandle MeshWidget::Reserve(const QString& name)
+{
+    DeleteMesh(name);
+    MeshHandle h = handles.Insert(name);
+    names.insert(name, h);
+    return h;
+}
+
+/*!
+\brief Store an uploaded mesh, executed by the render thread.
+\param expected handle returned by Reserve()
+\param gl uploaded mesh
+*/
+void MeshWidget::Insert(MeshHandle expected, MeshGL&& gl)
+{
+    [[maybe_unused]] MeshHandle h = objects.Insert(std::move(gl));
+    assert(h == expected);
+    batchDirty = true;
+    drawListDirty = true;
+    frameRequested = true;
+}
+
+/*!
+\brief Return the handle of a mesh given its name, a null handle if there is no such mesh.
+\param name mesh name
+*/
+MeshWidget::MeshHandle MeshWidget::FindMesh(const QString& name) const
+{
+    return names.value(name);
+}
+
+/*!
+\brief Delete a mesh in the scene from its name.
+\param name mesh name
+*/
+void MeshWidget::DeleteMesh(const QString& name)
+{
+    DeleteMesh(FindMesh(name));
+}
+
+/*!
+\brief Delete a mesh in the scene.
+
+The last mesh of the scene is moved in its place, handles to other meshes remain valid.
+\param h mesh handle
+*/
+void MeshWidget::DeleteMesh(MeshHandle h)
+{
+    const QString* name = handles.Get(h);
+    if (name == nullptr)
+        return;
+    names.remove(*name);
+    handles.Remove(h);
+    Post([this, h]
+        {
+            MeshGL* gl = objects.Get(h);
+            gl->Delete();
+            objects.Remove(h);
+            batchDirty = true;
+            drawListDirty = true;
+            frameRequested = true;
+        });
+}
+
+/*!
+\brief Updates the transform of a mesh given its name.
+\param name mesh name
+\param frame new frame
+*/
+void MeshWidget::UpdateMesh(const QString& name, const Vector& frame)
+{
+    UpdateMesh(FindMesh(name), frame);
+}
+
+/*!
+\brief Updates the transform of a mesh.
+\param h mesh handle
+\param frame new frame
+*/
+void MeshWidget::UpdateMesh(MeshHandle h, const Vector& frame)
+{
+    Post([this, h, frame]
+        {
+            if (MeshGL* gl = objects.Get(h))
+            {
+                gl->SetFrame(frame);
+                drawListDirty = true;
+                frameRequested = true;
+            }
+        });
+}
+
+/*!
+\brief Replaces the geometry of a mesh given its name, for instance when it is generated again.
+
+The geometry is uploaded as a new static mesh, with its levels of detail and occluder, keeping
+the handle, the frame and the display settings. Meshes that do not exist yet are added. The
+geometry is drawn once: instances of the previous geometry are removed, see UpdateInstancedGeometry().
+Meshes whose vertices move should use DeformMeshGeometry() instead.
+\param name mesh name
+\param mesh new geometry
+*/
+void MeshWidget::UpdateMeshGeometry(const QString& name, const MeshColor& mesh)
+{
+    UpdateMeshGeometry(name, MeshColor(mesh));
+}
+
+/*!
+\brief Overloaded, the geometry is moved to the render thread.
+\param name mesh name
+\param mesh new geometry
+*/
+void MeshWidget::UpdateMeshGeometry(const QString& name, MeshColor&& mesh)
+{
+    const MeshHandle h = FindMesh(name);
+    if (h.IsNull())
+    {
+        AddMesh(name, std::move(mesh));
+        return;
+    }
+
+    Post([this, h, mesh = std::move(mesh)]
+        {
+            Replace(*objects.Get(h), mesh);
+            batchDirty = true;
+            drawListDirty = true;
+            frameRequested = true;
+        });
+}
+
+/*!
+\brief Replaces the geometry of a mesh drawn as a set of instances, given its name.
+
+As UpdateMeshGeometry(), the instances being replaced by the given ones. Meshes that do not exist
+yet are added.
+\param name mesh name
+\param mesh new geometry
+\param frames frames of the instances
+*/
+void MeshWidget::UpdateInstancedGeometry(const QString& name, const MeshColor& mesh, const std::vector<InstanceFrame>& frames)
+{
+    UpdateInstancedGeometry(name, MeshColor(mesh), frames);
+}
+
+/*!
+\brief Overloaded, the geometry is moved to the render thread.
+\param name mesh name
+\param mesh new geometry
+\param frames frames of the instances
+*/
+void MeshWidget::UpdateInstancedGeometry(const QString& name, MeshColor&& mesh, const std::vector<InstanceFrame>& frames)
+{
+    const MeshHandle h = FindMesh(name);
+    if (h.IsNull())
+    {
+        AddInstances(name, std::move(mesh), frames);
+        return;
+    }
+
+    Post([this, h, mesh = std::move(mesh), frames]
+        {
+            MeshGL* gl = objects.Get(h);
+            Replace(*gl, mesh);
+            gl->SetInstances(frames, instanceAttribute);
+            batchDirty = true;
+            drawListDirty = true;
+            frameRequested = true;
+        });
+}
+
+/*!
+\brief Updates the vertices of a deformed mesh given its name, keeping its GPU buffers.
+
+The mesh must have the same triangles as the uploaded one, only their vertices, normals and colors
+change. The first deformation replaces the static buffer by streamed storage, after which only
+the vertex data of the modified triangles is uploaded. Streamed meshes are neither simplified,
+batched nor used as occluders, until their geometry is replaced by UpdateMeshGeometry().
+Instances are kept. Meshes whose number of triangles has changed are uploaded again, and meshes
+that do not exist yet are added.
+\param name mesh name
+\param mesh deformed geometry
+\param ranges modified triangles, all of them if empty
+*/
+void MeshWidget::DeformMeshGeometry(const QString& name, const MeshColor& mesh, const std::vector<TriangleRange>& ranges)
+{
+    DeformMeshGeometry(name, MeshColor(mesh), ranges);
+}
+
+/*!
+\brief Overloaded, the geometry is moved to the render thread.
+\param name mesh name
+\param mesh deformed geometry
+\param ranges modified triangles, all of them if empty
+*/
+void MeshWidget::DeformMeshGeometry(const QString& name, MeshColor&& mesh, const std::vector<TriangleRange>& ranges)
+{
+    const MeshHandle h = FindMesh(name);
+    if (h.IsNull())
+    {
+        AddMesh(name, std::move(mesh));
+        return;
+    }
+
+    Post([this, h, mesh = std::move(mesh), ranges]
+        {
+            MeshGL* gl = objects.Get(h);
+            if (!gl->Update(mesh, ranges))
+            {
+                const std::vector<InstanceFrame> frames = gl->instances;
+                Replace(*gl, mesh);
+                if (!frames.empty())
+                    gl->SetInstances(frames, instanceAttribute);
+            }
+            batchDirty = true;
+            drawListDirty = true;
+            frameRequested = true;
+        });
+}
+
+/*!
+\brief Upload a new geometry in place of a mesh, so that its handle remains valid. Executed by the render thread.
+
+The display settings and the frame are kept, the new geometry is drawn once.
+\param gl The mesh.
+\param mesh New geometry.
+*/
+void MeshWidget::Replace(MeshGL& gl, const MeshColor& mesh)
+{
+    MeshGL fresh(&bufferPool, mesh);
+    fresh.enabled = gl.enabled;
+    fresh.material = gl.material;
+    fresh.shading = gl.shading;
+    fresh.useWireframe = gl.useWireframe;
+    std::copy(gl.TRSMatrix, gl.TRSMatrix + 16, fresh.TRSMatrix);
+    gl.Delete();
+    gl = std::move(fresh);
+}
+
+/*!
+\brief Enable a mesh given its name.
+\param name mesh name
+*/
+void MeshWidget::EnableMesh(const QString& name)
+{
+    EnableMesh(FindMesh(name));
+}
+
+/*!
+\brief Overloaded.
+\param h mesh handle
+*/
+void MeshWidget::EnableMesh(MeshHandle h)
+{
+    Post([this, h]
+        {
+            if (MeshGL* gl = objects.Get(h))
+                gl->enabled = true;
+            drawListDirty = true;
+            frameRequested = true;
+        });
+}
+
+/*!
+\brief Disable a mesh given its name. The mesh will not be rendered until it's enabled again.
+\param name mesh name
+*/
+void MeshWidget::DisableMesh(const QString& name)
+{
+    DisableMesh(FindMesh(name));
+}
+
+/*!
+\brief Overloaded.
+\param h mesh handle
+*/
+void MeshWidget::DisableMesh(MeshHandle h)
+{
+    Post([this, h]
+        {
+            if (MeshGL* gl = objects.Get(h))
+                gl->enabled = false;
+            drawListDirty = true;
+            frameRequested = true;
+        });
+}
+
+/*!
+\brief Destroys all mesh objects in the scene.
+*/
+void MeshWidget::ClearAll()
+{
+    handles.Clear();
+    names.clear();
+    Post([this]
+        {
+            for (MeshGL& gl : objects)
+                gl.Delete();
+            objects.Clear();
+            batchDirty = true;
+            drawListDirty = true;
+            frameRequested = true;
+        });
+    ClearTerrain();
+}
+
+/*!
+\brief Set the chunked terrain rendered in the scene.
+
+Only the chunks selected from the current camera are uploaded, so that the number of
+triangles stays roughly constant whatever the size of the height field.
+\param lod Terrain, which must outlive its use in the widget.
+\param tau Maximum screen space error, in pixels.
+*/
+void MeshWidget::SetTerrain(const HeightFieldLOD* lod, double tau)
+{
+    ClearTerrain();
+    Post([this, lod, tau]
+        {
+            terrain = lod;
+            terrainPixelError = tau;
+            frameRequested = true;
+        });
+}
+
+/*!
+\brief Remove the terrain and release its chunks.
+
+Waits for the render thread, so that the terrain may be deleted once the function returns.
 */
-void MeshWidget::resizeGL(int w, int h)
+void MeshWidget::ClearTerrain()
 {
-    glViewport(0, 0, (GLint)w, (GLint)h);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-
-    if (perspectiveProjection)
-        gluPerspective(Math::RadianToDegree(camera.GetAngleOfViewV(w, h)), (GLdouble)w / (GLdouble)h, camera.GetNear(), camera.GetFar());
-    else
-        glOrtho(-cameraOrthoSize, cameraOrthoSize, -cameraOrthoSize, cameraOrthoSize, camera.GetNear(), camera.GetFar());
+    Invoke([this]
+        {
+            for (QMap<int, MeshGL*>::iterator i = terrainChunks.begin(); i != terrainChunks.end(); i++)
+            {
+                i.value()->Delete();
+                delete i.value();
+            }
+            terrainChunks.clear();
+            terrain = nullptr;
+            drawListDirty = true;
+            frameRequested = true;
+        });
 }
 
 /*!
-\brief Renders the scene.
+\brief Update the uploaded terrain chunks from the current camera.
+
+Newly selected chunks are uploaded and those which are not selected anymore are released.
+\param w, h Size of the image.
 */
-void MeshWidget::paintGL()
+void MeshWidget::UpdateTerrain(int w, int h)
 {
-    // Custom update from user
-    emit _signalUpdate();
+    if (terrain == nullptr)
+        return;
 
-    // Clear
-    glClearColor(1.0f, 1.0f, 1.0f, 1.f);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Tiles of out-of-core terrains are loaded ahead of the chunks that need them
+    terrain->GetField().Prefetch(view.camera, w, h);
 
-    // Move camera
-    if (MoveAt)
+    std::vector<int> selected = terrain->Select(view.camera, w, h, terrainPixelError);
+
+    QMap<int, MeshGL*> chunks;
+    for (int c : selected)
     {
-        if (stepAt < 15)
+        if (terrainChunks.contains(c))
         {
-            stepAt++;
-            double alpha = double(stepAt) / 15.;
-            camera.SetAt(currentAt * (1. - alpha) + toAt * (alpha));
+            chunks.insert(c, terrainChunks[c]);
+            terrainChunks.remove(c);
         }
         else
-            MoveAt = false;
-    }
-    gluLookAt(camera.Eye()[0], camera.Eye()[1], camera.Eye()[2], camera.At()[0], camera.At()[1], camera.At()[2], camera.Up()[0], camera.Up()[1], camera.Up()[2]);
-
-    // Sky
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
-    glUseProgram(skyboxShader);
-    glBindVertexArray(skyboxVAO);
-    glUniform3f(glGetUniformLocation(skyboxShader, "CamPos"), camera.Eye()[0], camera.Eye()[1], camera.Eye()[2]);
-    glUniform3f(glGetUniformLocation(skyboxShader, "CamAt"), camera.At()[0], camera.At()[1], camera.At()[2]);
-    glUniform3f(glGetUniformLocation(skyboxShader, "CamUp"), camera.Up()[0], camera.Up()[1], camera.Up()[2]);
-    glUniform2f(glGetUniformLocation(skyboxShader, "iResolution"), width(), height());
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    // Draw meshes
-    profiler.BeginGPU();
-    GLfloat ModelViewMatrix[16];
-    GLfloat ProjectionMatrix[16];
-    glGetFloatv(GL_MODELVIEW_MATRIX, ModelViewMatrix);
-    glGetFloatv(GL_PROJECTION_MATRIX, ProjectionMatrix);
-    glUseProgram(mainShaderProgram);
-
-    // Shared uniforms
-    glUniformMatrix4fv(glGetUniformLocation(mainShaderProgram, "ModelViewMatrix"), 1, 0, ModelViewMatrix);
-    glUniformMatrix4fv(glGetUniformLocation(mainShaderProgram, "ProjectionMatrix"), 1, 0, ProjectionMatrix);
-    Vector view = Normalized(camera.View());
-    glUniform3f(glGetUniformLocation(mainShaderProgram, "viewDir"), view[0], view[1], view[2]);
-
-    for (MeshIterator i = objects.begin(); i != objects.end(); i++)
-    {
-        if (!i.value()->enabled)
-            continue;
-
-        // Uniforms
-        glUniform2f(glGetUniformLocation(mainShaderProgram, "WIN_SCALE"), width() / 2.0f, height() / 2.0f);
-        glUniformMatrix4fv(glGetUniformLocation(mainShaderProgram, "TRSMatrix"), 1, GL_FALSE, &i.value()->TRSMatrix[0]);
-        glUniform1i(glGetUniformLocation(mainShaderProgram, "useWireframe"), i.value()->useWireframe ? 1 : 0);
-        glUniform1i(glGetUniformLocation(mainShaderProgram, "material"), (int)i.value()->material);
-        glUniform1i(glGetUniformLocation(mainShaderProgram, "shading"), (int)i.value()->shading);
-
-        // Draw
-        glBindVertexArray(i.value()->vao);
-        glDrawElements(GL_TRIANGLES, (GLsizei)i.value()->triangleCount, GL_UNSIGNED_INT, nullptr);
+        {
+            chunks.insert(c, new MeshGL(&bufferPool, terrain->GetMesh(c)));
+            drawListDirty = true;
+        }
     }
-    profiler.EndGPU();
-
-    // CPU Profiling
-    if (profiler.enabled)
+    if (!terrainChunks.isEmpty())
+        drawListDirty = true;
+    for (QMap<int, MeshGL*>::iterator i = terrainChunks.begin(); i != terrainChunks.end(); i++)
     {
-        profiler.Update();
-        RenderStats();
+        i.value()->Delete();
+        delete i.value();
     }
-
-    // Schedule next draw
-    update();
+    terrainChunks = chunks;
 }
 
 /*!
-\brief Add a new mesh in the scene.
-\param mesh new mesh
-\param frame mesh frame, identity by default.
-*/
-void MeshWidget::AddMesh(const QString& name, const Mesh& mesh, const Vector& frame)
-{
-    makeCurrent();
-    objects.insert(name, new MeshGL(mesh, frame));
-}
+\brief Rebuild the list of draw calls from the enabled objects and the terrain chunks.
 
-/*!
-\brief Add a new colored mesh in the scene.
-\param mesh new colored mesh
-\param frame mesh frame, identity by default.
+Draw calls are sorted by program and render state, so that RenderFrame() only changes
+the state between groups of objects.
 */
-void MeshWidget::AddMesh(const QString& name, const MeshColor& mesh, const Vector& frame)
+void MeshWidget::BuildDrawList()
 {
-    makeCurrent();
-    objects.insert(name, new MeshGL(mesh, frame));
+    drawList.clear();
+    drawList.reserve(objects.Size() + terrainChunks.size());
+    for (MeshGL& gl : objects)
+    {
+        if (gl.enabled)
+            drawList.push_back({ mainShaderProgram, int(gl.material), int(gl.shading), gl.useWireframe ? 1 : 0, &gl });
+    }
+    for (QMap<int, MeshGL*>::iterator i = terrainChunks.begin(); i != terrainChunks.end(); i++)
+        drawList.push_back({ mainShaderProgram, int(i.value()->material), int(i.value()->shading), i.value()->useWireframe ? 1 : 0, i.value() });
+    std::stable_sort(drawList.begin(), drawList.end());
+
+    if (renderSettings.batching)
+        BuildBatch();
+
+    // World space boxes, in the order of the draw list
+    drawBoxes.Clear();
+    drawBoxes.Reserve(int(drawList.size()));
+    for (const DrawItem& item : drawList)
+        drawBoxes.Append(item.mesh->WorldBox());
+    drawListDirty = false;
 }
 
 /*!
-\brief Delete a mesh in the scene from its name.
-\param name mesh name
+\brief Pack the static meshes into shared buffers and update their transforms.
+
+Meshes that are streamed or instanced keep their own buffers. The arenas are only packed again
+when meshes are added or removed, by copying the vertex data of the meshes on the GPU. Arenas
+are kept between packings and only reallocated when they grow.
 */
-void MeshWidget::DeleteMesh(const QString& name)
+void MeshWidget::BuildBatch()
 {
-    makeCurrent();
-    if (objects.contains(name))
+    if (batchDirty)
     {
-        objects[name]->Delete();
-        objects.remove(name);
+        for (MeshGL& gl : objects)
+            gl.batchSlot = -1;
+        batch.commands.clear();
+
+        std::vector<MeshGL*> meshes;
+        for (MeshGL& gl : objects)
+        {
+            if (gl.regions == 0 && gl.instanceCount == 0)
+                meshes.push_back(&gl);
+        }
+        size_t total = 0;
+        size_t indexes = 0;
+        for (MeshGL* mesh : meshes)
+        {
+            total += mesh->triangleCount;
+            indexes += mesh->lod.Size();
+        }
+
+        if (!meshes.empty())
+        {
+            if (batch.vao == 0)
+            {
+                glGenVertexArrays(1, &batch.vao);
+                glGenBuffers(1, &batch.vertexBuffer);
+                glGenBuffers(1, &batch.indexBuffer);
+                glGenBuffers(1, &batch.transformBuffer);
+                glGenBuffers(1, &batch.commandBuffer);
+            }
+
+            // Arenas grow by at least a half to absorb small additions
+            glBindVertexArray(batch.vao);
+            glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBuffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.indexBuffer);
+            if (total > batch.capacity)
+            {
+                batch.capacity = std::max(total, batch.capacity + batch.capacity / 2);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 9 * batch.capacity, nullptr, GL_STATIC_DRAW);
+            }
+            if (indexes > batch.indexCapacity)
+            {
+                batch.indexCapacity = std::max(indexes, batch.indexCapacity + batch.indexCapacity / 2);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * batch.indexCapacity, nullptr, GL_STATIC_DRAW);
+            }
+
+            // Every part of the arena spans the whole capacity
+            total = batch.capacity;
+
+            glBindBuffer(GL_COPY_WRITE_BUFFER, batch.vertexBuffer);
+            size_t first = 0;
+            size_t firstIndex = 0;
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                MeshGL* mesh = meshes[i];
+                const size_t n = mesh->triangleCount;
+
+                // Vertices, normals and colors of the mesh go to the three parts of the arena
+                glBindBuffer(GL_COPY_READ_BUFFER, mesh->vertexRange.buffer);
+                for (int a = 0; a < mesh->attributes; a++)
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, mesh->vertexRange.offset + sizeof(float) * 3 * n * a, sizeof(float) * 3 * (total * a + first), sizeof(float) * 3 * n);
+                if (mesh->attributes < 3)
+                {
+                    std::vector<float> black(3 * n, 0.0f);
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(float) * 3 * (total * 2 + first), sizeof(float) * 3 * n, black.data());
+                }
+                // Whole index chain, the level is selected when the commands are gathered
+                glBindBuffer(GL_COPY_READ_BUFFER, mesh->indexRange.buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, mesh->indexRange.offset, sizeof(GLuint) * firstIndex, sizeof(GLuint) * mesh->lod.Size());
+
+                mesh->batchSlot = int(i);
+                batch.commands.push_back({ GLuint(n), 1, GLuint(firstIndex), GLint(first), GLuint(i) });
+                first += n;
+                firstIndex += mesh->lod.Size();
+            }
+
+            for (int a = 0; a < 3; a++)
+            {
+                glVertexAttribPointer(a, 3, GL_FLOAT, GL_FALSE, 0, (const void*)(sizeof(float) * 3 * total * a));
+                glEnableVertexAttribArray(a);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, batch.transformBuffer);
+            if (meshes.size() > batch.transformCapacity)
+            {
+                batch.transformCapacity = std::max(meshes.size(), batch.transformCapacity + batch.transformCapacity / 2);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 16 * batch.transformCapacity, nullptr, GL_DYNAMIC_DRAW);
+            }
+            for (int c = 0; c < 4 && instanceAttribute >= 0; c++)
+            {
+                glVertexAttribPointer(instanceAttribute + c, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 16, (const void*)(sizeof(float) * 4 * c));
+                glVertexAttribDivisor(instanceAttribute + c, 1);
+                glEnableVertexAttribArray(instanceAttribute + c);
+            }
+            glBindVertexArray(0);
+        }
+        batchDirty = false;
     }
-}
 
-/*!
-\brief Updates the transform of a mesh given its name.
-\param name mesh name
-\param frame new frame
-*/
-void MeshWidget::UpdateMesh(const QString& name, const Vector& frame)
-{
-    makeCurrent();
-    if (objects.contains(name))
-        objects[name]->SetFrame(frame);
+    // Transforms may change without the set of meshes changing
+    if (batch.commands.empty())
+        return;
+    std::vector<float> transforms(16 * batch.commands.size());
+    for (const MeshGL& gl : objects)
+    {
+        if (gl.batchSlot >= 0)
+            std::copy(gl.TRSMatrix, gl.TRSMatrix + 16, transforms.begin() + 16 * gl.batchSlot);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, batch.transformBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * transforms.size(), transforms.data());
 }
 
 /*!
-\brief Enable a mesh given its name.
-\param name mesh name
+\brief Release the shared buffers, meshes are drawn with their own buffers again.
 */
-void MeshWidget::EnableMesh(const QString& name)
+void MeshWidget::DeleteBatch()
 {
-    if (objects.contains(name))
-        objects[name]->enabled = true;
+    for (MeshGL& gl : objects)
+        gl.batchSlot = -1;
+    glDeleteVertexArrays(1, &batch.vao);
+    glDeleteBuffers(1, &batch.vertexBuffer);
+    glDeleteBuffers(1, &batch.indexBuffer);
+    glDeleteBuffers(1, &batch.transformBuffer);
+    glDeleteBuffers(1, &batch.commandBuffer);
+    batch = MeshBatch();
+    batchDirty = true;
 }
 
 /*!
-\brief Disable a mesh given its name. The mesh will not be rendered until it's enabled again.
-\param name mesh name
-*/
-void MeshWidget::DisableMesh(const QString& name)
-{
-    if (objects.contains(name))
-        objects[name]->enabled = false;
-}
+\brief Gather the commands of the visible batched items and upload them.
 
-/*!
-\brief Destroys all mesh objects in the scene.
+Batched items of a group sharing the same render state are drawn with a single call, issued
+at the first visible one of the group.
 */
-void MeshWidget::ClearAll()
+void MeshWidget::PrepareBatchDraws()
 {
-    makeCurrent();
-    for (MeshIterator i = objects.begin(); i != objects.end(); i++)
+    frameCommands.clear();
+    batchDraws.assign(drawList.size(), std::pair<int, int>(0, 0));
+    if (batch.commands.empty())
+        return;
+
+    int head = -1;
+    for (size_t k = 0; k < drawList.size(); k++)
     {
-        i.value()->Delete();
-        delete i.value();
+        const DrawItem& item = drawList[k];
+        if (k > 0 && (drawList[k - 1] < item || item < drawList[k - 1]))
+            head = -1;
+        if (!drawVisible[k] || item.mesh->batchSlot < 0)
+            continue;
+        if (head < 0)
+        {
+            head = int(k);
+            batchDraws[k].first = int(frameCommands.size());
+        }
+        DrawCommand command = batch.commands[item.mesh->batchSlot];
+        const MeshLOD::Level& level = item.mesh->lod[item.mesh->lodLevel];
+        command.firstIndex += level.first;
+        command.count = level.count;
+        frameCommands.push_back(command);
+        batchDraws[head].second++;
     }
-    objects.clear();
+
+    // Buffer is orphaned every frame so that the commands of the previous frame may still be read
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * frameCommands.size(), frameCommands.data(), GL_STREAM_DRAW);
 }
 
 /*!
@@ -513,17 +2053,8 @@ Ray MeshWidget::ComputeRay(const QPoint& pix) const
 */
 void MeshWidget::SetCamera(const Camera& c)
 {
-    makeCurrent();
-
     camera = c;
-
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-
-    if (perspectiveProjection)
-        gluPerspective(Math::RadianToDegree(camera.GetAngleOfViewV(width(), height())), (GLdouble)width() / (GLdouble)height(), camera.GetNear(), camera.GetFar());
-    else
-        glOrtho(-cameraOrthoSize, cameraOrthoSize, -cameraOrthoSize, cameraOrthoSize, camera.GetNear(), camera.GetFar());
+    RequestFrame();
 }
 
 /*!
@@ -532,16 +2063,8 @@ void MeshWidget::SetCamera(const Camera& c)
 */
 void MeshWidget::SetNearAndFarPlane(double n, double f)
 {
-    makeCurrent();
-
     camera.SetPlanes(n, f);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-
-    if (perspectiveProjection)
-        gluPerspective(Math::RadianToDegree(camera.GetAngleOfViewV(width(), height())), (GLdouble)width() / (GLdouble)height(), camera.GetNear(), camera.GetFar());
-    else
-        glOrtho(-cameraOrthoSize, cameraOrthoSize, -cameraOrthoSize, cameraOrthoSize, camera.GetNear(), camera.GetFar());
+    RequestFrame();
 }
 
 /*!
@@ -550,15 +2073,62 @@ void MeshWidget::SetNearAndFarPlane(double n, double f)
 */
 void MeshWidget::SetCameraMode(bool perspective)
 {
-    makeCurrent();
     perspectiveProjection = perspective;
+    RequestFrame();
+}
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    if (perspectiveProjection)
-        gluPerspective(Math::RadianToDegree(camera.GetAngleOfViewV(width(), height())), (GLdouble)width() / (GLdouble)height(), camera.GetNear(), camera.GetFar());
-    else
-        glOrtho(-cameraOrthoSize, cameraOrthoSize, -cameraOrthoSize, cameraOrthoSize, camera.GetNear(), camera.GetFar());
+/*!
+\brief Set the redraw mode of the widget.
+
+By default the scene is only redrawn when the camera or the scene changes. In continuous mode,
+frames are rendered back to back, which is only useful for benchmarking.
+\param continuous Continuous mode.
+*/
+void MeshWidget::SetContinuousRendering(bool continuous)
+{
+    settings.continuous = continuous;
+    UpdateSettings();
+}
+
+/*!
+\brief Set the batched mode.
+
+In batched mode, static meshes are packed into shared buffers and all the visible meshes sharing
+the same render state are drawn with a single glMultiDrawElementsIndirect() call. Without multi
+draw indirect, the packed meshes are drawn one by one from the shared buffers. The mode cannot
+be enabled without base instance support, which selects the transform of every draw.
+\param b Batched mode.
+*/
+void MeshWidget::SetBatching(bool b)
+{
+    settings.batching = b && GLEW_ARB_base_instance;
+    UpdateSettings();
+}
+
+/*!
+\brief Set the occlusion culling mode.
+
+When enabled, objects hidden behind the largest visible objects are not drawn. Only meshes with
+at most MeshGL::MaxOccluderTriangles triangles, neither streamed nor instanced, hide other objects.
+\param b Occlusion culling.
+*/
+void MeshWidget::SetOcclusionCulling(bool b)
+{
+    settings.occlusionCulling = b;
+    UpdateSettings();
+}
+
+/*!
+\brief Set the screen space error threshold of the levels of detail of the meshes.
+
+Meshes with at least MeshGL::MinLodTriangles triangles are drawn with the coarsest level whose
+geometric error projects to at most this number of pixels.
+\param e Threshold, in pixels, 0 draws all the meshes at full resolution.
+*/
+void MeshWidget::SetMeshPixelError(double e)
+{
+    settings.meshPixelError = e;
+    UpdateSettings();
 }
 
 /*!
@@ -568,8 +2138,23 @@ void MeshWidget::SetCameraMode(bool perspective)
 */
 void MeshWidget::SetMaterial(const QString& name, MeshMaterial mat)
 {
-    if (objects.contains(name))
-        objects[name]->material = mat;
+    SetMaterial(FindMesh(name), mat);
+}
+
+/*!
+\brief Overloaded.
+\param h mesh handle
+\param mat the new material
+*/
+void MeshWidget::SetMaterial(MeshHandle h, MeshMaterial mat)
+{
+    Post([this, h, mat]
+        {
+            if (MeshGL* gl = objects.Get(h))
+                gl->material = mat;
+            drawListDirty = true;
+            frameRequested = true;
+        });
 }
 
 /*!
@@ -578,8 +2163,13 @@ void MeshWidget::SetMaterial(const QString& name, MeshMaterial mat)
 */
 void MeshWidget::SetMaterialGlobal(MeshMaterial mat)
 {
-    for (MeshIterator i = objects.begin(); i != objects.end(); i++)
-        i.value()->material = mat;
+    Post([this, mat]
+        {
+            for (MeshGL& gl : objects)
+                gl.material = mat;
+            drawListDirty = true;
+            frameRequested = true;
+        });
 }
 
 /*!
@@ -589,8 +2179,23 @@ void MeshWidget::SetMaterialGlobal(MeshMaterial mat)
 */
 void MeshWidget::UseWireframe(const QString& name, bool wireframe)
 {
-    if (objects.contains(name))
-        objects[name]->useWireframe = wireframe;
+    UseWireframe(FindMesh(name), wireframe);
+}
+
+/*!
+\brief Overloaded.
+\param h mesh handle
+\param wireframe new wireframe flag value
+*/
+void MeshWidget::UseWireframe(MeshHandle h, bool wireframe)
+{
+    Post([this, h, wireframe]
+        {
+            if (MeshGL* gl = objects.Get(h))
+                gl->useWireframe = wireframe;
+            drawListDirty = true;
+            frameRequested = true;
+        });
 }
 
 /*!
@@ -599,8 +2204,13 @@ void MeshWidget::UseWireframe(const QString& name, bool wireframe)
 */
 void MeshWidget::UseWireframeGlobal(bool wireframe)
 {
-    for (MeshIterator i = objects.begin(); i != objects.end(); i++)
-        i.value()->useWireframe = wireframe;
+    Post([this, wireframe]
+        {
+            for (MeshGL& gl : objects)
+                gl.useWireframe = wireframe;
+            drawListDirty = true;
+            frameRequested = true;
+        });
 }
 
 /*!
@@ -609,8 +2219,23 @@ void MeshWidget::UseWireframeGlobal(bool wireframe)
 */
 void MeshWidget::SetShading(const QString& name, MeshShading shading)
 {
-    if (objects.contains(name))
-        objects[name]->shading = shading;
+    SetShading(FindMesh(name), shading);
+}
+
+/*!
+\brief Overloaded.
+\param h mesh handle
+\param shading new shading mode
+*/
+void MeshWidget::SetShading(MeshHandle h, MeshShading shading)
+{
+    Post([this, h, shading]
+        {
+            if (MeshGL* gl = objects.Get(h))
+                gl->shading = shading;
+            drawListDirty = true;
+            frameRequested = true;
+        });
 }
 
 /*!
@@ -619,20 +2244,25 @@ void MeshWidget::SetShading(const QString& name, MeshShading shading)
 */
 void MeshWidget::SetShadingGlobal(MeshShading shading)
 {
-    for (MeshIterator i = objects.begin(); i != objects.end(); i++)
-        i.value()->shading = shading;
+    Post([this, shading]
+        {
+            for (MeshGL& gl : objects)
+                gl.shading = shading;
+            drawListDirty = true;
+            frameRequested = true;
+        });
 }
 
 
 /*!
-\brief Capture the rendering viewport and save it to disk.
+\brief Save a screenshot of the current view in the app folder, named after the date and time.
+
+The image is rendered offscreen, so that it may be larger than the widget, and written in the
+background: the function returns without waiting for the GPU or for the encoding.
+\param w, h Size of the image.
 */
 void MeshWidget::SaveScreen(int w, int h)
 {
-    QSize qs = size();
-    resize(w, h);
-    QImage image(size(), QImage::Format_ARGB32);
-
     // Date and time
     QDate date = QDate::currentDate();
     QTime time = QTime::currentTime();
@@ -646,12 +2276,299 @@ void MeshWidget::SaveScreen(int w, int h)
             .arg(time.minute(), 2, 10, QChar('0'))
             .arg(time.second(), 2, 10, QChar('0'));
 
-    // Get image
-    image = grabFramebuffer();
+    const Camera current = camera;
+    Post([this, current, w, h, name] { CaptureView(current, w, h, name); });
+}
+
+/*!
+\brief Render a set of views of the scene into image files.
+
+All the views are submitted at once, the GPU copies and the encoding of the images overlap the
+rendering of the next views. Use FinishCaptures() to wait for the files to be written.
+\param cameras Cameras of the views.
+\param pattern File name, with a %1 replaced by the index of the view, such as "view-%1.png".
+\param w, h Size of the images.
+*/
+void MeshWidget::SaveViews(const std::vector<Camera>& cameras, const QString& pattern, int w, int h)
+{
+    Post([this, cameras, pattern, w, h]
+        {
+            for (size_t i = 0; i < cameras.size(); i++)
+                CaptureView(cameras[i], w, h, pattern.arg(int(i), 4, 10, QChar('0')));
+        });
+}
+
+/*!
+\brief Wait for all the screenshots to be read back and written.
+*/
+void MeshWidget::FinishCaptures()
+{
+    Invoke([this] { CollectReadbacks(0); });
+    imageWriter.Wait();
+}
+
+/*!
+\brief Render a view into an image written to a file.
+
+Executed by the render thread. The image is rendered in tiles into an offscreen framebuffer, every
+tile being copied to a pixel buffer object. The copies are only read once their fence has been
+signaled, by the next iterations of the render loop, so that the CPU does not wait for the GPU
+unless too many copies are in flight.
+\param shot Camera.
+\param w, h Size of the image.
+\param name File name.
+*/
+void MeshWidget::CaptureView(const Camera& shot, int w, int h, const QString& name)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    if (captureFramebuffer == 0)
+    {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxSize);
+        captureTile = std::min(2048, int(maxSize));
+
+        glGenRenderbuffers(1, &captureColor);
+        glBindRenderbuffer(GL_RENDERBUFFER, captureColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, captureTile, captureTile);
+        glGenRenderbuffers(1, &captureDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, captureDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, captureTile, captureTile);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &captureFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, captureFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, captureColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "Error : Offscreen framebuffer is incomplete, screenshots are disabled" << std::endl;
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            DeleteCaptureBuffers();
+            return;
+        }
+    }
+
+    std::shared_ptr<Capture> capture = std::make_shared<Capture>();
+    capture->image = QImage(w, h, QImage::Format_RGBX8888);
+    capture->name = name;
+    capture->tiles = ((w + captureTile - 1) / captureTile) * ((h + captureTile - 1) / captureTile);
+
+    // The view is drawn with the state of the renderer, which is restored afterwards
+    const Camera current = view.camera;
+    view.camera = shot;
+    const Camera& camera = view.camera;
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glBindFramebuffer(GL_FRAMEBUFFER, captureFramebuffer);
+    UpdateTerrain(w, h);
+
+    for (int y = 0; y < h; y += captureTile)
+    {
+        for (int x = 0; x < w; x += captureTile)
+        {
+            const int tw = std::min(captureTile, w - x);
+            const int th = std::min(captureTile, h - y);
+            glViewport(0, 0, tw, th);
+            SetProjection(w, h, x, y, tw, th);
+            glClearColor(1.0f, 1.0f, 1.0f, 1.f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glLoadIdentity();
+            gluLookAt(camera.Eye()[0], camera.Eye()[1], camera.Eye()[2], camera.At()[0], camera.At()[1], camera.At()[2], camera.Up()[0], camera.Up()[1], camera.Up()[2]);
+            DrawSky(w, h, x, y);
+            DrawMeshes(w, h, tw, th);
+
+            // Bounded number of copies in flight, waits for the oldest one otherwise
+            CollectReadbacks(MaxReadbacks - 1);
+            Readback readback;
+            const size_t size = size_t(tw) * th * 4;
+            for (size_t i = 0; i < readbackBuffers.size(); i++)
+            {
+                if (readbackBuffers[i].size >= size)
+                {
+                    readback = readbackBuffers[i];
+                    readbackBuffers.erase(readbackBuffers.begin() + i);
+                    break;
+                }
+            }
+            if (readback.pbo == 0)
+            {
+                glGenBuffers(1, &readback.pbo);
+                readback.size = size_t(captureTile) * captureTile * 4;
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+                glBufferData(GL_PIXEL_PACK_BUFFER, readback.size, nullptr, GL_STREAM_READ);
+            }
+
+            // Asynchronous copy
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, tw, th, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            readback.capture = capture;
+            readback.x = x;
+            readback.y = y;
+            readback.w = tw;
+            readback.h = th;
+            readbacks.push_back(readback);
+        }
+    }
+
+    view.camera = current;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+/*!
+\brief Copy the finished readbacks into their images, oldest first.
+
+Images whose tiles have all arrived are queued to the image writer.
+\param pending Number of readbacks that may be left in flight, the function waits for the others.
+*/
+void MeshWidget::CollectReadbacks(size_t pending)
+{
+    while (!readbacks.empty())
+    {
+        Readback& readback = readbacks.front();
+        GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED && readbacks.size() <= pending)
+            break;
+        while (status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(readback.fence, 0, 1000000);
+        glDeleteSync(readback.fence);
+        readback.fence = 0;
+
+        // Rows are read bottom up
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+        const size_t row = size_t(readback.w) * 4;
+        const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, row * readback.h, GL_MAP_READ_BIT);
+        if (pixels != nullptr)
+        {
+            QImage& image = readback.capture->image;
+            for (int j = 0; j < readback.h; j++)
+                memcpy(image.scanLine(image.height() - 1 - readback.y - j) + size_t(readback.x) * 4, pixels + row * j, row);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (--readback.capture->tiles == 0)
+            imageWriter.Save(readback.capture->image, readback.capture->name);
+        readback.capture.reset();
+        readbackBuffers.push_back(readback);
+        readbacks.pop_front();
+    }
+}
+
+/*!
+\brief Release the offscreen framebuffer and the pixel buffer objects, pending readbacks are lost.
+*/
+void MeshWidget::DeleteCaptureBuffers()
+{
+    for (Readback& readback : readbacks)
+    {
+        glDeleteSync(readback.fence);
+        glDeleteBuffers(1, &readback.pbo);
+    }
+    readbacks.clear();
+    for (Readback& readback : readbackBuffers)
+        glDeleteBuffers(1, &readback.pbo);
+    readbackBuffers.clear();
+    glDeleteFramebuffers(1, &captureFramebuffer);
+    glDeleteRenderbuffers(1, &captureColor);
+    glDeleteRenderbuffers(1, &captureDepth);
+    captureFramebuffer = captureColor = captureDepth = 0;
+}
+
+/*!
+\brief Render a camera path as fast as possible and write the statistics of every frame to a CSV file.
+
+Frames are rendered back to back by the render thread at a fixed size, whatever the size of the
+widget, so that runs on the same machine may be compared. Every frame is timed on the GPU, the
+profiler waiting for the timestamps instead of skipping frames. The CSV file has one line per
+frame, with the CPU time spent submitting the frame, excluding the wait for the timestamps of
+older frames, the GPU time of every pass and of the whole
+frame in milliseconds, and the number of triangles, draw calls and culled objects.
+_signalBenchmarkDone() is emitted once the file is written.
+\param path Camera path, the near and far planes being those of the current camera.
+\param frames Number of frames, evenly spaced along the path.
+\param file CSV file name.
+\param w, h Size of the frames.
+*/
+void MeshWidget::RunBenchmark(const CameraPath& path, int frames, const QString& file, int w, int h)
+{
+    const std::vector<Camera> cameras = path.Sample(frames, camera.GetNear(), camera.GetFar());
+    Post([this, cameras, w, h, file] { Benchmark(cameras, w, h, file); });
+}
+
+/*!
+\brief Render the frames of a benchmark, executed by the render thread.
+\param cameras Camera of every frame.
+\param w, h Size of the frames.
+\param file CSV file name.
+*/
+void MeshWidget::Benchmark(const std::vector<Camera>& cameras, int w, int h, const QString& file)
+{
+    // Statistics of a frame, its GPU times are read back later
+    struct Sample
+    {
+        double cpu;
+        int triangles, drawCalls, visible, culled, occluded;
+    };
+    std::vector<Sample> samples;
+    samples.reserve(cameras.size());
+
+    const View current = view;
+    view.width = w;
+    view.height = h;
+    profiler.enabled = true;
+    profiler.blocking = true;
+    profiler.Record(int(cameras.size()));
+    for (const Camera& c : cameras)
+    {
+        view.camera = c;
+        // Blocking read back of old timestamps is kept out of the submission time
+        profiler.WaitNextFrame();
+        auto start = std::chrono::high_resolution_clock::now();
+        RenderFrame();
+        auto stop = std::chrono::high_resolution_clock::now();
+        samples.push_back({ std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / 1000000.0,
+            profiler.triangles, profiler.drawCalls, profiler.visibleObjects, profiler.culledObjects, profiler.occludedObjects });
+    }
+    profiler.Flush();
 
-    // Save
-    image.save(name, "PNG");
-    resize(qs);
+    QFile data(file);
+    const bool written = data.open(QFile::WriteOnly);
+    if (written)
+    {
+        QTextStream out(&data);
+        out << "frame,cpu_ms,gpu_sky_ms,gpu_meshes_ms,gpu_ms,triangles,draw_calls,visible,frustum_culled,occluded\n";
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            const Sample& sample = samples[i];
+            out << i << ',' << QString::number(sample.cpu, 'f', 3);
+            for (int p = 0; p <= RenderingProfiler::PassCount; p++)
+                out << ',' << QString::number(profiler.history[i * (RenderingProfiler::PassCount + 1) + p], 'f', 3);
+            out << ',' << sample.triangles << ',' << sample.drawCalls << ',' << sample.visible << ',' << sample.culled << ',' << sample.occluded << '\n';
+        }
+        out.flush();
+        data.close();
+    }
+    else
+        std::cout << "Error : Benchmark file " << file.toStdString() << " could not be written" << std::endl;
+
+    // Interactive state is restored
+    profiler.history.clear();
+    profiler.blocking = false;
+    profiler.enabled = renderSettings.statistics;
+    view = current;
+    frameRequested = true;
+    QMetaObject::invokeMethod(this, [this, written] { emit _signalBenchmarkDone(written); }, Qt::QueuedConnection);
 }
 
 /*!
@@ -664,8 +2581,9 @@ QPoint MeshWidget::GetMousePosition() const
 
 /*!
 \brief Render the stats panel of the widget.
+\param stats Statistics of the presented frame.
 */
-void MeshWidget::RenderStats()
+void MeshWidget::RenderStats(const FrameStats& stats)
 {
     // We need to unbind VAO and program for now because it causes problem with below command.
     glBindVertexArray(0);
@@ -682,8 +2600,8 @@ void MeshWidget::RenderStats()
 
     const int bX = 10;
     const int bY = 10;
-    const int sizeX = 200;
-    const int sizeY = 65;
+    const int sizeX = 320;
+    const int sizeY = 185;
 
     // Background
     painter.setPen(penLineGrey);
@@ -697,9 +2615,23 @@ void MeshWidget::RenderStats()
     painter.setPen(penLineWhite);
     painter.drawText(10 + 5, bY + 10 + 5, "Statistics");
     painter.setFont(f2);
-    painter.drawText(10 + 5, bY + 10 + 20, "CPU FPS:\t" + QString::number(profiler.framePerSecond));
-    painter.drawText(10 + 5, bY + 10 + 35, "CPU Frame:\t" + QString::number(profiler.msPerFrame) + "ms");
-    painter.drawText(10 + 5, bY + 10 + 50, "GPU:\t" + QString::number(profiler.elapsedTimeGPU / 1000000.0) + "ms");
+    painter.drawText(10 + 5, bY + 10 + 20, "CPU FPS:\t" + QString::number(stats.framePerSecond));
+    painter.drawText(10 + 5, bY + 10 + 35, "CPU Frame:\t" + QString::number(stats.msPerFrame) + "ms");
+    painter.drawText(10 + 5, bY + 10 + 50, "GPU ms:\tmin\tavg\tp95\tp99");
+    const char* passes[RenderingProfiler::PassCount + 1] = { "Sky", "Meshes", "Total" };
+    for (int i = 0; i <= RenderingProfiler::PassCount; i++)
+    {
+        const RenderingProfiler::PassStats& gpu = stats.gpu[i];
+        painter.drawText(10 + 5, bY + 10 + 65 + 15 * i, QString(passes[i]) + ":\t" + QString::number(gpu.min, 'f', 2) + "\t" + QString::number(gpu.avg, 'f', 2)
+            + "\t" + QString::number(gpu.p95, 'f', 2) + "\t" + QString::number(gpu.p99, 'f', 2));
+    }
+    painter.drawText(10 + 5, bY + 10 + 110, "Visible:\t" + QString::number(stats.visibleObjects));
+    painter.drawText(10 + 5, bY + 10 + 125, "Culled:\t" + QString::number(stats.culledObjects) + " frustum, " + QString::number(stats.occludedObjects) + " occluded");
+    painter.drawText(10 + 5, bY + 10 + 140, "Draw calls:\t" + QString::number(stats.drawCalls));
+    painter.drawText(10 + 5, bY + 10 + 155, "Triangles:\t" + QString::number(stats.triangles));
+    const GpuBufferPool::Stats& pool = stats.pool;
+    painter.drawText(10 + 5, bY + 10 + 170, "GPU pool:\t" + QString::number(pool.inUse / 1048576.0, 'f', 1) + " / " + QString::number(pool.reserved / 1048576.0, 'f', 1)
+        + "MB, " + QString::number(pool.pages) + " buffers, " + QString::number(100.0 * pool.fragmentation, 'f', 0) + "% fragmented");
 
     painter.end();
 
@@ -751,7 +2683,7 @@ void MeshWidget::mouseReleaseEvent(QMouseEvent*)
 {
     QApplication::setOverrideCursor(QCursor(Qt::ArrowCursor));
     emit _signalMouseRelease();
-    update();
+    RequestFrame();
 }
 
 /*!
@@ -761,7 +2693,7 @@ void MeshWidget::mouseReleaseEvent(QMouseEvent*)
 void MeshWidget::mouseDoubleClickEvent(QMouseEvent* e)
 {
     emit _signalMouseMove(e);
-    update();
+    RequestFrame();
 }
 
 /*!
@@ -799,6 +2731,7 @@ void MeshWidget::mouseMoveEvent(QMouseEvent* e)
         _InternalGetMouseGlobalPosition(e, x0, y0);
 
         emit _signalMouseMove(e);
+        RequestFrame();
     }
     if (e->modifiers() & Qt::ShiftModifier)
     {
@@ -826,16 +2759,7 @@ void MeshWidget::wheelEvent(QWheelEvent* e)
         camera.BackForth(-MoveScale);
     }
 
-    // Apply changes to projection matrix if we are in orthographic mode
-    if (!perspectiveProjection)
-    {
-        makeCurrent();
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        glOrtho(-cameraOrthoSize, cameraOrthoSize, -cameraOrthoSize, cameraOrthoSize, camera.GetNear(), camera.GetFar());
-    }
-
-    update();
+    RequestFrame();
 }
 
 /*!
@@ -853,7 +2777,25 @@ void MeshWidget::keyPressEvent(QKeyEvent* e)
     case Qt::Key_S:
         // Ctrl + S: Statistics
         if (e->modifiers() & Qt::ControlModifier)
-            profiler.enabled = !profiler.enabled;
+        {
+            settings.statistics = !settings.statistics;
+            UpdateSettings();
+        }
+        break;
+    case Qt::Key_B:
+        // Ctrl + B: Batched mode
+        if (e->modifiers() & Qt::ControlModifier)
+            SetBatching(!settings.batching);
+        break;
+    case Qt::Key_O:
+        // Ctrl + O: Occlusion culling
+        if (e->modifiers() & Qt::ControlModifier)
+            SetOcclusionCulling(!settings.occlusionCulling);
+        break;
+    case Qt::Key_R:
+        // Ctrl + R: Continuous rendering, for benchmarking
+        if (e->modifiers() & Qt::ControlModifier)
+            SetContinuousRendering(!settings.continuous);
         break;
     default:
         QOpenGLWidget::keyPressEvent(e);
@@ -867,5 +2809,5 @@ void MeshWidget::keyPressEvent(QKeyEvent* e)
 void MeshWidget::keyReleaseEvent(QKeyEvent* e)
 {
     QOpenGLWidget::keyReleaseEvent(e);
-    update();
+    RequestFrame();
 }
@@ -2,6 +2,7 @@
 #include "cylinder.h"
 #include "matrix.h"
 #include "mathematics.h"
+#include "trace.h"
 #include <chrono>
 
 /*!
@@ -70,6 +71,8 @@ This function weights the normals of the faces by their corresponding area.
 */
 void Mesh::SmoothNormals()
 {
+    TRACE_ZONE("Mesh::SmoothNormals");
+
     // Initialize
     normals.resize(vertices.size(), Vector::Null);
 
@@ -168,6 +171,8 @@ The object has 8 vertices, 6 normals and 12 triangles.
 */
 Mesh::Mesh(const Box& box)
 {
+    TRACE_ZONE("Mesh(Box)");
+
     // Vertices
     vertices.resize(8);
 
@@ -209,6 +214,8 @@ Mesh::Mesh(const Box& box)
 
 Mesh::Mesh(const Disc& disc, int n)
 {
+    TRACE_ZONE("Mesh(Disc)");
+
     // Vertices
     double angle = 2 * M_PI / n;
     vertices.push_back(disc.Center());
@@ -231,6 +238,8 @@ Mesh::Mesh(const Disc& disc, int n)
 
 Mesh::Mesh(const Cone& cone, int n)
 {
+    TRACE_ZONE("Mesh(Cone)");
+
     // Vertices
     double angle = 2 * M_PI / n;
     vertices.push_back(cone.Center());
@@ -259,6 +268,8 @@ Mesh::Mesh(const Cone& cone, int n)
 
 Mesh::Mesh(const Cylinder& c, int n)
 {
+    TRACE_ZONE("Mesh(Cylinder)");
+
     // Vertices
     double angle = 2 * M_PI / n;
     vertices.push_back(c.Center()); // Index 0
@@ -300,8 +311,10 @@ Mesh::Mesh(const Cylinder& c, int n)
     SmoothNormals();
 }
 
-Mesh::Mesh(const Sphere& s,  int n)
+Mesh::Mesh(const Sphere& s,  int n, const BuildProgress& progress)
 {
+    TRACE_ZONE("Mesh(Sphere)");
+
     // Vertices
     vertices.push_back(s.Center() + s.Normal() * s.Radius());
     for (int i = 0; i < n-1; ++i)
@@ -316,6 +329,8 @@ Mesh::Mesh(const Sphere& s,  int n)
             double z = cos(phi) * s.Radius();
             vertices.push_back(Vector(x, y, z) + s.Center());
         }
+        if (!Continue(progress, 0.4 * (i + 1) / (n - 1)))
+            return;
     }
     vertices.push_back(Vector(s.Center() - s.Normal() * s.Radius()));
 
@@ -343,14 +358,19 @@ Mesh::Mesh(const Sphere& s,  int n)
             AddTriangle(i0, i1, i2, 0);
             AddTriangle(i0, i2, i3, 0);
         }
+        if (!Continue(progress, 0.4 + 0.4 * (j + 1) / (n - 2)))
+            return;
     }
 
     // Normals
     SmoothNormals();
+    Continue(progress, 1.0);
 }
 
-Mesh::Mesh(const Tore& t, int n)
+Mesh::Mesh(const Tore& t, int n, const BuildProgress& progress)
 {
+    TRACE_ZONE("Mesh(Tore)");
+
     // Vertices
     for (int i = 0; i < n; ++i)
     {
@@ -364,6 +384,8 @@ Mesh::Mesh(const Tore& t, int n)
             double z = cos(theta) * t.radius();
             vertices.push_back(Vector(x, y, z) + t.Center());
         }
+        if (!Continue(progress, 0.4 * (i + 1) / n))
+            return;
     }
 
     // Topology
@@ -380,14 +402,19 @@ Mesh::Mesh(const Tore& t, int n)
             AddTriangle(j0, j1, j2, 0);
             AddTriangle(j0, j2, j3, 0);
         }
+        if (!Continue(progress, 0.4 + 0.4 * (i + 1) / n))
+            return;
     }
 
     // Normals
     SmoothNormals();
+    Continue(progress, 1.0);
 }
 
-Mesh::Mesh(const Capsule& c, int n)
+Mesh::Mesh(const Capsule& c, int n, const BuildProgress& progress)
 {
+    TRACE_ZONE("Mesh(Capsule)");
+
     if (n % 2 == 0) n -= 1;
 
     // Vertices
@@ -408,6 +435,8 @@ Mesh::Mesh(const Capsule& c, int n)
                 vertices.push_back(Vector(x, y, z) + c.Center());
             }
         }
+        if (!Continue(progress, 0.4 * (i + 1) / (n - 1)))
+            return;
     }
     vertices.push_back(c.Center() - c.Normal() * c.Radius());
 
@@ -435,10 +464,30 @@ Mesh::Mesh(const Capsule& c, int n)
             AddTriangle(i0, i1, i2, 0);
             AddTriangle(i0, i2, i3, 0);
         }
+        if (!Continue(progress, 0.4 + 0.4 * (j + 1) / (n - 2)))
+            return;
     }
 
     // Normals
     SmoothNormals();
+    Continue(progress, 1.0);
+}
+
+/*!
+\brief Report the progress of a constructor, and empty the mesh if it is cancelled.
+\param progress Callback, may be empty.
+\param p Progress, between 0 and 1.
+\return false if the construction is cancelled.
+*/
+bool Mesh::Continue(const BuildProgress& progress, double p)
+{
+    if (!progress || progress(p))
+        return true;
+    vertices.clear();
+    normals.clear();
+    varray.clear();
+    narray.clear();
+    return false;
 }
 
 /*!
@@ -534,11 +583,8 @@ void Mesh::Merge(const Mesh& m)
         vertices.push_back(m.Vertex(i));
     }
 
-    // adding m's normals
-    for (int i = 0; i < m.Triangles()*3; ++i)
-    {
-        normals.push_back(m.Normal(i));
-    }
+    // adding m's normals, which may be shared by several triangles
+    normals.insert(normals.end(), m.normals.begin(), m.normals.end());
 
     for (int i = 0; i < m.Triangles(); ++i)
     {
@@ -572,75 +618,92 @@ void Mesh::SphereWarp(const Sphere& s, double force)
     SmoothNormals();
 }
 
-#include <QtCore/QFile>
-#include <QtCore/QTextStream>
-#include <QtCore/QRegularExpression>
-#include <QtCore/qstring.h>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
 
 /*!
 \brief Import a mesh from an .obj file.
+
+Faces with more than three vertices are split into a fan of triangles. Normals are computed
+if some faces do not reference any.
 \param filename File name.
+\return false if the file could not be opened.
 */
-void Mesh::Load(const QString& filename)
+bool Mesh::Load(const std::string& filename)
 {
+  TRACE_ZONE("Mesh::Load");
+
   vertices.clear();
   normals.clear();
   varray.clear();
   narray.clear();
 
-  QFile data(filename);
+  std::ifstream in(filename);
+  if (!in)
+    return false;
 
-  if (!data.open(QFile::ReadOnly))
-    return;
-  QTextStream in(&data);
-
-  // Set of regular expressions : Vertex, Normal, Triangle
-  QRegularExpression rexv("v\\s*([-|+|\\s]\\d*\\.\\d+)\\s*([-|+|\\s]\\d*\\.\\d+)\\s*([-|+|\\s]\\d*\\.\\d+)");
-  QRegularExpression rexn("vn\\s*([-|+|\\s]\\d*\\.\\d+)\\s*([-|+|\\s]\\d*\\.\\d+)\\s*([-|+|\\s]\\d*\\.\\d+)");
-  QRegularExpression rext("f\\s*(\\d*)/\\d*/(\\d*)\\s*(\\d*)/\\d*/(\\d*)\\s*(\\d*)/\\d*/(\\d*)");
-  while (!in.atEnd())
+  bool smooth = false;
+  std::string line;
+  while (std::getline(in, line))
   {
-    QString line = in.readLine();
-    QRegularExpressionMatch match = rexv.match(line);
-    QRegularExpressionMatch matchN = rexn.match(line);
-    QRegularExpressionMatch matchT = rext.match(line);
-    if (match.hasMatch())//rexv.indexIn(line, 0) > -1)
-    {
-      Vector q = Vector(match.captured(1).toDouble(), match.captured(2).toDouble(), match.captured(3).toDouble()); vertices.push_back(q);
-    }
-    else if (matchN.hasMatch())//rexn.indexIn(line, 0) > -1)
-    {
-      Vector q = Vector(matchN.captured(1).toDouble(), matchN.captured(2).toDouble(), matchN.captured(3).toDouble());  normals.push_back(q);
-    }
-    else if (matchT.hasMatch())//rext.indexIn(line, 0) > -1)
-    {
-      varray.push_back(matchT.captured(1).toInt() - 1);
-      varray.push_back(matchT.captured(3).toInt() - 1);
-      varray.push_back(matchT.captured(5).toInt() - 1);
-      narray.push_back(matchT.captured(2).toInt() - 1);
-      narray.push_back(matchT.captured(4).toInt() - 1);
-      narray.push_back(matchT.captured(6).toInt() - 1);
+    std::istringstream tokens(line);
+    std::string type;
+    tokens >> type;
+    if (type == "v")
+    {
+      double x = 0.0, y = 0.0, z = 0.0;
+      tokens >> x >> y >> z;
+      vertices.push_back(Vector(x, y, z));
+    }
+    else if (type == "vn")
+    {
+      double x = 0.0, y = 0.0, z = 0.0;
+      tokens >> x >> y >> z;
+      normals.push_back(Vector(x, y, z));
+    }
+    else if (type == "f")
+    {
+      // Corners are given as v, v/t, v//n or v/t/n, indexes start at one
+      std::vector<int> v, n;
+      std::string corner;
+      while (tokens >> corner)
+      {
+        const size_t first = corner.find('/');
+        const size_t second = first == std::string::npos ? first : corner.find('/', first + 1);
+        v.push_back(atoi(corner.c_str()) - 1);
+        n.push_back(second == std::string::npos ? -1 : atoi(corner.c_str() + second + 1) - 1);
+        if (n.back() < 0)
+          smooth = true;
+      }
+      for (size_t i = 2; i < v.size(); i++)
+        AddSmoothTriangle(v[0], n[0], v[i - 1], n[i - 1], v[i], n[i]);
     }
   }
-  data.close();
+
+  if (smooth)
+    SmoothNormals();
+  return true;
 }
 
 /*!
 \brief Save the mesh in .obj format, with vertices and normals.
 \param url Filename.
 \param meshName %Mesh name in .obj file.
+\return false if the file could not be written.
 */
-void Mesh::SaveObj(const QString& url, const QString& meshName) const
+bool Mesh::SaveObj(const std::string& url, const std::string& meshName) const
 {
-  QFile data(url);
-  if (!data.open(QFile::WriteOnly))
-    return;
-  QTextStream out(&data);
-  out << "g " << meshName << Qt::endl;
+  TRACE_ZONE("Mesh::SaveObj");
+
+  std::ofstream out(url);
+  if (!out)
+    return false;
+  out << "g " << meshName << "\n";
   for (size_t i = 0; i < vertices.size(); i++)
-    out << "v " << vertices.at(i)[0] << " " << vertices.at(i)[1] << " " << vertices.at(i)[2] << QString('\n');
+    out << "v " << vertices.at(i)[0] << " " << vertices.at(i)[1] << " " << vertices.at(i)[2] << "\n";
   for (size_t i = 0; i < normals.size(); i++)
-    out << "vn " << normals.at(i)[0] << " " << normals.at(i)[1] << " " << normals.at(i)[2] << QString('\n');
+    out << "vn " << normals.at(i)[0] << " " << normals.at(i)[1] << " " << normals.at(i)[2] << "\n";
   for (size_t i = 0; i < varray.size(); i += 3)
   {
     out << "f " << varray.at(i) + 1 << "//" << narray.at(i) + 1 << " "
@@ -649,6 +712,6 @@ void Mesh::SaveObj(const QString& url, const QString& meshName) const
       << "\n";
   }
   out.flush();
-  data.close();
+  return bool(out);
 }
 
@@ -0,0 +1,217 @@
+#include "mesh_lod.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+/*!
+\class MeshLOD mesh_lod.h
+
+\brief Chain of levels of detail of a triangle mesh, sharing the vertices of the full resolution mesh.
+
+Coarser levels are computed by vertex clustering: vertices are snapped to a grid whose cells double
+in size at every level, every cell being replaced by the vertex closest to the average of its
+vertices. Triangles collapsed by the clustering are removed. Cells of a level are nested in those
+of the next one, so every level is computed from the previous one.
+
+Levels only differ by their indexes, so that a mesh stores a single vertex buffer and a single index
+buffer holding the whole chain. Levels are selected by projecting their geometric error on screen:
+
+\code
+MeshLOD lod(vertices, n);
+int level = lod.Select(pixels / distance, level, 1.0);
+glDrawElements(GL_TRIANGLES, lod[level].count, GL_UNSIGNED_INT, (const void*)(sizeof(int) * lod[level].first));
+\endcode
+*/
+
+/*!
+\brief Spread the ten lower bits of an integer so that they are interleaved with two zero bits.
+\param x Integer.
+*/
+static inline uint32_t Spread(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+/*!
+\brief Create a single level drawing the vertices in order.
+\param n Number of indexes, three per triangle.
+*/
+MeshLOD::MeshLOD(int n)
+{
+    levels.push_back({ 0, n, 0.0 });
+    indexes.resize(n);
+    for (int i = 0; i < n; i++)
+        indexes[i] = i;
+}
+
+/*!
+\brief Compute the levels of detail of a triangle mesh.
+
+The mesh is given as the array of its vertices, three consecutive vertices forming a triangle.
+A level is kept if it has at most half as many triangles as the previous one.
+\param vertices Coordinates of the vertices.
+\param n Number of vertices, three per triangle.
+\param minimum Levels are no longer computed once a level has fewer triangles.
+*/
+MeshLOD::MeshLOD(const float* vertices, int n, int minimum) : MeshLOD(n)
+{
+    if (n < 3)
+        return;
+
+    // Box of the vertices and size of the cells of the finest grid
+    float a[3] = { vertices[0], vertices[1], vertices[2] };
+    float b[3] = { a[0], a[1], a[2] };
+    for (int i = 1; i < n; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            a[j] = std::min(a[j], vertices[3 * i + j]);
+            b[j] = std::max(b[j], vertices[3 * i + j]);
+        }
+    }
+    const float extent = std::max(b[0] - a[0], std::max(b[1] - a[1], b[2] - a[2]));
+    if (extent <= 0.0f)
+        return;
+    const int cells = 1 << Bits;
+    const float scale = float(cells) / extent;
+
+    // Vertices sorted along a Morton curve, so that the vertices of a cell are contiguous at every level
+    std::vector<uint64_t> keys(n);
+#pragma omp parallel for
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t code = 0;
+        for (int j = 0; j < 3; j++)
+        {
+            const int q = std::min(cells - 1, int((vertices[3 * i + j] - a[j]) * scale));
+            code |= Spread(uint32_t(q)) << j;
+        }
+        keys[i] = (uint64_t(code) << 32) | uint32_t(i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<int> replaced(n);
+    std::vector<std::array<int, 3>> triangles(n / 3);
+    for (int t = 0; t < n / 3; t++)
+        triangles[t] = { 3 * t, 3 * t + 1, 3 * t + 2 };
+
+    for (int level = 1; level <= Bits && int(triangles.size()) >= minimum; level++)
+    {
+        // Every cell is replaced by the vertex closest to the average of its vertices
+        const int shift = 32 + 3 * level;
+        double error = 0.0;
+        for (int i = 0; i < n;)
+        {
+            int j = i + 1;
+            while (j < n && (keys[j] >> shift) == (keys[i] >> shift))
+                j++;
+
+            double c[3] = { 0.0, 0.0, 0.0 };
+            for (int k = i; k < j; k++)
+            {
+                const float* p = vertices + 3 * uint32_t(keys[k]);
+                c[0] += p[0];
+                c[1] += p[1];
+                c[2] += p[2];
+            }
+            for (int e = 0; e < 3; e++)
+                c[e] /= double(j - i);
+
+            int best = int(uint32_t(keys[i]));
+            double d = 1e300;
+            for (int k = i; k < j; k++)
+            {
+                const float* p = vertices + 3 * uint32_t(keys[k]);
+                const double s = (p[0] - c[0]) * (p[0] - c[0]) + (p[1] - c[1]) * (p[1] - c[1]) + (p[2] - c[2]) * (p[2] - c[2]);
+                if (s < d)
+                {
+                    d = s;
+                    best = int(uint32_t(keys[k]));
+                }
+            }
+
+            const float* r = vertices + 3 * best;
+            for (int k = i; k < j; k++)
+            {
+                const int v = int(uint32_t(keys[k]));
+                const float* p = vertices + 3 * v;
+                error = std::max(error, double(p[0] - r[0]) * (p[0] - r[0]) + double(p[1] - r[1]) * (p[1] - r[1]) + double(p[2] - r[2]) * (p[2] - r[2]));
+                replaced[v] = best;
+            }
+            i = j;
+        }
+
+        // Collapsed triangles are removed, and duplicates with the same orientation
+        size_t m = 0;
+        for (const std::array<int, 3>& t : triangles)
+        {
+            std::array<int, 3> u = { replaced[t[0]], replaced[t[1]], replaced[t[2]] };
+            if (u[0] == u[1] || u[1] == u[2] || u[2] == u[0])
+                continue;
+            std::rotate(u.begin(), std::min_element(u.begin(), u.end()), u.end());
+            triangles[m++] = u;
+        }
+        triangles.resize(m);
+        std::sort(triangles.begin(), triangles.end());
+        triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+        if (triangles.empty())
+            break;
+
+        if (2 * triangles.size() * 3 <= size_t(levels.back().count))
+        {
+            levels.push_back({ int(indexes.size()), int(3 * triangles.size()), sqrt(error) });
+            for (const std::array<int, 3>& t : triangles)
+                indexes.insert(indexes.end(), t.begin(), t.end());
+        }
+    }
+}
+
+/*!
+\brief Release the memory of the index chain, once it has been uploaded.
+*/
+void MeshLOD::ReleaseIndexes()
+{
+    indexes = std::vector<int>();
+}
+
+/*!
+\brief Return the coarsest level whose projected error is below a threshold.
+\param scale Pixels per unit of length at the distance of the mesh.
+\param tau Threshold, in pixels.
+*/
+int MeshLOD::Coarsest(double scale, double tau) const
+{
+    for (int i = int(levels.size()) - 1; i > 0; i--)
+    {
+        if (levels[i].error * scale <= tau)
+            return i;
+    }
+    return 0;
+}
+
+/*!
+\brief Select the level to be drawn.
+
+The coarsest level whose projected error is below the threshold is selected. In order to avoid
+popping when the mesh stays at the same distance from the camera, a coarser level than the current
+one is only selected once its error falls below a lower threshold, whereas finer levels are selected
+as soon as the error of the current one exceeds the threshold.
+\param scale Pixels per unit of length at the distance of the mesh.
+\param current Level drawn in the previous frame.
+\param tau Maximum screen space error, in pixels.
+\param hysteresis Relative margin of the lower threshold.
+*/
+int MeshLOD::Select(double scale, int current, double tau, double hysteresis) const
+{
+    const int level = Coarsest(scale, tau);
+    if (level <= current)
+        return level;
+    return std::max(current, Coarsest(scale, tau / (1.0 + hysteresis)));
+}
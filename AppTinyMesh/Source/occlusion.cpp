@@ -0,0 +1,368 @@
+// Occlusion
+
+#include "occlusion.h"
+
+#include <algorithm>
+#include <cmath>
+
+/*!
+\class OcclusionBuffer occlusion.h
+\brief Low resolution depth buffer of a few large occluders, used to cull hidden boxes on the CPU.
+
+Occluders are rasterized at the centers of the pixels, and every covered pixel stores the farthest
+depth of the triangle over the pixel, so that depths are conservative. Coverage is not: requiring
+triangles to cover whole pixels would leave cracks along the edges shared by the triangles of a
+mesh, so silhouettes are only accurate to half a pixel of the buffer.
+
+Levels of a hierarchy store the farthest and the nearest depth of blocks of 2<sup>n</sup> pixels,
+so that testing a box only reads a few texels whatever its size on screen.
+
+\code
+OcclusionBuffer occlusion(256, 128);
+occlusion.Clear(mvp);                                // Column major projection times view matrix
+occlusion.Add(vertices, triangles, model);
+occlusion.Build();
+int hidden = occlusion.Cull(boxes, visible);
+\endcode
+*/
+
+/*!
+\brief Create a buffer.
+\param w, h Size of the finest level.
+*/
+OcclusionBuffer::OcclusionBuffer(int w, int h)
+{
+  for (int i = 0; i < 16; i++)
+    matrix[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+  Resize(w, h);
+}
+
+/*!
+\brief Change the size of the buffer, and allocate the levels of the hierarchy.
+
+Does nothing if the size is unchanged.
+\param w, h Size of the finest level.
+*/
+void OcclusionBuffer::Resize(int w, int h)
+{
+  w = std::max(1, w);
+  h = std::max(1, h);
+  if (w == width && h == height)
+    return;
+  width = w;
+  height = h;
+
+  widths.clear();
+  heights.clear();
+  while (true)
+  {
+    widths.push_back(w);
+    heights.push_back(h);
+    if (w == 1 && h == 1)
+      break;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+  const int levels = int(widths.size());
+  maxima.assign(levels, std::vector<float>());
+  minima.assign(levels, std::vector<float>());
+  for (int l = 0; l < levels; l++)
+  {
+    maxima[l].assign(size_t(widths[l]) * heights[l], 1.0f);
+    // Both bounds are the same at the finest level
+    if (l > 0)
+      minima[l].assign(size_t(widths[l]) * heights[l], 1.0f);
+  }
+}
+
+/*!
+\brief Remove all occluders and set the view of the next frame.
+\param mvp Projection times view matrix, column major as returned by OpenGL.
+*/
+void OcclusionBuffer::Clear(const float* mvp)
+{
+  std::copy(mvp, mvp + 16, matrix);
+  setups.clear();
+  std::fill(maxima[0].begin(), maxima[0].end(), 1.0f);
+}
+
+/*!
+\brief Add an occluder.
+
+Triangles are clipped against the near plane and set up for rasterization, which is
+deferred to Build().
+\param vertices Coordinates of the three corners of every triangle, in object space.
+\param triangles Number of triangles.
+\param model Object to world matrix, column major, may be nullptr for the identity.
+*/
+void OcclusionBuffer::Add(const float* vertices, int triangles, const float* model)
+{
+  // Object to clip space
+  double m[16];
+  for (int c = 0; c < 4; c++)
+  {
+    for (int r = 0; r < 4; r++)
+    {
+      if (model == nullptr)
+        m[c * 4 + r] = matrix[c * 4 + r];
+      else
+        m[c * 4 + r] = matrix[r] * model[c * 4] + matrix[4 + r] * model[c * 4 + 1] + matrix[8 + r] * model[c * 4 + 2] + matrix[12 + r] * model[c * 4 + 3];
+    }
+  }
+
+  for (int t = 0; t < triangles; t++)
+  {
+    double p[3][4];
+    for (int i = 0; i < 3; i++)
+    {
+      const float* v = vertices + 9 * t + 3 * i;
+      for (int r = 0; r < 4; r++)
+        p[i][r] = m[r] * v[0] + m[4 + r] * v[1] + m[8 + r] * v[2] + m[12 + r];
+    }
+
+    // Clip against the near plane
+    double polygon[4][4];
+    int n = 0;
+    for (int i = 0; i < 3; i++)
+    {
+      const double* a = p[i];
+      const double* b = p[(i + 1) % 3];
+      const double da = a[2] + a[3];
+      const double db = b[2] + b[3];
+      if (da >= 0.0)
+        std::copy(a, a + 4, polygon[n++]);
+      if ((da >= 0.0) != (db >= 0.0))
+      {
+        const double u = da / (da - db);
+        for (int j = 0; j < 4; j++)
+          polygon[n][j] = a[j] + u * (b[j] - a[j]);
+        n++;
+      }
+    }
+
+    for (int i = 1; i + 1 < n; i++)
+    {
+      const double* v[3] = { polygon[0], polygon[i], polygon[i + 1] };
+      double x[3], y[3], z[3];
+      bool valid = true;
+      for (int j = 0; j < 3; j++)
+      {
+        if (v[j][3] <= 1e-9)
+        {
+          valid = false;
+          break;
+        }
+        const double w = 1.0 / v[j][3];
+        x[j] = (0.5 + 0.5 * v[j][0] * w) * width;
+        y[j] = (0.5 - 0.5 * v[j][1] * w) * height;
+        z[j] = 0.5 + 0.5 * v[j][2] * w;
+      }
+      if (!valid)
+        continue;
+
+      const double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+      if (fabs(area) < 1e-9)
+        continue;
+
+      Setup s;
+      s.x0 = std::max(0, int(floor(std::min(x[0], std::min(x[1], x[2])))));
+      s.y0 = std::max(0, int(floor(std::min(y[0], std::min(y[1], y[2])))));
+      s.x1 = std::min(width, int(ceil(std::max(x[0], std::max(x[1], x[2])))));
+      s.y1 = std::min(height, int(ceil(std::max(y[0], std::max(y[1], y[2])))));
+      if (s.x0 >= s.x1 || s.y0 >= s.y1)
+        continue;
+
+      // Barycentric coordinates, both orientations are rasterized
+      double dz[3] = { 0.0, 0.0, 0.0 };
+      for (int a = 0; a < 3; a++)
+      {
+        const int b = (a + 1) % 3;
+        const int c = (a + 2) % 3;
+        const double l[3] = { (y[b] - y[c]) / area, (x[c] - x[b]) / area, (x[b] * y[c] - x[c] * y[b]) / area };
+        for (int e = 0; e < 3; e++)
+        {
+          s.l[a][e] = float(l[e]);
+          dz[e] += l[e] * z[a];
+        }
+      }
+      for (int e = 0; e < 3; e++)
+        s.z[e] = float(dz[e]);
+      // Largest increase of the depth from the center to a corner of a pixel
+      s.dz = float(0.5 * (fabs(dz[0]) + fabs(dz[1])));
+      setups.push_back(s);
+    }
+  }
+}
+
+/*!
+\brief Rasterize the occluders and build the hierarchy.
+
+Bands of rows are rasterized by different threads.
+*/
+void OcclusionBuffer::Build()
+{
+  const int bands = (height + Band - 1) / Band;
+#pragma omp parallel for schedule(dynamic)
+  for (int b = 0; b < bands; b++)
+    RasterizeBand(b * Band, std::min(height, (b + 1) * Band));
+
+  // Hierarchy, texels are the bounds of their two by two children
+  for (int l = 1; l < int(widths.size()); l++)
+  {
+    const int w = widths[l - 1];
+    const int h = heights[l - 1];
+    const std::vector<float>& fmax = maxima[l - 1];
+    const std::vector<float>& fmin = (l == 1) ? maxima[0] : minima[l - 1];
+    std::vector<float>& cmax = maxima[l];
+    std::vector<float>& cmin = minima[l];
+#pragma omp parallel for schedule(static) if (widths[l] * heights[l] > 4096)
+    for (int y = 0; y < heights[l]; y++)
+    {
+      const int y0 = 2 * y;
+      const int y1 = std::min(2 * y + 1, h - 1);
+      for (int x = 0; x < widths[l]; x++)
+      {
+        const int x0 = 2 * x;
+        const int x1 = std::min(2 * x + 1, w - 1);
+        const size_t a = size_t(y0) * w + x0, b = size_t(y0) * w + x1, c = size_t(y1) * w + x0, d = size_t(y1) * w + x1;
+        const size_t i = size_t(y) * widths[l] + x;
+        cmax[i] = std::max(std::max(fmax[a], fmax[b]), std::max(fmax[c], fmax[d]));
+        cmin[i] = std::min(std::min(fmin[a], fmin[b]), std::min(fmin[c], fmin[d]));
+      }
+    }
+  }
+}
+
+/*!
+\brief Rasterize the occluders overlapping a band of rows of the finest level.
+\param by0, by1 Rows, upper bound excluded.
+*/
+void OcclusionBuffer::RasterizeBand(int by0, int by1)
+{
+  for (const Setup& s : setups)
+  {
+    const int y0 = std::max(s.y0, by0);
+    const int y1 = std::min(s.y1, by1);
+    for (int y = y0; y < y1; y++)
+    {
+      const float py = float(y) + 0.5f;
+      const float r0 = s.l[0][1] * py + s.l[0][2];
+      const float r1 = s.l[1][1] * py + s.l[1][2];
+      const float r2 = s.l[2][1] * py + s.l[2][2];
+      const float rz = s.z[1] * py + s.z[2] + s.dz;
+      float* row = &maxima[0][size_t(y) * width];
+
+      // Inside test and depth of a group of pixels, merged with the buffer without branches
+      for (int x = s.x0; x < s.x1; x += Lanes)
+      {
+        const int n = std::min(Lanes, s.x1 - x);
+        float* dst = row + x;
+#pragma omp simd
+        for (int k = 0; k < n; k++)
+        {
+          const float px = float(x + k) + 0.5f;
+          const float b0 = s.l[0][0] * px + r0;
+          const float b1 = s.l[1][0] * px + r1;
+          const float b2 = s.l[2][0] * px + r2;
+          const float d = s.z[0] * px + rz;
+          const bool inside = (b0 >= 0.0f) & (b1 >= 0.0f) & (b2 >= 0.0f);
+          dst[k] = inside ? std::min(dst[k], d) : dst[k];
+        }
+      }
+    }
+  }
+}
+
+/*!
+\brief Check if a box may be visible.
+\param a, b Lower and upper vertices of the box.
+*/
+bool OcclusionBuffer::IsVisible(const Vector& a, const Vector& b) const
+{
+  // Screen rectangle and nearest depth of the box
+  float x0 = float(width), y0 = float(height), x1 = 0.0f, y1 = 0.0f;
+  float zmin = 1.0f;
+  for (int i = 0; i < 8; i++)
+  {
+    const float p[3] = { float((i & 1) ? b[0] : a[0]), float((i & 2) ? b[1] : a[1]), float((i & 4) ? b[2] : a[2]) };
+    float q[4];
+    for (int r = 0; r < 4; r++)
+      q[r] = matrix[r] * p[0] + matrix[4 + r] * p[1] + matrix[8 + r] * p[2] + matrix[12 + r];
+
+    // Boxes crossing the near plane are visible
+    if (q[3] <= 1e-6f || q[2] < -q[3])
+      return true;
+    const float w = 1.0f / q[3];
+    const float x = (0.5f + 0.5f * q[0] * w) * width;
+    const float y = (0.5f - 0.5f * q[1] * w) * height;
+    x0 = std::min(x0, x);
+    x1 = std::max(x1, x);
+    y0 = std::min(y0, y);
+    y1 = std::max(y1, y);
+    zmin = std::min(zmin, 0.5f + 0.5f * q[2] * w);
+  }
+
+  // Pixels overlapped by the rectangle, boxes outside of the buffer are left to frustum culling
+  const int px0 = std::max(0, int(floor(x0)));
+  const int py0 = std::max(0, int(floor(y0)));
+  const int px1 = std::min(width, int(ceil(x1))) - 1;
+  const int py1 = std::min(height, int(ceil(y1))) - 1;
+  if (px0 > px1 || py0 > py1)
+    return true;
+
+  // Coarsest level where the rectangle spans at most two by two texels
+  const int levels = int(widths.size());
+  int level = 0;
+  while (level + 1 < levels && (((px1 >> level) - (px0 >> level)) > 1 || ((py1 >> level) - (py0 >> level)) > 1))
+    level++;
+
+  // Descend a few levels while the bounds cannot decide
+  for (int l = level; l >= std::max(0, level - 2); l--)
+  {
+    const std::vector<float>& fmax = maxima[l];
+    const std::vector<float>& fmin = (l == 0) ? maxima[0] : minima[l];
+    float farthest = 0.0f, nearest = 1.0f;
+    for (int y = py0 >> l; y <= (py1 >> l); y++)
+    {
+      for (int x = px0 >> l; x <= (px1 >> l); x++)
+      {
+        const size_t i = size_t(y) * widths[l] + x;
+        farthest = std::max(farthest, fmax[i]);
+        nearest = std::min(nearest, fmin[i]);
+      }
+    }
+    if (zmin > farthest)
+      return false;
+    if (zmin <= nearest)
+      return true;
+  }
+  return true;
+}
+
+/*!
+\brief Cull the boxes hidden by the occluders.
+
+Boxes are tested in parallel, boxes already culled are not tested again.
+\param boxes The boxes.
+\param visible Visibility flags of the boxes, set to 0 for the boxes found hidden.
+\return The number of boxes found hidden.
+*/
+int OcclusionBuffer::Cull(const BoxArray& boxes, std::vector<unsigned char>& visible) const
+{
+  const int n = boxes.Size();
+  int hidden = 0;
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:hidden)
+  for (int i = 0; i < n; i++)
+  {
+    if (!visible[i])
+      continue;
+    const Vector c(boxes.cx[i], boxes.cy[i], boxes.cz[i]);
+    const Vector e(boxes.ex[i], boxes.ey[i], boxes.ez[i]);
+    if (!IsVisible(c - e, c + e))
+    {
+      visible[i] = 0;
+      hidden++;
+    }
+  }
+  return hidden;
+}
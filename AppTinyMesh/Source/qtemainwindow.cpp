@@ -1,6 +1,8 @@
 #include "qte.h"
 #include "implicits.h"
+#include "trace.h"
 #include "ui_interface.h"
+#include <QtWidgets/QApplication>
 
 MainWindow::MainWindow() : QMainWindow(), uiw(new Ui::Assets)
 {
@@ -22,7 +24,13 @@ MainWindow::MainWindow() : QMainWindow(), uiw(new Ui::Assets)
 
 MainWindow::~MainWindow()
 {
+	// Running jobs must not post their results to a destroyed window
+	jobs.Cancel();
+	jobs.Wait();
+
 	delete meshWidget;
+	delete terrain;
+	delete heightField;
 }
 
 void MainWindow::CreateActions()
@@ -40,6 +48,7 @@ void MainWindow::CreateActions()
     connect(uiw->complexMesh, SIGNAL(clicked()), this, SLOT(ComplexMeshExample()));
 
     connect(uiw->sphereImplicit, SIGNAL(clicked()), this, SLOT(SphereImplicitExample()));
+    connect(uiw->heightField, SIGNAL(clicked()), this, SLOT(HeightFieldExample()));
     connect(uiw->resetcameraButton, SIGNAL(clicked()), this, SLOT(ResetCamera()));
     connect(uiw->wireframe, SIGNAL(clicked()), this, SLOT(UpdateMaterial()));
     connect(uiw->radioShadingButton_1, SIGNAL(clicked()), this, SLOT(UpdateMaterial()));
@@ -58,183 +67,302 @@ void MainWindow::editingSceneRight(const Ray&)
 {
 }
 
-void MainWindow::BoxMeshExample()
-{
-    auto start = std::chrono::high_resolution_clock::now();
-
-    Mesh mesh = Mesh(Box(1.0));
+/*!
+\brief Adapt the token of a generation job to the progress callback of the long computations.
 
-    mesh.RotateX(M_PI / 4);
+Progress is forwarded in whole percents, so that the interface is not flooded with updates,
+and the computation stops as soon as the job is cancelled.
+\param token Token of the job, which must outlive the callback.
+\param a, b Part of the job covered by the computation.
+*/
+static BuildProgress Reporter(const JobPool::Token& token, double a, double b)
+{
+    return [&token, a, b, last = -1](double p) mutable
+        {
+            const double q = a + (b - a) * p;
+            if (int(100.0 * q) != last)
+            {
+                last = int(100.0 * q);
+                token.Progress(q);
+            }
+            return !token.Cancelled();
+        };
+}
 
-    meshColor = MeshColor(mesh);
+void MainWindow::BoxMeshExample()
+{
+    Generate([](Generation& generation, const JobPool::Token&)
+        {
+            Mesh mesh = Mesh(Box(1.0));
 
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
+            mesh.RotateX(M_PI / 4);
 
-    UpdateGeometry();
+            generation.mesh = MeshColor(mesh);
+        });
 }
 
 // Added
 void MainWindow::DiscMeshExample()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    Mesh mesh = Mesh(Disc(2.0), 25);
-
-    meshColor = MeshColor(mesh);
-
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
+    Generate([](Generation& generation, const JobPool::Token&)
+        {
+            Mesh mesh = Mesh(Disc(2.0), 25);
 
-    UpdateGeometry();
+            generation.mesh = MeshColor(mesh);
+        });
 }
 
 void MainWindow::ConeMeshExample()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    Mesh mesh = Mesh(Cone(1.0, 3.0), 25);
-
-    meshColor = MeshColor(mesh);
-
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
+    Generate([](Generation& generation, const JobPool::Token&)
+        {
+            Mesh mesh = Mesh(Cone(1.0, 3.0), 25);
 
-    UpdateGeometry();
+            generation.mesh = MeshColor(mesh);
+        });
 }
 
 void MainWindow::CylinderMeshExample()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    Mesh mesh = Mesh(Cylinder(), 1000);
-
-    meshColor = MeshColor(mesh);
-
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
-
-    UpdateGeometry();
+    Generate([](Generation& generation, const JobPool::Token& token)
+        {
+            Mesh mesh = Mesh(Cylinder(), 1000);
+            if (token.Cancelled())
+                return;
+
+            generation.mesh = MeshColor(mesh);
+        });
 }
 
 void MainWindow::SphereMeshExample()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    Mesh mesh = Mesh(Sphere(), 1000);
-
-    meshColor = MeshColor(mesh);
-
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
-
-    UpdateGeometry();
+    Generate([](Generation& generation, const JobPool::Token& token)
+        {
+            // Conversion to colors is the last part of the job
+            Mesh mesh = Mesh(Sphere(), 1000, Reporter(token, 0.0, 0.9));
+            if (token.Cancelled())
+                return;
+
+            generation.mesh = MeshColor(mesh);
+        });
 }
 
 void MainWindow::ToreMeshExample()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    Mesh mesh = Mesh(Tore(), 1000);
-
-    meshColor = MeshColor(mesh);
-
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
-
-    UpdateGeometry();
+    Generate([](Generation& generation, const JobPool::Token& token)
+        {
+            // Conversion to colors is the last part of the job
+            Mesh mesh = Mesh(Tore(), 1000, Reporter(token, 0.0, 0.9));
+            if (token.Cancelled())
+                return;
+
+            generation.mesh = MeshColor(mesh);
+        });
 }
 
 void MainWindow::CapsuleMeshExample()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    Mesh mesh = Mesh(Capsule(), 1000);
-
-    meshColor = MeshColor(mesh);
-
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
-
-    UpdateGeometry();
+    Generate([](Generation& generation, const JobPool::Token& token)
+        {
+            // Conversion to colors is the last part of the job
+            Mesh mesh = Mesh(Capsule(), 1000, Reporter(token, 0.0, 0.9));
+            if (token.Cancelled())
+                return;
+
+            generation.mesh = MeshColor(mesh);
+        });
 }
 
 void MainWindow::ComplexMeshExample()
 {
-    // Time measure
-    auto start = std::chrono::high_resolution_clock::now();
-
-    // Mesh creation and transformation
-    Mesh mesh;
-    Mesh dice0 = Mesh(Sphere(Vector(0, 0, 0), 1), 100);
-
-    double r = 1.4;
-    double f = -2;
-
-    dice0.SphereWarp(Sphere(Vector(2, 0, 0), r), f);
-    dice0.SphereWarp(Sphere(Vector(-2, 0, 0), r), f);
-    dice0.SphereWarp(Sphere(Vector(0, 2, 0), r), f);
-    dice0.SphereWarp(Sphere(Vector(0, -2, 0), r), f);
-    dice0.SphereWarp(Sphere(Vector(0, 0, 2), r), f);
-    dice0.SphereWarp(Sphere(Vector(0, 0, -2), r), f);
-
-    Mesh dice1 = Mesh(dice0);
-    Mesh dice2 = Mesh(dice0);
-
-    dice0.Translate(Vector(0, -0.7, 0));
-
-    dice1.RotateZ(M_PI / 4);
-    dice1.Translate(Vector(1, 1, 0));
-
-    dice2.RotateX(M_PI / 4);
-    dice2.Translate(Vector(-1, 1, 0));
-
-
-    // Mesh assembly
-    mesh.Merge(dice0);
-    mesh.Merge(dice1);
-    mesh.Merge(dice2);
-
-    meshColor = MeshColor(mesh);
-
-    // Time measure
-    auto stop = std::chrono::high_resolution_clock::now();
-    double gen_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    uiw->lineEdit_gen_time->setText(QString::number(gen_time));
-
-    UpdateGeometry();
+    Generate([](Generation& generation, const JobPool::Token& token)
+        {
+            // Mesh creation, the three dice share the same geometry
+            Mesh dice = Mesh(Sphere(Vector(0, 0, 0), 1), 100);
+
+            double r = 1.4;
+            double f = -2;
+
+            const Vector centers[6] = { Vector(2, 0, 0), Vector(-2, 0, 0), Vector(0, 2, 0), Vector(0, -2, 0), Vector(0, 0, 2), Vector(0, 0, -2) };
+            for (int i = 0; i < 6; i++)
+            {
+                if (token.Cancelled())
+                    return;
+                dice.SphereWarp(Sphere(centers[i], r), f);
+                token.Progress((i + 1) / 7.0);
+            }
+
+            // Instances
+            generation.frames.push_back(MeshWidget::InstanceFrame(Vector(0, -0.7, 0)));
+            generation.frames.push_back(MeshWidget::InstanceFrame(Matrix::getRotationZ(M_PI / 4), Vector(1, 1, 0)));
+            generation.frames.push_back(MeshWidget::InstanceFrame(Matrix::getRotationX(M_PI / 4), Vector(-1, 1, 0)));
+
+            generation.mesh = MeshColor(dice);
+        });
 }
 
 void MainWindow::SphereImplicitExample()
 {
-  AnalyticScalarField implicit;
+    Generate([](Generation& generation, const JobPool::Token& token)
+        {
+            AnalyticScalarField implicit;
+
+            Mesh implicitMesh;
+            implicit.Polygonize(31, implicitMesh, Box(2.0), 1e-4, Reporter(token, 0.0, 0.9));
+            if (token.Cancelled())
+                return;
+
+            std::vector<Color> cols;
+            cols.resize(implicitMesh.Vertexes());
+            for (size_t i = 0; i < cols.size(); i++)
+                cols[i] = Color(0.8, 0.8, 0.8);
+
+            generation.mesh = MeshColor(implicitMesh, cols, implicitMesh.VertexIndexes());
+        });
+}
 
-  Mesh implicitMesh;
-  implicit.Polygonize(31, implicitMesh, Box(2.0));
+void MainWindow::HeightFieldExample()
+{
+    Generate([](Generation& generation, const JobPool::Token& token)
+        {
+            // Find the height map (depends on IDE: QtCreator or Visual Studio...)
+            std::unique_ptr<HeightField> field(new HeightField);
+            QImage image;
+            bool tiled = false;
+            QVector<QString> possiblePaths = { "./MyTinyMesh/AppTinyMesh/", "./AppTinyMesh/", "./", "../AppTinyMesh/" };
+            for (auto& path : possiblePaths)
+            {
+                // Terrains too large for memory are stored as tiles
+                if (field->load_tiles((path + "heightmap.hft").toStdString().c_str()))
+                {
+                    tiled = true;
+                    break;
+                }
+                if (image.load(path + "heightmap.png"))
+                    break;
+            }
+            if (!tiled && image.isNull())
+                return;
+
+            if (tiled)
+            {
+                // Relief is a fifth of the horizontal extent
+                field->set_scale(0.2 * field->SizeX() / 65535.0);
+            }
+            else
+            {
+                image = image.convertToFormat(QImage::Format_Grayscale16);
+                std::vector<int> points(size_t(image.width()) * image.height());
+                for (int j = 0; j < image.height(); j++)
+                {
+                    const quint16* line = reinterpret_cast<const quint16*>(image.constScanLine(j));
+                    for (int i = 0; i < image.width(); i++)
+                        points[size_t(j) * image.width() + i] = line[i];
+                }
+
+                // Relief is a fifth of the horizontal extent
+                *field = HeightField(image.width(), image.height(), points, 0.2 * image.width() / 65535.0);
+            }
+            if (token.Cancelled())
+                return;
+
+            // The level of detail refers to the height field, which is handed over with it
+            generation.terrain.reset(new HeightFieldLOD(*field));
+            generation.field = std::move(field);
+        });
+}
 
-  std::vector<Color> cols;
-  cols.resize(implicitMesh.Vertexes());
-  for (size_t i = 0; i < cols.size(); i++)
-    cols[i] = Color(0.8, 0.8, 0.8);
+/*!
+\brief Run a generation job in the background.
 
-  meshColor = MeshColor(implicitMesh, cols, implicitMesh.VertexIndexes());
-  UpdateGeometry();
+Jobs still queued or running are cancelled, so that rapid requests never pile up: only the
+result of the latest one reaches the viewer. Progress is displayed in the generation time field.
+\param generator Fills the generation, polling the token so as to return early once cancelled.
+*/
+void MainWindow::Generate(Generator&& generator)
+{
+    jobs.Cancel();
+    uiw->lineEdit_gen_time->setText("0%");
+
+    jobs.Submit([this, generator = std::move(generator)](const JobPool::Token& token)
+        {
+            TRACE_ZONE("MainWindow::Generate");
+            auto start = std::chrono::high_resolution_clock::now();
+
+            std::shared_ptr<Generation> generation = std::make_shared<Generation>();
+            generator(*generation, token);
+            if (token.Cancelled())
+                return;
+
+            auto stop = std::chrono::high_resolution_clock::now();
+            generation->time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+
+            // The result is shared with the interface thread, where it is moved to the viewer
+            const int ticket = token.Generation();
+            QMetaObject::invokeMethod(this, [this, ticket, generation] { Apply(ticket, std::move(*generation)); }, Qt::QueuedConnection);
+        },
+        [this](int ticket, double progress)
+        {
+            QMetaObject::invokeMethod(this, [this, ticket, progress]
+                {
+                    if (jobs.Current(ticket))
+                        uiw->lineEdit_gen_time->setText(QString::number(int(100.0 * progress)) + "%");
+                }, Qt::QueuedConnection);
+        });
 }
 
-void MainWindow::UpdateGeometry()
+/*!
+\brief Hand the result of a generation job over to the viewer.
+
+Results of jobs cancelled after they completed are discarded.
+\param ticket Generation of the job.
+\param generation Result.
+*/
+void MainWindow::Apply(int ticket, Generation&& generation)
 {
-	meshWidget->ClearAll();
-	meshWidget->AddMesh("BoxMesh", meshColor);
+    if (!jobs.Current(ticket))
+        return;
+    uiw->lineEdit_gen_time->setText(QString::number(generation.time));
+
+    if (generation.terrain)
+    {
+        // The previous terrain is released by the viewer before it is deleted
+        meshWidget->ClearAll();
+        delete terrain;
+        delete heightField;
+        heightField = generation.field.release();
+        terrain = generation.terrain.release();
+        meshWidget->SetTerrain(terrain);
+
+        Box box = heightField->GetBox();
+        meshWidget->SetCamera(Camera(box.Center() + Vector(-box.Diagonal()[0], -box.Diagonal()[1], 0.5 * box.Diagonal()[0]), box.Center()));
+    }
+    else if (!generation.frames.empty())
+    {
+        const int n = int(generation.frames.size());
+        uiw->lineEdit->setText(QString::number(generation.mesh.Vertexes() * n));
+        uiw->lineEdit_2->setText(QString::number(generation.mesh.Triangles() * n));
+
+        // The previous mesh is replaced in place, with the new instances
+        meshWidget->ClearTerrain();
+        meshWidget->UpdateInstancedGeometry("BoxMesh", std::move(generation.mesh), generation.frames);
+
+        UpdateMaterial();
+    }
+    else if (generation.mesh.Vertexes() > 0)
+        UpdateGeometry(std::move(generation.mesh));
+
+    emit _signalGenerated();
+}
+
+void MainWindow::UpdateGeometry(MeshColor&& mesh)
+{
+    uiw->lineEdit->setText(QString::number(mesh.Vertexes()));
+    uiw->lineEdit_2->setText(QString::number(mesh.Triangles()));
 
-    uiw->lineEdit->setText(QString::number(meshColor.Vertexes()));
-    uiw->lineEdit_2->setText(QString::number(meshColor.Triangles()));
+	// The previous mesh is replaced in place by a static upload, the mesh is moved to the viewer
+	meshWidget->ClearTerrain();
+	meshWidget->UpdateMeshGeometry("BoxMesh", std::move(mesh));
 
 	UpdateMaterial();
 }
@@ -249,6 +377,16 @@ void MainWindow::UpdateMaterial()
 		meshWidget->SetMaterialGlobal(MeshMaterial::Color);
 }
 
+bool MainWindow::Benchmark(const QString& scene, const CameraPath& path, int frames, const QString& file, int w, int h)
+{
+    // Scene is one of the examples, the benchmark starts once it is generated and the application exits once the statistics are written
+    if (!QMetaObject::invokeMethod(this, (scene + "Example").toLatin1().constData()))
+        return false;
+    connect(this, &MainWindow::_signalGenerated, this, [this, path, frames, file, w, h] { meshWidget->RunBenchmark(path, frames, file, w, h); }, Qt::SingleShotConnection);
+    connect(meshWidget, &MeshWidget::_signalBenchmarkDone, this, [](bool written) { QApplication::exit(written ? 0 : 1); });
+    return true;
+}
+
 void MainWindow::ResetCamera()
 {
 	meshWidget->SetCamera(Camera(Vector(-10.0), Vector(0.0)));
@@ -0,0 +1,384 @@
+// Rasterizer
+
+#include "rasterizer.h"
+#include "meshcolor.h"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+/*!
+\class Rasterizer rasterizer.h
+\brief Software rasterizer rendering meshes into an image without any graphics device.
+
+The rasterizer reproduces what MeshWidget draws for a given camera, with the same projection
+and the Normal and Color materials of the mesh shader, so that images can be rendered and
+compared on machines without a GPU. Sky and wireframe are not rendered.
+
+Triangles are transformed, clipped against the near plane and set up in parallel, then binned
+into tiles of TileSize pixels in submission order. Tiles are rasterized in parallel, every tile
+testing the barycentric coordinates of Lanes pixels at a time in a vectorized loop against its
+triangles, with a depth test. The result does not depend on the number of threads.
+
+\code
+Rasterizer rasterizer(1280, 720);
+rasterizer.SetCamera(Camera(Vector(-10.0), Vector(0.0)));
+rasterizer.Clear();
+rasterizer.Draw(mesh);
+rasterizer.SavePPM("mesh.ppm");
+\endcode
+*/
+
+/*!
+\brief Create an image, cleared to white.
+\param w, h Size of the image.
+*/
+Rasterizer::Rasterizer(int w, int h) : width(std::max(w, 1)), height(std::max(h, 1))
+{
+  pixels.resize(size_t(width) * height * 3);
+  depth.resize(size_t(width) * height);
+  bins.resize(size_t((width + TileSize - 1) / TileSize) * ((height + TileSize - 1) / TileSize));
+  Clear();
+  SetCamera(Camera(Vector(-10.0), Vector(0.0)));
+}
+
+/*!
+\brief Clear the image and the depth buffer.
+\param c Background color.
+*/
+void Rasterizer::Clear(const Color& c)
+{
+  unsigned char rgb[3];
+  for (int i = 0; i < 3; i++)
+    rgb[i] = (unsigned char)(Math::Clamp(c[i]) * 255.0 + 0.5);
+  for (size_t i = 0; i < depth.size(); i++)
+  {
+    pixels[3 * i + 0] = rgb[0];
+    pixels[3 * i + 1] = rgb[1];
+    pixels[3 * i + 2] = rgb[2];
+  }
+  std::fill(depth.begin(), depth.end(), 1.0f);
+}
+
+/*!
+\brief Set the camera, with the same perspective projection as MeshWidget.
+\param c Camera.
+*/
+void Rasterizer::SetCamera(const Camera& c)
+{
+  camera = c;
+
+  // Orthonormal frame, as computed by gluLookAt()
+  const Vector f = Normalized(camera.View());
+  const Vector s = Normalized(f / camera.Up());
+  const Vector u = s / f;
+  const Vector eye = camera.Eye();
+
+  const double fy = 1.0 / tan(0.5 * camera.GetAngleOfViewV(width, height));
+  const double fx = fy * double(height) / double(width);
+  const double n = camera.GetNear();
+  const double fa = camera.GetFar();
+  const double a = (fa + n) / (n - fa);
+  const double b = 2.0 * fa * n / (n - fa);
+
+  const Vector rows[4] = { fx * s, fy * u, -a * f, f };
+  const double offsets[4] = { -fx * (s * eye), -fy * (u * eye), a * (f * eye) + b, -(f * eye) };
+  for (int r = 0; r < 4; r++)
+  {
+    for (int k = 0; k < 3; k++)
+      viewProjection[4 * r + k] = float(rows[r][k]);
+    viewProjection[4 * r + 3] = float(offsets[r]);
+  }
+  for (int k = 0; k < 3; k++)
+    viewDir[k] = float(f[k]);
+}
+
+/*!
+\brief Draw a mesh, vertices have no color as in MeshWidget.
+\param mesh The mesh.
+\param material Material.
+\param position Translation of the mesh.
+*/
+void Rasterizer::Draw(const Mesh& mesh, Material material, const Vector& position)
+{
+  Render(mesh, nullptr, material, position);
+}
+
+/*!
+\brief Draw a colored mesh.
+\param mesh The mesh.
+\param material Material.
+\param position Translation of the mesh.
+*/
+void Rasterizer::Draw(const MeshColor& mesh, Material material, const Vector& position)
+{
+  Render(mesh, &mesh, material, position);
+}
+
+/*!
+\brief Transform, set up and bin the triangles of a mesh, then rasterize the tiles.
+\param mesh The mesh.
+\param colors Colors of the vertices, nullptr for black.
+\param material Material.
+\param position Translation of the mesh.
+*/
+void Rasterizer::Render(const Mesh& mesh, const MeshColor* colors, Material material, const Vector& position)
+{
+  const int n = mesh.Triangles();
+  std::vector<Setup> clipped(size_t(n) * 2);
+  std::vector<unsigned char> counts(n, 0);
+
+#pragma omp parallel for schedule(static)
+  for (int t = 0; t < n; t++)
+  {
+    ClipVertex v[3];
+    for (int k = 0; k < 3; k++)
+    {
+      const Vector p = mesh.Vertex(mesh.VertexIndex(t, k)) + position;
+      const Vector normal = Normalized(mesh.Normal(mesh.NormalIndex(t, k)));
+      const Color c = colors != nullptr ? colors->GetColor(colors->ColorIndex(t, k)) : Color(0.0);
+      for (int r = 0; r < 4; r++)
+        v[k].p[r] = float(viewProjection[4 * r] * p[0] + viewProjection[4 * r + 1] * p[1] + viewProjection[4 * r + 2] * p[2] + viewProjection[4 * r + 3]);
+      for (int j = 0; j < 3; j++)
+      {
+        v[k].n[j] = float(normal[j]);
+        v[k].c[j] = float(c[j]);
+      }
+    }
+
+    // Triangles entirely outside of a side or of the far plane
+    bool outside = false;
+    for (int j = 0; j < 3 && !outside; j++)
+    {
+      outside = (v[0].p[j] > v[0].p[3] && v[1].p[j] > v[1].p[3] && v[2].p[j] > v[2].p[3]) ||
+        (j < 2 && v[0].p[j] < -v[0].p[3] && v[1].p[j] < -v[1].p[3] && v[2].p[j] < -v[2].p[3]);
+    }
+    if (outside)
+      continue;
+
+    ClipVertex polygon[4];
+    const int m = Clip(v, 3, polygon);
+    for (int i = 1; i + 1 < m; i++)
+    {
+      if (SetupTriangle(polygon[0], polygon[i], polygon[i + 1], int(material), clipped[size_t(t) * 2 + counts[t]]))
+        counts[t]++;
+    }
+  }
+
+  // Compaction and binning keep the submission order, so that results are deterministic
+  setups.clear();
+  for (int t = 0; t < n; t++)
+  {
+    for (int i = 0; i < counts[t]; i++)
+      setups.push_back(clipped[size_t(t) * 2 + i]);
+  }
+  const int tx = (width + TileSize - 1) / TileSize;
+  const int ty = (height + TileSize - 1) / TileSize;
+  for (std::vector<int>& bin : bins)
+    bin.clear();
+  for (int i = 0; i < int(setups.size()); i++)
+  {
+    const Setup& s = setups[i];
+    for (int b = s.y0 / TileSize; b <= (s.y1 - 1) / TileSize; b++)
+    {
+      for (int a = s.x0 / TileSize; a <= (s.x1 - 1) / TileSize; a++)
+        bins[size_t(b) * tx + a].push_back(i);
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (int k = 0; k < tx * ty; k++)
+    RasterizeTile(k % tx, k / tx);
+}
+
+/*!
+\brief Clip a polygon against the near plane.
+\param v Vertices.
+\param n Number of vertices, 3 for a triangle.
+\param out Clipped polygon, with at most n + 1 vertices.
+\return Number of vertices of the clipped polygon, 0 if it is entirely behind the near plane.
+*/
+int Rasterizer::Clip(ClipVertex* v, int n, ClipVertex* out) const
+{
+  int m = 0;
+  for (int i = 0; i < n; i++)
+  {
+    const ClipVertex& a = v[i];
+    const ClipVertex& b = v[(i + 1) % n];
+    const float da = a.p[2] + a.p[3];
+    const float db = b.p[2] + b.p[3];
+    if (da >= 0.0f)
+      out[m++] = a;
+    if ((da >= 0.0f) != (db >= 0.0f))
+    {
+      const float t = da / (da - db);
+      ClipVertex& c = out[m++];
+      for (int j = 0; j < 4; j++)
+        c.p[j] = a.p[j] + t * (b.p[j] - a.p[j]);
+      for (int j = 0; j < 3; j++)
+      {
+        c.n[j] = a.n[j] + t * (b.n[j] - a.n[j]);
+        c.c[j] = a.c[j] + t * (b.c[j] - a.c[j]);
+      }
+    }
+  }
+  return m;
+}
+
+/*!
+\brief Project a triangle and compute the linear functions interpolated over its pixels.
+\param a, b, c Vertices, in front of the near plane.
+\param material Material.
+\param s Set up triangle.
+\return false if the triangle is degenerate or covers no pixel.
+*/
+bool Rasterizer::SetupTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, int material, Setup& s) const
+{
+  const ClipVertex* v[3] = { &a, &b, &c };
+  double x[3], y[3], z[3];
+  for (int i = 0; i < 3; i++)
+  {
+    const double w = 1.0 / v[i]->p[3];
+    x[i] = (0.5 + 0.5 * v[i]->p[0] * w) * width;
+    y[i] = (0.5 - 0.5 * v[i]->p[1] * w) * height;
+    z[i] = 0.5 + 0.5 * v[i]->p[2] * w;
+    s.w[i] = float(w);
+    for (int j = 0; j < 3; j++)
+    {
+      s.n[i][j] = v[i]->n[j];
+      s.c[i][j] = v[i]->c[j];
+    }
+  }
+
+  const double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (fabs(area) < 1e-12)
+    return false;
+
+  s.x0 = std::max(0, int(floor(std::min(x[0], std::min(x[1], x[2])))));
+  s.y0 = std::max(0, int(floor(std::min(y[0], std::min(y[1], y[2])))));
+  s.x1 = std::min(width, int(ceil(std::max(x[0], std::max(x[1], x[2])))));
+  s.y1 = std::min(height, int(ceil(std::max(y[0], std::max(y[1], y[2])))));
+  if (s.x0 >= s.x1 || s.y0 >= s.y1)
+    return false;
+
+  // Barycentric coordinate of every vertex, the edge function of the opposite edge scaled by the area
+  double dz[3] = { 0.0, 0.0, 0.0 };
+  for (int i = 0; i < 3; i++)
+  {
+    const int j = (i + 1) % 3;
+    const int k = (i + 2) % 3;
+    const double l[3] = { (y[j] - y[k]) / area, (x[k] - x[j]) / area, (x[j] * y[k] - x[k] * y[j]) / area };
+    for (int e = 0; e < 3; e++)
+    {
+      s.l[i][e] = float(l[e]);
+      dz[e] += l[e] * z[i];
+    }
+  }
+  for (int e = 0; e < 3; e++)
+    s.z[e] = float(dz[e]);
+  s.material = material;
+  return true;
+}
+
+/*!
+\brief Rasterize the triangles binned in a tile.
+\param tx, ty Tile.
+*/
+void Rasterizer::RasterizeTile(int tx, int ty)
+{
+  const std::vector<int>& bin = bins[size_t(ty) * ((width + TileSize - 1) / TileSize) + tx];
+  const int bx0 = tx * TileSize;
+  const int by0 = ty * TileSize;
+  const int bx1 = std::min(width, bx0 + TileSize);
+  const int by1 = std::min(height, by0 + TileSize);
+
+  for (int index : bin)
+  {
+    const Setup& s = setups[index];
+    const int x0 = std::max(s.x0, bx0);
+    const int x1 = std::min(s.x1, bx1);
+    const int y0 = std::max(s.y0, by0);
+    const int y1 = std::min(s.y1, by1);
+
+    for (int y = y0; y < y1; y++)
+    {
+      const float py = float(y) + 0.5f;
+      const float r0 = s.l[0][1] * py + s.l[0][2];
+      const float r1 = s.l[1][1] * py + s.l[1][2];
+      const float r2 = s.l[2][1] * py + s.l[2][2];
+      const float rz = s.z[1] * py + s.z[2];
+      float* row = &depth[size_t(y) * width];
+
+      for (int x = x0; x < x1; x += Lanes)
+      {
+        float b0[Lanes], b1[Lanes], b2[Lanes], d[Lanes];
+        int inside[Lanes];
+
+        // Edge and depth tests of a group of pixels
+#pragma omp simd
+        for (int k = 0; k < Lanes; k++)
+        {
+          const float px = float(x + k) + 0.5f;
+          b0[k] = s.l[0][0] * px + r0;
+          b1[k] = s.l[1][0] * px + r1;
+          b2[k] = s.l[2][0] * px + r2;
+          d[k] = s.z[0] * px + rz;
+          inside[k] = (b0[k] >= 0.0f) & (b1[k] >= 0.0f) & (b2[k] >= 0.0f) & (d[k] >= 0.0f) & (d[k] <= 1.0f) & (x + k < x1);
+        }
+
+        for (int k = 0; k < Lanes; k++)
+        {
+          if (!inside[k] || d[k] > row[x + k])
+            continue;
+          row[x + k] = d[k];
+
+          // Perspective correct interpolation
+          float q[3] = { b0[k] * s.w[0], b1[k] * s.w[1], b2[k] * s.w[2] };
+          const float sum = q[0] + q[1] + q[2];
+          q[0] /= sum;
+          q[1] /= sum;
+          q[2] /= sum;
+          float n[3], c[3];
+          for (int j = 0; j < 3; j++)
+          {
+            n[j] = q[0] * s.n[0][j] + q[1] * s.n[1][j] + q[2] * s.n[2][j];
+            c[j] = q[0] * s.c[0][j] + q[1] * s.c[1][j] + q[2] * s.c[2][j];
+          }
+
+          // Materials of the mesh shader
+          float rgb[3];
+          if (s.material == int(Material::Normal))
+          {
+            for (int j = 0; j < 3; j++)
+              rgb[j] = 0.2f * (3.0f + 2.0f * n[j]);
+          }
+          else
+          {
+            const float l = 0.5f * (1.0f - (n[0] * viewDir[0] + n[1] * viewDir[1] + n[2] * viewDir[2]));
+            const float diffuse = std::min(std::max(0.25f + l * l, 0.0f), 1.0f);
+            for (int j = 0; j < 3; j++)
+              rgb[j] = c[j] * diffuse;
+          }
+          unsigned char* pixel = &pixels[(size_t(y) * width + x + k) * 3];
+          for (int j = 0; j < 3; j++)
+            pixel[j] = (unsigned char)(std::min(std::max(rgb[j], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+      }
+    }
+  }
+}
+
+/*!
+\brief Save the image in the binary PPM format.
+\param name File name.
+*/
+bool Rasterizer::SavePPM(const char* name) const
+{
+  FILE* f = fopen(name, "wb");
+  if (f == nullptr)
+    return false;
+  fprintf(f, "P6\n%d %d\n255\n", width, height);
+  const bool ok = fwrite(pixels.data(), 1, pixels.size(), f) == pixels.size();
+  fclose(f);
+  return ok;
+}
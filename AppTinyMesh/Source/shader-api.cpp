@@ -5,6 +5,10 @@
 #include <algorithm>
 #include <iostream>
 #include <climits>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
 
 #include "realtime.h"
 
@@ -125,6 +129,138 @@ GLenum shader_types[] =
 #endif
 };
 
+// cache des binaires des programs linkes, desactive tant que le repertoire n'est pas defini
+static
+std::string cache_directory;
+
+void program_cache_directory(const char* directory)
+{
+  cache_directory = directory ? directory : "";
+  if (cache_directory.empty() == false)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(cache_directory, error);
+  }
+}
+
+// entete des fichiers du cache, suivie du binaire
+struct program_binary_header
+{
+  char magic[4];        // "TMPB"
+  uint64_t key;         // cle du program, verifiee en plus du nom du fichier
+  GLenum format;        // format du binaire, propre au driver
+  GLint length;         // taille du binaire
+  double compile_time;  // duree de la compilation depuis les sources, en ms
+};
+
+// hash fnv-1a 64 bits
+static
+uint64_t hash_string(uint64_t h, const std::string& string)
+{
+  for (unsigned char c : string)
+  {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static
+std::string driver_string()
+{
+  std::string driver;
+  const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+  for (GLenum name : names)
+  {
+    const GLubyte* string = glGetString(name);
+    if (string != nullptr)
+      driver.append((const char*)string);
+    driver.push_back('\n');
+  }
+  return driver;
+}
+
+static
+bool program_binary_supported()
+{
+  if (cache_directory.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+    return false;
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+static
+std::string cache_filename(const uint64_t key)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+  return (std::filesystem::path(cache_directory) / name).string();
+}
+
+// charge le binaire d'un program depuis le cache, renvoie false si le binaire n'existe pas ou si le driver le refuse
+static
+bool load_program_binary(const GLuint program, const uint64_t key, const char* filename)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  std::ifstream in(cache_filename(key), std::ios::binary);
+  if (in.good() == false)
+    return false;
+
+  program_binary_header header;
+  in.read((char*)&header, sizeof(header));
+  if (!in || memcmp(header.magic, "TMPB", 4) != 0 || header.key != key || header.length <= 0)
+    return false;
+  std::vector<char> binary(header.length);
+  in.read(binary.data(), header.length);
+  if (!in)
+    return false;
+
+  glProgramBinary(program, header.format, binary.data(), header.length);
+  GLint status;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status == GL_FALSE)
+  {
+    std::cout << "[cache] binary of program " << filename << " rejected by the driver, compiling" << std::endl;
+    return false;
+  }
+
+  auto stop = std::chrono::high_resolution_clock::now();
+  const double time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0;
+  std::cout << "loading program " << filename << " from cache in " << time << "ms, " << header.compile_time - time << "ms saved" << std::endl;
+  return true;
+}
+
+// ecrit le binaire d'un program linke dans le cache
+static
+void save_program_binary(const GLuint program, const uint64_t key, const double compile_time)
+{
+  program_binary_header header;
+  memcpy(header.magic, "TMPB", 4);
+  header.key = key;
+  header.format = 0;
+  header.length = 0;
+  header.compile_time = compile_time;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+  if (header.length <= 0)
+    return;
+  std::vector<char> binary(header.length);
+  glGetProgramBinary(program, header.length, &header.length, &header.format, binary.data());
+
+  // fichier temporaire renomme une fois ecrit, pour ne jamais laisser de binaire tronque
+  const std::string name = cache_filename(key);
+  const std::string temporary = name + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write((const char*)&header, sizeof(header));
+    out.write(binary.data(), header.length);
+    if (!out)
+      return;
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary, name, error);
+}
+
 static
 GLuint compile_shader(const GLuint program, const GLenum shader_type, const std::string& source)
 {
@@ -144,11 +280,13 @@ GLuint compile_shader(const GLuint program, const GLenum shader_type, const std:
 }
 
 
-int reload_program(GLuint program, const char* filename, const char* definitions)
+int reload_program(GLuint program, const char* filename, const char* definitions, const char* const* attributes)
 {
   if (program == 0)
     return -1;
 
+  auto start = std::chrono::high_resolution_clock::now();
+
   // supprime les shaders attaches au program
   int shaders_max = 0;
   glGetProgramiv(program, GL_ATTACHED_SHADERS, &shaders_max);
@@ -167,21 +305,50 @@ int reload_program(GLuint program, const char* filename, const char* definitions
   glObjectLabel(GL_PROGRAM, program, -1, filename);
 #endif
 
-  // prepare les sources
+  // prepare les sources des shaders detectes dans le source
   std::string common_source = read(filename);
+  std::string sources[shader_keys_max];
   for (int i = 0; i < shader_keys_max; i++)
   {
     if (common_source.find(shader_keys[i]) != std::string::npos)
+      sources[i] = prepare_source(common_source, std::string(definitions).append("#define ").append(shader_keys[i]).append("\n"));
+  }
+
+  // cle du cache : sources des shaders, attributs et driver
+  const bool cached = program_binary_supported();
+  uint64_t key = 14695981039346656037ull;
+  if (cached)
+  {
+    for (int i = 0; i < shader_keys_max; i++)
+      key = hash_string(hash_string(key, sources[i]), "\n");
+    for (int i = 0; attributes != nullptr && attributes[i] != nullptr; i++)
+      key = hash_string(hash_string(key, attributes[i]), "\n");
+    key = hash_string(key, driver_string());
+
+    if (load_program_binary(program, key, filename))
     {
-      // cree et compile les shaders detectes dans le source
-      std::string source = prepare_source(common_source, std::string(definitions).append("#define ").append(shader_keys[i]).append("\n"));
-      GLuint shader = compile_shader(program, shader_types[i], source);
-      if (shader == 0)
-        std::cout << "[error] compiling " << shader_string(shader_types[i]) << " " << definitions;
+      glUseProgram(program);
+      return 0;
     }
   }
 
+  // cree et compile les shaders
+  for (int i = 0; i < shader_keys_max; i++)
+  {
+    if (sources[i].empty())
+      continue;
+    GLuint shader = compile_shader(program, shader_types[i], sources[i]);
+    if (shader == 0)
+      std::cout << "[error] compiling " << shader_string(shader_types[i]) << " " << definitions;
+  }
+
+  // les attributs sont associes aux locations 0, 1, 2... avant le link
+  for (int i = 0; attributes != nullptr && attributes[i] != nullptr; i++)
+    glBindAttribLocation(program, i, attributes[i]);
+
   // linke les shaders
+  if (cached)
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(program);
 
   // verifie les erreurs
@@ -193,15 +360,21 @@ int reload_program(GLuint program, const char* filename, const char* definitions
     return -1;
   }
 
+  if (cached)
+  {
+    auto stop = std::chrono::high_resolution_clock::now();
+    save_program_binary(program, key, std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0);
+  }
+
   // pour etre coherent avec les autres fonctions de creation, active l'objet gl qui vient d'etre cree.
   glUseProgram(program);
   return 0;
 }
 
-GLuint read_program(const char* filename, const char* definitions)
+GLuint read_program(const char* filename, const char* definitions, const char* const* attributes)
 {
   GLuint program = glCreateProgram();
-  reload_program(program, filename, definitions);
+  reload_program(program, filename, definitions, attributes);
   program_print_errors(program);
   return program;
 }
@@ -0,0 +1,187 @@
+// Tracing
+
+#include "trace.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Trace::recording{ false };
+
+namespace
+{
+  //! Zone, as recorded.
+  struct Event
+  {
+    const char* name; //!< Name.
+    int64_t start;    //!< Start time, in nanoseconds.
+    int64_t stop;     //!< End time, in nanoseconds.
+  };
+
+  //! Fixed size block of events, filled by a single thread and read concurrently.
+  struct Chunk
+  {
+    static const int Size = 4096;
+    Event events[Size];                   //!< Events.
+    std::atomic<int> count{ 0 };          //!< Number of events written.
+    std::atomic<Chunk*> next{ nullptr };  //!< Next chunk of the thread.
+  };
+
+  //! Events of a thread, a list of chunks.
+  struct Buffer
+  {
+    int thread;                           //!< Thread number, in order of the first zone.
+    std::string name;                     //!< Thread name, guarded by the registry mutex.
+    Chunk* first;                         //!< First chunk.
+    Chunk* last;                          //!< Chunk being filled, only used by the thread.
+
+    explicit Buffer(int t) : thread(t), first(new Chunk), last(first) {}
+    ~Buffer()
+    {
+      for (Chunk* c = first; c != nullptr;)
+      {
+        Chunk* n = c->next.load(std::memory_order_relaxed);
+        delete c;
+        c = n;
+      }
+    }
+  };
+
+  //! Buffers of all the threads, kept after their thread ends.
+  struct Registry
+  {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Buffer>> buffers;
+  };
+
+  Registry& GetRegistry()
+  {
+    static Registry registry;
+    return registry;
+  }
+
+  //! Buffer of the calling thread, registered on first use.
+  Buffer& GetBuffer()
+  {
+    thread_local std::shared_ptr<Buffer> buffer = []
+      {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.buffers.push_back(std::make_shared<Buffer>(int(registry.buffers.size()) + 1));
+        return registry.buffers.back();
+      }();
+    return *buffer;
+  }
+}
+
+/*!
+\brief Start recording zones.
+*/
+void Trace::Start()
+{
+  Now();
+  recording.store(true, std::memory_order_relaxed);
+}
+
+/*!
+\brief Stop recording zones, recorded zones are kept.
+*/
+void Trace::Stop()
+{
+  recording.store(false, std::memory_order_relaxed);
+}
+
+/*!
+\brief Name the calling thread in the trace.
+\param name Name.
+*/
+void Trace::SetThreadName(const std::string& name)
+{
+  Buffer& buffer = GetBuffer();
+  std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+  buffer.name = name;
+}
+
+/*!
+\brief Append a zone to the buffer of the calling thread.
+
+Only the calling thread writes to its buffer, and an event is published by incrementing the
+count of its chunk, so that the trace may be saved while other threads keep recording.
+\param name Name of the zone.
+\param start, stop Start and end times, in nanoseconds.
+*/
+void Trace::Record(const char* name, int64_t start, int64_t stop)
+{
+  Buffer& buffer = GetBuffer();
+  Chunk* chunk = buffer.last;
+  int n = chunk->count.load(std::memory_order_relaxed);
+  if (n == Chunk::Size)
+  {
+    Chunk* next = new Chunk;
+    chunk->next.store(next, std::memory_order_release);
+    buffer.last = chunk = next;
+    n = 0;
+  }
+  chunk->events[n] = { name, start, stop };
+  chunk->count.store(n + 1, std::memory_order_release);
+}
+
+/*!
+\brief Save the recorded zones in the Chrome trace event format.
+
+Zones are complete events, grouped by thread.
+\param file File name.
+\return false if the file could not be written.
+*/
+bool Trace::Save(const std::string& file)
+{
+  FILE* out = fopen(file.c_str(), "w");
+  if (out == nullptr)
+    return false;
+
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  for (const std::shared_ptr<Buffer>& buffer : registry.buffers)
+  {
+    const std::string name = buffer->name.empty() ? "Thread " + std::to_string(buffer->thread) : buffer->name;
+    fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buffer->thread, name.c_str());
+    first = false;
+    for (Chunk* chunk = buffer->first; chunk != nullptr; chunk = chunk->next.load(std::memory_order_acquire))
+    {
+      const int n = chunk->count.load(std::memory_order_acquire);
+      for (int i = 0; i < n; i++)
+      {
+        const Event& e = chunk->events[i];
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"tinymesh\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", e.name, buffer->thread, e.start / 1000.0, (e.stop - e.start) / 1000.0);
+      }
+    }
+  }
+  fprintf(out, "\n]}\n");
+  return fclose(out) == 0;
+}
+
+/*!
+\brief Discard the recorded zones.
+
+Must not be called while other threads record zones.
+*/
+void Trace::Clear()
+{
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const std::shared_ptr<Buffer>& buffer : registry.buffers)
+  {
+    for (Chunk* c = buffer->first->next.load(std::memory_order_relaxed); c != nullptr;)
+    {
+      Chunk* n = c->next.load(std::memory_order_relaxed);
+      delete c;
+      c = n;
+    }
+    buffer->first->next.store(nullptr, std::memory_order_relaxed);
+    buffer->first->count.store(0, std::memory_order_relaxed);
+    buffer->last = buffer->first;
+  }
+}
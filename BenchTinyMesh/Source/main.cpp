@@ -0,0 +1,400 @@
+// Microbenchmarks of the core library, reported as JSON
+
+#include "mesh.h"
+#include "implicits.h"
+#include "rasterizer.h"
+#include "height_field_erosion.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Allocations are counted by replacing the global allocation functions
+static std::atomic<long long> allocations{ 0 };  //!< Number of allocations.
+static std::atomic<long long> allocated{ 0 };    //!< Number of bytes allocated.
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+// GCC pairs the inlined free() with the replaced operator new and reports a mismatch
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+// Other forms forward to the replaced pair, so that every pointer is released by the
+// deallocation function matching its allocation function
+void operator delete[](void* p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+/*!
+\brief Benchmark case.
+
+An iteration returns the number of items it processed, such as triangles or intersection tests,
+from which the throughput is computed. Inputs are built by the reset function, which is called
+before every iteration and is neither timed nor counted in the allocations, so that listing or
+filtering the cases does not build them.
+*/
+struct Case
+{
+    std::string name;                         //!< Name, with its parameters.
+    std::string unit;                         //!< Items processed by an iteration.
+    std::function<void()> reset;              //!< Prepare the inputs of an iteration.
+    std::function<long long()> iteration;     //!< Run one iteration.
+};
+
+//! Sphere built on first use, shared by several cases.
+class LazySphere
+{
+protected:
+    int n;                                    //!< Subdivisions.
+    std::unique_ptr<Mesh> mesh;               //!< Mesh, once built.
+public:
+    explicit LazySphere(int n) : n(n) {}
+
+    /*!
+    \brief Return the mesh, building it on the first call.
+    */
+    const Mesh& Get()
+    {
+        if (!mesh)
+            mesh = std::make_unique<Mesh>(Sphere(1.0), n);
+        return *mesh;
+    }
+};
+
+//! Sphere saved to a temporary file on first use. The file, and its copy written by SaveObj, are removed with the object.
+class SphereFile
+{
+protected:
+    std::shared_ptr<LazySphere> sphere;       //!< Sphere.
+    std::string file;                         //!< File name, unique to the process.
+    long long bytes = -1;                     //!< Size of the file, negative until it is written.
+public:
+    SphereFile(const std::shared_ptr<LazySphere>& sphere, const std::string& file) : sphere(sphere), file(file) {}
+    SphereFile(const SphereFile&) = delete;
+    SphereFile& operator=(const SphereFile&) = delete;
+    ~SphereFile()
+    {
+        std::error_code error;
+        std::filesystem::remove(file, error);
+        std::filesystem::remove(Copy(), error);
+    }
+
+    /*!
+    \brief Write the file if it has not been written yet.
+    */
+    void Write()
+    {
+        if (bytes >= 0)
+            return;
+        sphere->Get().SaveObj(file, "Sphere");
+        std::error_code error;
+        bytes = (long long)std::filesystem::file_size(file, error);
+    }
+
+    const std::string& Path() const { return file; }
+    std::string Copy() const { return file + ".out"; }
+    long long Bytes() const { return bytes; }
+};
+
+//! Measures of a case.
+struct Result
+{
+    long long iterations = 0;                 //!< Number of timed iterations.
+    double time = 0.0;                        //!< Time per iteration, in nanoseconds.
+    double throughput = 0.0;                  //!< Items per second.
+    double allocations = 0.0;                 //!< Allocations per iteration.
+    double bytes = 0.0;                       //!< Bytes allocated per iteration.
+};
+
+/*!
+\brief Run a case until the minimum time is reached, after one untimed iteration.
+\param c Case.
+\param minimum Minimum time, in seconds.
+*/
+static Result Run(const Case& c, double minimum)
+{
+    if (c.reset)
+        c.reset();
+    c.iteration();
+
+    Result result;
+    long long items = 0;
+    long long a = allocations.load();
+    long long b = allocated.load();
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do
+    {
+        if (c.reset)
+        {
+            // The clock and the counters skip the reset
+            const long long ra = allocations.load();
+            const long long rb = allocated.load();
+            const auto pause = std::chrono::steady_clock::now();
+            c.reset();
+            start += std::chrono::steady_clock::now() - pause;
+            a += allocations.load() - ra;
+            b += allocated.load() - rb;
+        }
+        items += c.iteration();
+        result.iterations++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minimum);
+
+    result.time = 1e9 * elapsed / double(result.iterations);
+    result.throughput = double(items) / elapsed;
+    result.allocations = double(allocations.load() - a) / double(result.iterations);
+    result.bytes = double(allocated.load() - b) / double(result.iterations);
+    return result;
+}
+
+/*!
+\brief Create the cases, their inputs being built when they are run.
+\param prefix Path and file name prefix of the temporary files, unique to the process.
+*/
+static std::vector<Case> Cases(const std::string& prefix)
+{
+    std::vector<Case> cases;
+
+    // Primitive constructors
+    for (int n : { 16, 128, 1024 })
+    {
+        const std::string p = "/n=" + std::to_string(n);
+        cases.push_back({ "Mesh(Disc)" + p, "triangles", {}, [n] { return (long long)Mesh(Disc(1.0), n).Triangles(); } });
+        cases.push_back({ "Mesh(Cone)" + p, "triangles", {}, [n] { return (long long)Mesh(Cone(1.0, 2.0), n).Triangles(); } });
+        cases.push_back({ "Mesh(Cylinder)" + p, "triangles", {}, [n] { return (long long)Mesh(Cylinder(1.0, 2.0), n).Triangles(); } });
+        cases.push_back({ "Mesh(Sphere)" + p, "triangles", {}, [n] { return (long long)Mesh(Sphere(1.0), n).Triangles(); } });
+        cases.push_back({ "Mesh(Tore)" + p, "triangles", {}, [n] { return (long long)Mesh(Tore(0.5, 2.0), n).Triangles(); } });
+        cases.push_back({ "Mesh(Capsule)" + p, "triangles", {}, [n] { return (long long)Mesh(Capsule(1.0, 2.0), n).Triangles(); } });
+    }
+    cases.push_back({ "Mesh(Box)", "triangles", {}, [] { return (long long)Mesh(Box(1.0)).Triangles(); } });
+
+    // Operations on an existing mesh, every case works on its own copy restored before every iteration
+    for (int n : { 64, 512 })
+    {
+        const std::string p = "/n=" + std::to_string(n);
+        std::shared_ptr<LazySphere> sphere = std::make_shared<LazySphere>(n);
+        auto operation = [&cases, &p, sphere](const std::string& name, const std::string& unit, const std::function<long long(Mesh&)>& f)
+            {
+                std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+                cases.push_back({ name + p, unit, [sphere, mesh] { *mesh = sphere->Get(); }, [mesh, f] { return f(*mesh); } });
+            };
+        operation("SmoothNormals", "triangles", [](Mesh& mesh) { mesh.SmoothNormals(); return (long long)mesh.Triangles(); });
+        operation("Merge", "triangles", [](Mesh& mesh) { Mesh m = mesh; m.Merge(mesh); return (long long)m.Triangles(); });
+        operation("SphereWarp", "vertices", [](Mesh& mesh) { mesh.SphereWarp(Sphere(Vector(1.0, 0.0, 0.0), 0.5), 0.01); return (long long)mesh.Vertexes(); });
+        operation("RotateZ", "vertices", [](Mesh& mesh) { mesh.RotateZ(0.01); return (long long)mesh.Vertexes(); });
+        operation("Translate", "vertices", [](Mesh& mesh) { mesh.Translate(Vector(0.001)); return (long long)mesh.Vertexes(); });
+    }
+
+    // Polygonization
+    for (int n : { 16, 32, 64, 128 })
+    {
+        cases.push_back({ "Polygonize/n=" + std::to_string(n), "cells", {}, [n]
+            {
+                Mesh mesh;
+                AnalyticScalarField().Polygonize(n, mesh, Box(2.0));
+                return (long long)n * n * n;
+            } });
+    }
+
+    // Files, written once on first use so that loading does not depend on saving
+    for (int n : { 16, 128, 512 })
+    {
+        const std::string p = "/n=" + std::to_string(n);
+        std::shared_ptr<LazySphere> sphere = std::make_shared<LazySphere>(n);
+        std::shared_ptr<SphereFile> file = std::make_shared<SphereFile>(sphere, prefix + std::to_string(n) + ".obj");
+        cases.push_back({ "SaveObj" + p, "bytes", [file] { file->Write(); }, [sphere, file] { sphere->Get().SaveObj(file->Copy(), "Sphere"); return file->Bytes(); } });
+        cases.push_back({ "Load" + p, "bytes", [file] { file->Write(); }, [file] { Mesh m; m.Load(file->Path()); return file->Bytes(); } });
+    }
+
+    // Ray triangle intersections, every ray against every triangle of a sphere
+    {
+        std::shared_ptr<std::vector<Triangle>> triangles = std::make_shared<std::vector<Triangle>>();
+        std::shared_ptr<std::vector<Ray>> rays = std::make_shared<std::vector<Ray>>();
+        auto reset = [triangles, rays]
+            {
+                if (!triangles->empty())
+                    return;
+                Mesh sphere(Sphere(1.0), 64);
+                for (int i = 0; i < sphere.Triangles(); i++)
+                    triangles->push_back(sphere.GetTriangle(i));
+                std::mt19937 random(1);
+                std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+                for (int i = 0; i < 128; i++)
+                {
+                    const Vector o(uniform(random) * 3.0, uniform(random) * 3.0, 3.0);
+                    rays->push_back(Ray(o, Normalized(Vector(uniform(random) * 0.3, uniform(random) * 0.3, -1.0))));
+                }
+            };
+        cases.push_back({ "Triangle::Intersect", "tests", reset, [triangles, rays]
+            {
+                long long hits = 0;
+                double t, u, v;
+                for (const Ray& ray : *rays)
+                    for (const Triangle& triangle : *triangles)
+                        hits += triangle.Intersect(ray, t, u, v);
+                // Keeps the loop from being optimized away
+                if (hits < 0)
+                    printf("%lld\n", hits);
+                return (long long)(rays->size() * triangles->size());
+            } });
+    }
+
+    // Software rasterization of a sphere filling most of a 720p image
+    for (int n : { 64, 512 })
+    {
+        std::shared_ptr<LazySphere> sphere = std::make_shared<LazySphere>(n);
+        cases.push_back({ "Rasterizer/n=" + std::to_string(n), "triangles", [sphere] { sphere->Get(); }, [sphere]
+            {
+                Camera camera(Vector(0.0, -3.0, 0.0), Vector::Null);
+                camera.SetPlanes(0.1, 10.0);
+                Rasterizer rasterizer(1280, 720);
+                rasterizer.SetCamera(camera);
+                rasterizer.Clear();
+                rasterizer.Draw(sphere->Get());
+                return (long long)sphere->Get().Triangles();
+            } });
+    }
+
+    // Erosion of a 2048 x 2048 terrain, one erosion iteration per case iteration from the original terrain
+    {
+        const int n = 2048;
+        std::shared_ptr<HeightField> field = std::make_shared<HeightField>();
+        std::shared_ptr<std::unique_ptr<HeightFieldErosion>> erosion = std::make_shared<std::unique_ptr<HeightFieldErosion>>();
+        auto reset = [field, erosion]
+            {
+                if (field->SizeX() == 0)
+                {
+                    std::vector<int> samples(size_t(n) * n);
+                    for (int j = 0; j < n; j++)
+                        for (int i = 0; i < n; i++)
+                            samples[size_t(j) * n + i] = int(127.0 + 100.0 * sin(i * 0.02) * cos(j * 0.017) + 20.0 * sin(i * 0.3 + j * 0.2));
+                    *field = HeightField(n, n, samples);
+                }
+                *erosion = std::make_unique<HeightFieldErosion>(*field);
+            };
+        cases.push_back({ "HeightFieldErosion::Thermal/n=2048", "cells", reset, [erosion] { (*erosion)->Thermal(1); return (long long)n * n; } });
+        cases.push_back({ "HeightFieldErosion::Hydraulic/n=2048", "cells", reset, [erosion] { (*erosion)->Hydraulic(1); return (long long)n * n; } });
+    }
+
+    return cases;
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+        "Usage: tinymesh-bench [--filter text] [--time seconds] [--output file] [--list]\n"
+        "  --filter text    Only run the cases whose name contains the text\n"
+        "  --time seconds   Minimum time per case, 0.2 by default\n"
+        "  --output file    Write the results to a file rather than to the standard output\n"
+        "  --list           List the cases\n");
+}
+
+int main(int argc, char* argv[])
+{
+    std::string filter;
+    std::string output;
+    double minimum = 0.2;
+    bool list = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+            minimum = atof(argv[++i]);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--list") == 0)
+            list = true;
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    // Temporary files are named after the run, so that concurrent runs do not share them,
+    // and are removed with the cases whatever the exit path
+    const unsigned long long run = (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count() ^ std::random_device()();
+    const std::string prefix = (std::filesystem::temp_directory_path() / ("tinymesh-bench-" + std::to_string(run) + "-")).string();
+    std::vector<Case> cases = Cases(prefix);
+    if (list)
+    {
+        for (const Case& c : cases)
+            printf("%s\n", c.name.c_str());
+        return 0;
+    }
+
+    FILE* out = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (out == nullptr)
+    {
+        fprintf(stderr, "Cannot write %s\n", output.c_str());
+        return 1;
+    }
+
+    // One object per case, so that successive runs can be compared case by case
+    fprintf(out, "{\n  \"context\": { \"threads\": %u, \"build\": \"%s\", \"minimum_time\": %g },\n  \"benchmarks\": [\n",
+        std::thread::hardware_concurrency(),
+        TINYMESH_BUILD_TYPE,
+        minimum);
+    bool first = true;
+    for (const Case& c : cases)
+    {
+        if (!filter.empty() && c.name.find(filter) == std::string::npos)
+            continue;
+        const Result r = Run(c, minimum);
+        fprintf(out, "%s    { \"name\": \"%s\", \"iterations\": %lld, \"ns_per_iteration\": %.1f, \"%s_per_second\": %.6g, \"allocations_per_iteration\": %.1f, \"bytes_per_iteration\": %.1f }",
+            first ? "" : ",\n", c.name.c_str(), r.iterations, r.time, c.unit.c_str(), r.throughput, r.allocations, r.bytes);
+        fflush(out);
+        if (!output.empty())
+            fprintf(stderr, "%-28s %12.1f ns %12.4g %s/s\n", c.name.c_str(), r.time, r.throughput, c.unit.c_str());
+        first = false;
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,355 @@
+// Command line tool generating, transforming and saving meshes without any window
+
+#include "mesh.h"
+#include "implicits.h"
+#include "height_field.h"
+#include "height_field_rtin.h"
+#include "height_field_erosion.h"
+#include "rasterizer.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+//! Stage of the pipeline, and its duration.
+struct Stage
+{
+    std::string name;   //!< Name of the stage, as given on the command line.
+    double time;        //!< Duration, in milliseconds.
+};
+
+static void Usage()
+{
+    fprintf(stderr,
+        "Usage: tinymesh-cli <stage> [arguments] [<stage> [arguments]...]\n"
+        "Stages are run in order on the current mesh, and their timings are printed as JSON.\n"
+        "\n"
+        "Generation, replacing the current mesh:\n"
+        "  box <r>                 Box with half side r\n"
+        "  disc <r> <n>            Disc of radius r with n subdivisions\n"
+        "  cone <r> <h> <n>        Cone of radius r and height h\n"
+        "  cylinder <r> <h> <n>    Cylinder of radius r and height h\n"
+        "  sphere <r> <n>          Sphere of radius r\n"
+        "  tore <r> <R> <n>        Torus of radii r and R\n"
+        "  capsule <r> <h> <n>     Capsule of radius r and height h\n"
+        "  implicit <n>            Polygonize the unit sphere field with n cells per axis\n"
+        "  heightfield <file> <s> [--error <e>]\n"
+        "                          Height field from a PGM image or a tiled .hft file, with vertical scale s,\n"
+        "                          triangulated within the vertical error e by a RTIN if given\n"
+        "  load <file>             Load an .obj file\n"
+        "\n"
+        "Height field, from the last heightfield stage:\n"
+        "  erode <thermal|hydraulic> <n>\n"
+        "                          Run n iterations of erosion, the mesh is left unchanged\n"
+        "  mesh [--error <e>]      Mesh the height field, as the heightfield stage\n"
+        "  cracks                  Fail if the mesh of the height field is not watertight\n"
+        "\n"
+        "Transformation:\n"
+        "  translate <x> <y> <z>   Translate\n"
+        "  scale <s>               Scale uniformly\n"
+        "  rotate <x|y|z> <a>      Rotate around an axis, angle in degrees\n"
+        "  warp <x> <y> <z> <r> <f> Warp inside a sphere\n"
+        "  smooth                  Compute smooth normals\n"
+        "\n"
+        "Output:\n"
+        "  save <file>             Save as an .obj file\n"
+        "  render <file> <w> <h> <ex> <ey> <ez> <ax> <ay> <az>\n"
+        "                          Render a PPM image with the software rasterizer, eye at e looking at a\n"
+        "  tiles <pgm> <hft> <s>   Convert a PGM image to a tiled .hft file with tiles of s x s samples\n"
+        "\n"
+        "Options:\n"
+        "  --trace <file>          Save the traced zones as a Chrome trace, if compiled with TINYMESH_TRACING\n");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        Usage();
+        return 1;
+    }
+
+    Mesh mesh;
+    HeightField field;
+    std::vector<Stage> stages;
+    std::string trace;
+    auto begin = std::chrono::high_resolution_clock::now();
+
+    int i = 1;
+    // Return the next argument, or exit if the stage lacks arguments
+    auto next = [&](const char* stage) -> const char*
+        {
+            if (i >= argc)
+            {
+                fprintf(stderr, "Missing argument for stage %s\n", stage);
+                exit(1);
+            }
+            return argv[i++];
+        };
+    auto real = [&](const char* stage) { return atof(next(stage)); };
+    auto integer = [&](const char* stage) { return atoi(next(stage)); };
+    // Optional error threshold of height field meshes, negative if the full grid is meshed
+    auto error = [&](const char* stage)
+        {
+            if (i >= argc || strcmp(argv[i], "--error") != 0)
+                return -1.0;
+            i++;
+            return real(stage);
+        };
+    // Mesh the current height field
+    auto grid = [&](double e)
+        {
+            mesh = e < 0.0 ? field.get_mesh() : HeightFieldRTIN(field).GetMesh(e);
+            return field.TileFailures() == 0;
+        };
+
+    while (i < argc)
+    {
+        const char* stage = argv[i++];
+        const std::string name = stage;
+
+        if (name == "--trace")
+        {
+            trace = next(stage);
+            Trace::Start();
+            continue;
+        }
+
+        // Arguments are parsed before the stage is timed
+        std::function<bool()> run;
+        if (name == "box")
+        {
+            const double r = real(stage);
+            run = [&, r] { mesh = Mesh(Box(r)); return true; };
+        }
+        else if (name == "disc")
+        {
+            const double r = real(stage);
+            const int n = integer(stage);
+            run = [&, r, n] { mesh = Mesh(Disc(r), n); return true; };
+        }
+        else if (name == "cone" || name == "cylinder" || name == "capsule" || name == "tore")
+        {
+            const double a = real(stage);
+            const double b = real(stage);
+            const int n = integer(stage);
+            run = [&, name, a, b, n]
+                {
+                    if (name == "cone")
+                        mesh = Mesh(Cone(a, b), n);
+                    else if (name == "cylinder")
+                        mesh = Mesh(Cylinder(a, b), n);
+                    else if (name == "capsule")
+                        mesh = Mesh(Capsule(a, b), n);
+                    else
+                        mesh = Mesh(Tore(a, b), n);
+                    return true;
+                };
+        }
+        else if (name == "sphere")
+        {
+            const double r = real(stage);
+            const int n = integer(stage);
+            run = [&, r, n] { mesh = Mesh(Sphere(r), n); return true; };
+        }
+        else if (name == "implicit")
+        {
+            const int n = integer(stage);
+            run = [&, n]
+                {
+                    mesh = Mesh();
+                    AnalyticScalarField().Polygonize(n, mesh, Box(2.0));
+                    return true;
+                };
+        }
+        else if (name == "heightfield")
+        {
+            const std::string file = next(stage);
+            const double s = real(stage);
+            const double e = error(stage);
+            run = [&, file, s, e]
+                {
+                    field = HeightField();
+                    const size_t dot = file.rfind('.');
+                    if (dot != std::string::npos && file.substr(dot) == ".hft")
+                        field.load_tiles(file.c_str());
+                    else
+                        field.load(file.c_str());
+                    if (field.SizeX() < 2 || field.SizeY() < 2)
+                        return false;
+                    field.set_scale(s);
+                    return grid(e);
+                };
+        }
+        else if (name == "erode")
+        {
+            const std::string mode = next(stage);
+            const int n = integer(stage);
+            if (mode != "thermal" && mode != "hydraulic")
+            {
+                fprintf(stderr, "Unknown erosion %s\n", mode.c_str());
+                return 1;
+            }
+            run = [&, mode, n]
+                {
+                    if (field.SizeX() < 2 || field.SizeY() < 2)
+                        return false;
+                    HeightFieldErosion erosion(field);
+                    if (mode == "thermal")
+                        erosion.Thermal(n);
+                    else
+                        erosion.Hydraulic(n);
+                    field = erosion.GetHeightField();
+                    return true;
+                };
+        }
+        else if (name == "mesh")
+        {
+            const double e = error(stage);
+            run = [&, e] { return field.SizeX() >= 2 && field.SizeY() >= 2 && grid(e); };
+        }
+        else if (name == "cracks")
+        {
+            run = [&]
+                {
+                    const int n = HeightFieldRTIN::Cracks(field, mesh);
+                    if (n > 0)
+                        fprintf(stderr, "%d edges are not shared by the expected number of triangles\n", n);
+                    return n == 0;
+                };
+        }
+        else if (name == "load")
+        {
+            const std::string file = next(stage);
+            run = [&, file] { return mesh.Load(file); };
+        }
+        else if (name == "translate")
+        {
+            const double x = real(stage);
+            const double y = real(stage);
+            const double z = real(stage);
+            run = [&, x, y, z] { mesh.Translate(Vector(x, y, z)); return true; };
+        }
+        else if (name == "scale")
+        {
+            const double s = real(stage);
+            run = [&, s] { mesh.Scale(s); return true; };
+        }
+        else if (name == "rotate")
+        {
+            const std::string axis = next(stage);
+            const double a = Math::DegreeToRadian(real(stage));
+            if (axis != "x" && axis != "y" && axis != "z")
+            {
+                fprintf(stderr, "Unknown axis %s\n", axis.c_str());
+                return 1;
+            }
+            run = [&, axis, a]
+                {
+                    if (axis == "x")
+                        mesh.RotateX(a);
+                    else if (axis == "y")
+                        mesh.RotateY(a);
+                    else
+                        mesh.RotateZ(a);
+                    return true;
+                };
+        }
+        else if (name == "warp")
+        {
+            const double x = real(stage);
+            const double y = real(stage);
+            const double z = real(stage);
+            const double r = real(stage);
+            const double f = real(stage);
+            run = [&, x, y, z, r, f] { mesh.SphereWarp(Sphere(Vector(x, y, z), r), f); return true; };
+        }
+        else if (name == "smooth")
+        {
+            run = [&] { mesh.SmoothNormals(); return true; };
+        }
+        else if (name == "save")
+        {
+            const std::string file = next(stage);
+            run = [&, file] { return mesh.SaveObj(file, "TinyMesh"); };
+        }
+        else if (name == "tiles")
+        {
+            const std::string input = next(stage);
+            const std::string output = next(stage);
+            const int s = integer(stage);
+            run = [input, output, s]
+                {
+                    HeightField field;
+                    field.load(input.c_str());
+                    return field.SizeX() > 0 && HeightFieldTiles::Save(output.c_str(), field, s);
+                };
+        }
+        else if (name == "render")
+        {
+            const std::string file = next(stage);
+            const int w = integer(stage);
+            const int h = integer(stage);
+            double v[6];
+            for (double& x : v)
+                x = real(stage);
+            if (w <= 0 || h <= 0)
+            {
+                fprintf(stderr, "Invalid image size %dx%d\n", w, h);
+                return 1;
+            }
+            run = [&, file, w, h, v]
+                {
+                    // Planes enclose the mesh seen from the eye
+                    Camera camera(Vector(v[0], v[1], v[2]), Vector(v[3], v[4], v[5]));
+                    const Box box = mesh.GetBox();
+                    const double far = Norm(box.Center() - camera.Eye()) + 0.5 * Norm(box.Diagonal());
+                    camera.SetPlanes(far * 1e-3, far);
+
+                    Rasterizer rasterizer(w, h);
+                    rasterizer.SetCamera(camera);
+                    rasterizer.Clear();
+                    rasterizer.Draw(mesh);
+                    return rasterizer.SavePPM(file.c_str());
+                };
+        }
+        else
+        {
+            fprintf(stderr, "Unknown stage %s\n", stage);
+            Usage();
+            return 1;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        const bool done = run();
+        auto stop = std::chrono::high_resolution_clock::now();
+        if (!done)
+        {
+            fprintf(stderr, "Stage %s failed\n", stage);
+            return 1;
+        }
+        stages.push_back({ name, std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0 });
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    if (!trace.empty() && !Trace::Save(trace))
+    {
+        fprintf(stderr, "Cannot write trace %s\n", trace.c_str());
+        return 1;
+    }
+
+    // Timings
+    printf("{\n  \"stages\": [\n");
+    for (size_t k = 0; k < stages.size(); k++)
+        printf("    { \"name\": \"%s\", \"ms\": %.3f }%s\n", stages[k].name.c_str(), stages[k].time, k + 1 < stages.size() ? "," : "");
+    printf("  ],\n");
+    printf("  \"vertices\": %d,\n  \"triangles\": %d,\n", mesh.Vertexes(), mesh.Triangles());
+    printf("  \"total_ms\": %.3f\n}\n", std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000.0);
+    return 0;
+}
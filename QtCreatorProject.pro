@@ -4,6 +4,9 @@ greaterThan(QT_MAJOR_VERSION, 5): QT += openglwidgets
 
 CONFIG += c++11
 
+# Uncomment to record the traced zones, saved with --trace
+# DEFINES += TINYMESH_TRACING
+
 INCLUDEPATH += AppTinyMesh/Include
 INCLUDEPATH += $$(GLEW_DIR)
 INCLUDEPATH += $$(OUT_PWD)
@@ -13,44 +16,73 @@ VPATH += AppTinyMesh
 SOURCES += \
     AppTinyMesh/Source/box.cpp \
     AppTinyMesh/Source/capsule.cpp \
+    AppTinyMesh/Source/command_queue.cpp \
     AppTinyMesh/Source/cone.cpp \
     AppTinyMesh/Source/cylinder.cpp \
     AppTinyMesh/Source/disc.cpp \
     AppTinyMesh/Source/evector.cpp \
+    AppTinyMesh/Source/frustum.cpp \
+    AppTinyMesh/Source/gpu_buffer_pool.cpp \
     AppTinyMesh/Source/height_field.cpp \
+    AppTinyMesh/Source/height_field_erosion.cpp \
+    AppTinyMesh/Source/height_field_lod.cpp \
+    AppTinyMesh/Source/height_field_rtin.cpp \
+    AppTinyMesh/Source/height_field_tiles.cpp \
+    AppTinyMesh/Source/image_writer.cpp \
     AppTinyMesh/Source/implicits.cpp \
+    AppTinyMesh/Source/job_pool.cpp \
     AppTinyMesh/Source/main.cpp \
     AppTinyMesh/Source/camera.cpp \
+    AppTinyMesh/Source/camera_path.cpp \
     AppTinyMesh/Source/matrix.cpp \
     AppTinyMesh/Source/mesh.cpp \
+    AppTinyMesh/Source/mesh_lod.cpp \
     AppTinyMesh/Source/meshcolor.cpp \
     AppTinyMesh/Source/mesh-widget.cpp \
+    AppTinyMesh/Source/occlusion.cpp \
     AppTinyMesh/Source/qtemainwindow.cpp \
+    AppTinyMesh/Source/rasterizer.cpp \
     AppTinyMesh/Source/ray.cpp \
     AppTinyMesh/Source/shader-api.cpp \
     AppTinyMesh/Source/sphere.cpp \
     AppTinyMesh/Source/tore.cpp \
+    AppTinyMesh/Source/trace.cpp \
     AppTinyMesh/Source/triangle.cpp \
 
 HEADERS += \
     AppTinyMesh/Include/box.h \
     AppTinyMesh/Include/camera.h \
+    AppTinyMesh/Include/camera_path.h \
     AppTinyMesh/Include/capsule.h \
     AppTinyMesh/Include/color.h \
+    AppTinyMesh/Include/command_queue.h \
     AppTinyMesh/Include/cone.h \
     AppTinyMesh/Include/cylinder.h \
     AppTinyMesh/Include/disc.h \
+    AppTinyMesh/Include/frustum.h \
+    AppTinyMesh/Include/gpu_buffer_pool.h \
     AppTinyMesh/Include/height_field.h \
+    AppTinyMesh/Include/height_field_erosion.h \
+    AppTinyMesh/Include/height_field_lod.h \
+    AppTinyMesh/Include/height_field_rtin.h \
+    AppTinyMesh/Include/height_field_tiles.h \
+    AppTinyMesh/Include/image_writer.h \
     AppTinyMesh/Include/implicits.h \
+    AppTinyMesh/Include/job_pool.h \
     AppTinyMesh/Include/mathematics.h \
     AppTinyMesh/Include/matrix.h \
     AppTinyMesh/Include/mesh.h \
+    AppTinyMesh/Include/mesh_lod.h \
     AppTinyMesh/Include/meshcolor.h \
+    AppTinyMesh/Include/occlusion.h \
     AppTinyMesh/Include/qte.h \
+    AppTinyMesh/Include/rasterizer.h \
     AppTinyMesh/Include/realtime.h \
     AppTinyMesh/Include/shader-api.h \
+    AppTinyMesh/Include/slot_map.h \
     AppTinyMesh/Include/sphere.h \
-    AppTinyMesh/Include/tore.h
+    AppTinyMesh/Include/tore.h \
+    AppTinyMesh/Include/trace.h
 
 FORMS += \
     AppTinyMesh/UI/interface.ui